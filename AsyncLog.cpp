@@ -0,0 +1,151 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "AsyncLog.h"
+
+#include <stdio.h>
+
+// Time between two drains of the rings
+const DWORD DRAIN_PERIOD = 50;
+
+static __declspec(thread) void* gLogRing = nullptr;
+
+static FILE*  gLogFile = nullptr;
+static HANDLE gLogThread = NULL;
+
+AsyncLog::Ring*  AsyncLog::_rings[MAX_LOG_THREADS];
+volatile LONG    AsyncLog::_nbRings = 0;
+volatile LONG    AsyncLog::_nbDropped = 0;
+int              AsyncLog::_level = 1;
+
+void AsyncLog::start( const char* fileName )
+{
+   if( gLogThread ) return;
+   gLogFile = fopen( fileName, "a" );
+   gLogThread = CreateThread( NULL, 0, drainThread, NULL, 0, NULL );
+}
+
+AsyncLog::Ring* AsyncLog::getRing()
+{
+   Ring* ring = static_cast<Ring*>(gLogRing);
+   if( ring ) return ring;
+
+   // First message of the thread, its ring is registered for the drain
+   // thread. Threads beyond the limit do not log.
+   const LONG index = InterlockedIncrement( &_nbRings )-1;
+   if( index>=MAX_LOG_THREADS ) return nullptr;
+   ring = new Ring;
+   ring->thread = GetCurrentThreadId();
+   gLogRing = ring;
+   MemoryBarrier();
+   _rings[index] = ring;
+   return ring;
+}
+
+std::ostream* AsyncLog::begin( const int level )
+{
+   if( level>_level ) return nullptr;
+   Ring* ring = getRing();
+   if( !ring ) return nullptr;
+   if( ring->head-ring->tail>=LOG_RING_SIZE )
+   {
+      InterlockedIncrement( &_nbDropped );
+      return nullptr;
+   }
+
+   Record& record = ring->records[ring->head&(LOG_RING_SIZE-1)];
+   ring->buffer.reset( record.text, LOG_RECORD_SIZE );
+   ring->stream.clear();
+   return &ring->stream;
+}
+
+void AsyncLog::commit()
+{
+   Ring* ring = static_cast<Ring*>(gLogRing);
+   Record& record = ring->records[ring->head&(LOG_RING_SIZE-1)];
+   record.text[ring->buffer.length()] = 0;
+   GetSystemTimeAsFileTime( &record.time );
+
+   // The record has to be complete before the drain thread can see it
+   MemoryBarrier();
+   ring->head = ring->head+1;
+}
+
+bool AsyncLog::drain()
+{
+   bool drained(false);
+   const LONG nbRings = (_nbRings<MAX_LOG_THREADS) ? _nbRings : MAX_LOG_THREADS;
+   for( LONG r(0); r<nbRings; ++r )
+   {
+      Ring* ring = _rings[r];
+      if( !ring ) continue;
+      const LONG head = ring->head;
+      MemoryBarrier();
+      while( ring->tail!=head )
+      {
+         const Record& record = ring->records[ring->tail&(LOG_RING_SIZE-1)];
+         FILETIME local;
+         SYSTEMTIME time;
+         FileTimeToLocalFileTime( &record.time, &local );
+         FileTimeToSystemTime( &local, &time );
+         char line[LOG_RECORD_SIZE+64];
+         sprintf( line, "%04d-%02d-%02d %02d:%02d:%02d.%03d [%lu] %s\n",
+            time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute, time.wSecond, time.wMilliseconds,
+            ring->thread, record.text );
+         if( gLogFile ) fputs( line, gLogFile );
+         fputs( line, stdout );
+
+         // The thread may reuse the record from now on
+         MemoryBarrier();
+         ring->tail = ring->tail+1;
+         drained = true;
+      }
+   }
+   return drained;
+}
+
+DWORD WINAPI AsyncLog::drainThread( LPVOID param )
+{
+   LONG reported(0);
+   while( true )
+   {
+      bool drained = drain();
+      const LONG dropped = _nbDropped;
+      if( dropped!=reported )
+      {
+         fprintf( gLogFile ? gLogFile : stdout, "%ld log messages dropped so far\n", dropped );
+         reported = dropped;
+         drained = true;
+      }
+      if( drained )
+      {
+         if( gLogFile ) fflush( gLogFile );
+         fflush( stdout );
+      }
+      Sleep( DRAIN_PERIOD );
+   }
+   return 0;
+}
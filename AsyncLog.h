@@ -0,0 +1,118 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#pragma once
+
+#include <windows.h>
+
+#include <ostream>
+#include <streambuf>
+
+#include <Logging.h>
+
+/*
+________________________________________________________________________________
+
+Asynchronous logging
+
+LOG_INFO and LOG_ERROR format straight into a ring of fixed size records
+owned by the calling thread. A background thread drains the rings of all
+threads to the log file and the console. Each ring has a single producer and
+a single consumer, so publishing a record is a memory barrier and an index
+update: the event loop never waits for the disk or the console. When a ring
+is full the message is dropped and counted, instead of blocking.
+
+The macros replace the synchronous ones of Logging.h for the server's own
+code. Records are truncated to LOG_RECORD_SIZE characters. Messages above the
+level set with setLevel (1 by default, errors are 0) are not even formatted.
+________________________________________________________________________________
+*/
+class AsyncLog
+{
+public:
+   static const int LOG_RECORD_SIZE = 240;
+   static const int LOG_RING_SIZE   = 256; // Records per thread, power of 2
+   static const int MAX_LOG_THREADS = 16;
+
+public:
+   // Starts the drain thread. Messages logged before are kept in the rings.
+   static void start( const char* fileName );
+
+   // Most detailed level that is logged
+   static void setLevel( const int level ) { _level = level; }
+
+   // Stream writing into the next free record of the calling thread, null if
+   // the level is not logged or the ring is full
+   static std::ostream* begin( const int level );
+
+   // Publishes the record opened by begin
+   static void commit();
+
+   static LONG getNbDropped() { return _nbDropped; }
+
+private:
+   class RecordBuffer : public std::streambuf
+   {
+   public:
+      void reset( char* buffer, const int size ) { setp( buffer, buffer+size-1 ); }
+      size_t length() const { return pptr()-pbase(); }
+   };
+
+   struct Record
+   {
+      FILETIME time;
+      char     text[LOG_RECORD_SIZE];
+   };
+
+   struct Ring
+   {
+      Ring() : head(0), tail(0), stream(&buffer) {}
+
+      DWORD          thread;
+      volatile LONG  head;   // Next record written by the thread
+      volatile LONG  tail;   // Next record drained
+      Record         records[LOG_RING_SIZE];
+      RecordBuffer   buffer;
+      std::ostream   stream;
+   };
+
+   static Ring* getRing();
+   static bool drain();
+   static DWORD WINAPI drainThread( LPVOID param );
+
+private:
+   static Ring*         _rings[MAX_LOG_THREADS];
+   static volatile LONG _nbRings;
+   static volatile LONG _nbDropped;
+   static int           _level;
+};
+
+#undef LOG_INFO
+#undef LOG_ERROR
+
+#define LOG_INFO( __level, __msg ) \
+   { std::ostream* __log = AsyncLog::begin( __level ); if( __log ) { *__log << __msg; AsyncLog::commit(); } }
+
+#define LOG_ERROR( __msg ) \
+   { std::ostream* __log = AsyncLog::begin( 0 ); if( __log ) { *__log << "ERROR: " << __msg; AsyncLog::commit(); } }
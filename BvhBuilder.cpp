@@ -0,0 +1,290 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#include "BvhBuilder.h"
+
+#include <algorithm>
+
+const int BVH_NB_BINS = 16;
+
+// Cost of testing a node, relative to testing an item
+const float BVH_TRAVERSAL_COST = 1.f;
+
+static float getArea( const float* bounds )
+{
+   const float dx = bounds[3]-bounds[0];
+   const float dy = bounds[4]-bounds[1];
+   const float dz = bounds[5]-bounds[2];
+   return (dx<0.f) ? 0.f : 2.f*(dx*dy+dy*dz+dz*dx);
+}
+
+static void resetBounds( float* bounds )
+{
+   bounds[0] = bounds[1] = bounds[2] = 1e30f;
+   bounds[3] = bounds[4] = bounds[5] = -1e30f;
+}
+
+static void growBounds( float* bounds, const float* other )
+{
+   for( int a(0); a<3; ++a )
+   {
+      bounds[a]   = std::min( bounds[a], other[a] );
+      bounds[a+3] = std::max( bounds[a+3], other[a+3] );
+   }
+}
+
+struct ItemCentroidLess
+{
+   int axis;
+   ItemCentroidLess( int a ) : axis(a) {}
+   bool operator()( const BvhBuilder::Item& a, const BvhBuilder::Item& b ) const { return a.centroid[axis]<b.centroid[axis]; }
+};
+
+BvhBuilder::BvhBuilder( const int nbThreads, const int maxLeafSize )
+ : _nbThreads(nbThreads), _maxLeafSize(maxLeafSize), _minTaskSize(0), _items(nullptr), _tasks(nullptr), _nextTask(0)
+{
+   if( _nbThreads<=0 )
+   {
+      SYSTEM_INFO info;
+      GetSystemInfo( &info );
+      _nbThreads = static_cast<int>(info.dwNumberOfProcessors);
+   }
+}
+
+void BvhBuilder::build( std::vector<Item>& items, std::vector<Node>& nodes )
+{
+   nodes.clear();
+   if( items.empty() ) return;
+   nodes.reserve( 2*items.size()/_maxLeafSize+1 );
+
+   // Enough subtrees for each thread to get several of them
+   std::vector<Task> tasks;
+   _minTaskSize = std::max( static_cast<int>(items.size()/(_nbThreads*4)), 1024 );
+   buildNode( items, 0, static_cast<int>(items.size()), 0, nodes, (_nbThreads>1) ? &tasks : nullptr );
+   if( tasks.empty() ) return;
+
+   _items    = &items;
+   _tasks    = &tasks;
+   _nextTask = 0;
+   std::vector<HANDLE> threads;
+   const int nbThreads = std::min( _nbThreads, static_cast<int>(tasks.size()) );
+   for( int i(1); i<nbThreads; ++i )
+   {
+      threads.push_back( CreateThread( NULL, 0, taskThread, this, 0, NULL ) );
+   }
+   taskThread( this );
+   for( size_t i(0); i<threads.size(); ++i )
+   {
+      WaitForSingleObject( threads[i], INFINITE );
+      CloseHandle( threads[i] );
+   }
+   _items = nullptr;
+   _tasks = nullptr;
+
+   // Subtree roots replace their placeholders, the other nodes are appended
+   for( size_t t(0); t<tasks.size(); ++t )
+   {
+      const Task& task = tasks[t];
+      const int offset = static_cast<int>(nodes.size())-1;
+      for( size_t i(0); i<task.nodes.size(); ++i )
+      {
+         Node node = task.nodes[i];
+         if( node.count==0 )
+         {
+            node.left  += offset;
+            node.right += offset;
+         }
+         if( i==0 ) nodes[task.node] = node;
+         else nodes.push_back( node );
+      }
+   }
+}
+
+DWORD WINAPI BvhBuilder::taskThread( LPVOID param )
+{
+   BvhBuilder* self = static_cast<BvhBuilder*>(param);
+   std::vector<Task>& tasks = *self->_tasks;
+   LONG index;
+   while( (index = InterlockedIncrement( &self->_nextTask )-1)<static_cast<LONG>(tasks.size()) )
+   {
+      // Items are shared, but each task only touches its own range of them
+      Task& task = tasks[index];
+      self->buildNode( *self->_items, task.first, task.last, task.depth, task.nodes, nullptr );
+   }
+   return 0;
+}
+
+int BvhBuilder::buildNode( std::vector<Item>& items, const int first, const int last, const int depth,
+   std::vector<Node>& nodes, std::vector<Task>* tasks )
+{
+   const int index = static_cast<int>(nodes.size());
+   nodes.push_back( Node() );
+
+   Node node;
+   resetBounds( node.bounds );
+   for( int i(first); i<last; ++i ) growBounds( node.bounds, items[i].bounds );
+   node.left  = 0;
+   node.right = 0;
+   node.first = first;
+   node.count = 0;
+   node.axis  = 0;
+
+   const int count = last-first;
+   if( tasks && count<=_minTaskSize && count>_maxLeafSize )
+   {
+      // Placeholder for a subtree built by the threads
+      Task task;
+      task.node  = index;
+      task.depth = depth;
+      task.first = first;
+      task.last  = last;
+      tasks->push_back( task );
+      nodes[index] = node;
+      return index;
+   }
+
+   Split split;
+   int middle(first);
+   const bool balanced = (depth>=MAX_DEPTH-32); // Halves never go deeper than 32 more levels
+   if( count>1 && !balanced && findSplit( items, first, last, getArea(node.bounds), split ) &&
+       (split.cost<count || count>_maxLeafSize) )
+   {
+      middle = partition( items, first, last, split );
+      node.axis = split.axis;
+   }
+   if( middle==first || middle==last )
+   {
+      if( count<=_maxLeafSize )
+      {
+         node.count = count;
+         nodes[index] = node;
+         return index;
+      }
+
+      // Centroids all in one bin, or too deep: halves of the items
+      for( int a(1); a<3; ++a )
+      {
+         if( node.bounds[a+3]-node.bounds[a]>node.bounds[node.axis+3]-node.bounds[node.axis] ) node.axis = a;
+      }
+      middle = (first+last)/2;
+      std::nth_element( items.begin()+first, items.begin()+middle, items.begin()+last, ItemCentroidLess(node.axis) );
+   }
+
+   // Children are built before the node is stored, they may move the array
+   const int left  = buildNode( items, first, middle, depth+1, nodes, tasks );
+   const int right = buildNode( items, middle, last, depth+1, nodes, tasks );
+   node.left  = left;
+   node.right = right;
+   nodes[index] = node;
+   return index;
+}
+
+int BvhBuilder::getBin( const Item& item, const Split& split )
+{
+   const int bin = static_cast<int>((item.centroid[split.axis]-split.minimum)*split.scale);
+   return (bin<0) ? 0 : (bin>=BVH_NB_BINS) ? BVH_NB_BINS-1 : bin;
+}
+
+bool BvhBuilder::findSplit( const std::vector<Item>& items, const int first, const int last, const float area, Split& split ) const
+{
+   float centroids[6];
+   resetBounds( centroids );
+   for( int i(first); i<last; ++i )
+   {
+      for( int a(0); a<3; ++a )
+      {
+         centroids[a]   = std::min( centroids[a], items[i].centroid[a] );
+         centroids[a+3] = std::max( centroids[a+3], items[i].centroid[a] );
+      }
+   }
+
+   bool found(false);
+   split.cost = 1e30f;
+   for( int axis(0); axis<3; ++axis )
+   {
+      const float extent = centroids[axis+3]-centroids[axis];
+      if( extent<=0.f ) continue;
+
+      Split candidate;
+      candidate.axis    = axis;
+      candidate.minimum = centroids[axis];
+      candidate.scale   = BVH_NB_BINS/extent;
+
+      int   counts[BVH_NB_BINS];
+      float bounds[BVH_NB_BINS][6];
+      for( int b(0); b<BVH_NB_BINS; ++b )
+      {
+         counts[b] = 0;
+         resetBounds( bounds[b] );
+      }
+      for( int i(first); i<last; ++i )
+      {
+         const int bin = getBin( items[i], candidate );
+         counts[bin]++;
+         growBounds( bounds[bin], items[i].bounds );
+      }
+
+      // Right side areas from the last bin back, then the left side sweep
+      float rightArea[BVH_NB_BINS];
+      int   rightCount[BVH_NB_BINS];
+      float box[6];
+      resetBounds( box );
+      int total(0);
+      for( int b(BVH_NB_BINS-1); b>0; --b )
+      {
+         growBounds( box, bounds[b] );
+         total += counts[b];
+         rightArea[b]  = getArea( box );
+         rightCount[b] = total;
+      }
+      resetBounds( box );
+      total = 0;
+      for( int b(0); b<BVH_NB_BINS-1; ++b )
+      {
+         growBounds( box, bounds[b] );
+         total += counts[b];
+         if( total==0 || rightCount[b+1]==0 ) continue;
+         const float cost = BVH_TRAVERSAL_COST+(getArea(box)*total+rightArea[b+1]*rightCount[b+1])/area;
+         if( cost<split.cost )
+         {
+            candidate.bin  = b;
+            candidate.cost = cost;
+            split = candidate;
+            found = true;
+         }
+      }
+   }
+   return found;
+}
+
+int BvhBuilder::partition( std::vector<Item>& items, const int first, const int last, const Split& split ) const
+{
+   int left(first), right(last-1);
+   while( left<=right )
+   {
+      if( getBin( items[left], split )<=split.bin ) ++left;
+      else std::swap( items[left], items[right--] );
+   }
+   return left;
+}
@@ -0,0 +1,114 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+#include <windows.h>
+
+#include <vector>
+
+/*
+________________________________________________________________________________
+
+Bounding volume hierarchy builder
+
+Binned surface area heuristic: at each node the centroids are sorted into 16
+bins along each axis, and the node is split at the bin boundary that
+minimizes the expected cost of a ray going through it. Nodes become leaves
+when splitting is no cheaper than testing their items, or when they are small
+enough.
+
+The top of the tree is split on the calling thread until there are enough
+subtrees for the threads, which then build the subtrees side by side. Each
+subtree works on its own range of the items, so they share nothing.
+________________________________________________________________________________
+*/
+class BvhBuilder
+{
+public:
+   // Deepest hierarchy built, nodes below this depth are split in halves
+   static const int MAX_DEPTH = 96;
+
+   struct Item
+   {
+      float bounds[6];   // Min x, y, z then max x, y, z
+      float centroid[3];
+      int   index;       // Of the item in the caller's list
+   };
+
+   struct Node
+   {
+      float bounds[6];
+      int   left;        // Children of an inner node
+      int   right;
+      int   first;       // Items of a leaf
+      int   count;       // 0 for an inner node
+      int   axis;        // Of the split
+   };
+
+public:
+   // nbThreads 0 is one thread per core
+   BvhBuilder( const int nbThreads, const int maxLeafSize );
+
+   // Builds the hierarchy of the items, which are reordered so that each leaf
+   // has its items together. The root is node 0.
+   void build( std::vector<Item>& items, std::vector<Node>& nodes );
+
+private:
+   struct Task
+   {
+      int node;   // Placeholder in the top of the tree
+      int depth;
+      int first;
+      int last;
+      std::vector<Node> nodes;
+   };
+
+   // Items go left when their centroid falls in bin 'bin' or before
+   struct Split
+   {
+      int   axis;
+      int   bin;
+      float minimum;
+      float scale;
+      float cost;
+   };
+
+   int  buildNode( std::vector<Item>& items, const int first, const int last, const int depth,
+      std::vector<Node>& nodes, std::vector<Task>* tasks );
+   bool findSplit( const std::vector<Item>& items, const int first, const int last, const float area, Split& split ) const;
+   int  partition( std::vector<Item>& items, const int first, const int last, const Split& split ) const;
+   static int getBin( const Item& item, const Split& split );
+
+   static DWORD WINAPI taskThread( LPVOID param );
+
+private:
+   int _nbThreads;
+   int _maxLeafSize;
+   int _minTaskSize;  // Below this size, a subtree is built by a single thread
+
+   // Tasks of the build in progress
+   std::vector<Item>* _items;
+   std::vector<Task>* _tasks;
+   volatile LONG      _nextTask;
+};
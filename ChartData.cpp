@@ -0,0 +1,154 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#include "ChartData.h"
+#include "NumberParser.h"
+
+#include <string.h>
+
+ChartData::ChartData()
+{
+   clear();
+}
+
+void ChartData::clear()
+{
+   _values.clear();
+   _offsets.assign( 1, 0 );
+}
+
+void ChartData::endSeries()
+{
+   // Empty series (e.g. trailing separators) are ignored
+   if( static_cast<int>(_values.size())!=_offsets.back() )
+   {
+      _offsets.push_back( static_cast<int>(_values.size()) );
+   }
+}
+
+bool ChartData::parseText( const char* first, const char* last )
+{
+   // Rough estimate of the number of values to avoid reallocations on large
+   // series: one value every 3 characters.
+   _values.reserve( _values.size() + (last-first)/3+1 );
+
+   const char* p = first;
+   while( p<last )
+   {
+      const char c = *p;
+      if( c==',' || c==' ' || c=='\t' || c=='\r' )
+      {
+         ++p;
+      }
+      else if( c==';' || c=='\n' )
+      {
+         endSeries();
+         ++p;
+      }
+      else
+      {
+         float value;
+         const char* next = parseFloat( p, last, value );
+         if( next==p )
+         {
+            clear();
+            return false;
+         }
+         _values.push_back( value );
+         p = next;
+      }
+   }
+   endSeries();
+   return true;
+}
+
+bool ChartData::parseBinary( const unsigned char* data, const size_t length, const std::vector<int>& points )
+{
+   if( length%sizeof(float)!=0 ) return false;
+   const size_t nbValues = length/sizeof(float);
+
+   // Offsets are ints
+   if( nbValues>static_cast<size_t>(0x7FFFFFFF)-_values.size() ) return false;
+
+   // Counts come from the request, their sum must not wrap around
+   size_t expected(0);
+   for( size_t s(0); s<points.size(); ++s )
+   {
+      if( points[s]<0 || static_cast<size_t>(points[s])>nbValues-expected ) return false;
+      expected += points[s];
+   }
+   if( !points.empty() && expected!=nbValues ) return false;
+
+   // Little endian, same as the host
+   const size_t start = _values.size();
+   _values.resize( start+nbValues );
+   if( nbValues!=0 ) memcpy( &_values[start], data, length );
+
+   // Infinities and NaN cannot be drawn
+   for( size_t i(start); i<_values.size(); ++i )
+   {
+      if( !isFinite( _values[i] ) )
+      {
+         _values.resize( start );
+         return false;
+      }
+   }
+
+   if( points.empty() )
+   {
+      endSeries();
+   }
+   else
+   {
+      int offset = static_cast<int>(start);
+      for( size_t s(0); s<points.size(); ++s )
+      {
+         offset += points[s];
+         if( offset!=_offsets.back() ) _offsets.push_back( offset );
+      }
+   }
+   return true;
+}
+
+void ChartData::addSeries( const float* values, const int nbValues )
+{
+   _values.insert( _values.end(), values, values+nbValues );
+   endSeries();
+}
+
+void ChartData::resize( const int nbSeries, const int nbPoints )
+{
+   _values.assign( nbSeries*nbPoints, 0.f );
+   _offsets.resize( nbSeries+1 );
+   for( int s(0); s<=nbSeries; ++s ) _offsets[s] = s*nbPoints;
+}
+
+int ChartData::getMaxPoints() const
+{
+   int result(0);
+   for( int s(0); s<getNbSeries(); ++s )
+   {
+      if( getNbPoints(s)>result ) result = getNbPoints(s);
+   }
+   return result;
+}
@@ -0,0 +1,86 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+/*
+________________________________________________________________________________
+
+Chart data
+
+Values of all series are stored back to back in a single array, and series
+are delimited by offsets into that array. Any number of series of any length
+can be held without per-series allocations, and the whole data set can be
+compared or walked in one linear pass.
+
+Text input is a list of numbers separated by commas or spaces, series being
+separated by semicolons or line breaks (CSV rows):
+   values=12,18,25;8,14,11
+Binary input is a buffer of little endian 32 bit floats, split into series
+according to a list of point counts.
+________________________________________________________________________________
+*/
+class ChartData
+{
+public:
+   ChartData();
+
+   void clear();
+
+   // Appends the series found in [first,last). Returns false and leaves the
+   // data empty if anything else than numbers and separators is found.
+   bool parseText( const char* first, const char* last );
+
+   // Appends the series held in a float32 buffer. points lists the number of
+   // values of each series, a single series is assumed if it is empty.
+   bool parseBinary( const unsigned char* data, const size_t length, const std::vector<int>& points );
+
+   // Appends a series, values are copied
+   void addSeries( const float* values, const int nbValues );
+
+   // nbSeries series of nbPoints zeros
+   void resize( const int nbSeries, const int nbPoints );
+
+   bool  empty() const { return _values.empty(); }
+   int   getNbSeries() const { return static_cast<int>(_offsets.size())-1; }
+   int   getNbValues() const { return static_cast<int>(_values.size()); }
+   int   getNbPoints( const int s ) const { return _offsets[s+1]-_offsets[s]; }
+   int   getMaxPoints() const;
+   int   getOffset( const int s ) const { return _offsets[s]; }
+   float getValue( const int s, const int i ) const { return _values[_offsets[s]+i]; }
+   float getValue( const int index ) const { return _values[index]; }
+   void  setValue( const int index, const float value ) { _values[index] = value; }
+
+   // Same number of series with the same number of points
+   bool hasSameShape( const ChartData& other ) const { return _offsets==other._offsets; }
+
+private:
+   void endSeries();
+
+private:
+   std::vector<float> _values;
+   std::vector<int>   _offsets; // Series s is [_offsets[s], _offsets[s+1])
+};
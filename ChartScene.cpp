@@ -0,0 +1,447 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#include "ChartScene.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+// Unit column, scaled by the column size and value: front, back, right,
+// left and top sides
+static const float gColumnMesh[] = {
+   0.f, 0.f, 0.f,  1.f, 0.f, 0.f,  1.f, 1.f, 0.f,
+   1.f, 1.f, 0.f,  0.f, 1.f, 0.f,  0.f, 0.f, 0.f,
+   0.f, 0.f, 1.f,  1.f, 0.f, 1.f,  1.f, 1.f, 1.f,
+   1.f, 1.f, 1.f,  0.f, 1.f, 1.f,  0.f, 0.f, 1.f,
+   1.f, 0.f, 0.f,  1.f, 0.f, 1.f,  1.f, 1.f, 1.f,
+   1.f, 1.f, 1.f,  1.f, 1.f, 0.f,  1.f, 0.f, 0.f,
+   0.f, 0.f, 0.f,  0.f, 0.f, 1.f,  0.f, 1.f, 1.f,
+   0.f, 1.f, 1.f,  0.f, 1.f, 0.f,  0.f, 0.f, 0.f,
+   0.f, 1.f, 0.f,  1.f, 1.f, 0.f,  1.f, 1.f, 1.f,
+   1.f, 1.f, 1.f,  0.f, 1.f, 1.f,  0.f, 1.f, 0.f };
+
+ChartScene::ChartScene()
+ : _resident(false), _creating(false), _created(false), _chartType(ctColumn), _maxPoints(0),
+   _window(0), _count(0), _origin(0), _firstStatic(0), _lampX(0.f), _lampZ(0.f)
+{
+   _columnMesh = _batch.addMesh( gColumnMesh, 10 );
+}
+
+std::string ChartScene::getShapeKey( const int chartType, const ChartData& data )
+{
+   char buffer[64];
+   sprintf( buffer, "chart:%d:%d", chartType, data.getNbSeries() );
+   std::string key(buffer);
+   for( int s(0); s<data.getNbSeries(); ++s )
+   {
+      sprintf( buffer, ":%d", data.getNbPoints(s) );
+      key += buffer;
+   }
+   return key;
+}
+
+void ChartScene::reset()
+{
+   _resident = false;
+   _window = 0;
+   _count  = 0;
+   _origin = 0;
+   _values.clear();
+   _firstPrimitive.clear();
+}
+
+bool ChartScene::update( GPUKernel& kernel, const int chartType, const ChartData& data )
+{
+   _created = false;
+   if( !_resident || chartType!=_chartType || _window!=0 )
+   {
+      _chartType = chartType;
+      _window = 0;
+      _count  = 0;
+      _values = data;
+      build( kernel );
+      _resident = true;
+      _created  = true;
+      return true;
+   }
+
+   // Same shape is guaranteed by the scene key, but better safe than sorry
+   if( !data.hasSameShape(_values) ) return false;
+
+   _batch.clear();
+   for( int s(0); s<data.getNbSeries(); ++s )
+   {
+      const int offset   = data.getOffset(s);
+      const int nbPoints = data.getNbPoints(s);
+      for( int i(0); i<nbPoints; ++i )
+      {
+         const float value = data.getValue(offset+i);
+         if( value==_values.getValue(offset+i) ) continue;
+
+         _values.setValue( offset+i, value );
+         if( _chartType==ctArea )
+         {
+            // A value is shared by the segments on both of its sides
+            if( i>0 )          setSegment( s, i-1 );
+            if( i<nbPoints-1 ) setSegment( s, i );
+         }
+         else
+         {
+            setColumn( s, i );
+         }
+      }
+   }
+   if( _batch.empty() ) return false;
+
+   _batch.upload( kernel );
+   return true;
+}
+
+bool ChartScene::updateWindow( GPUKernel& kernel, const int chartType, const ChartData& ring, const int count )
+{
+   _created = false;
+   const int window = ring.getMaxPoints();
+   if( !_resident || chartType!=_chartType || window!=_window || !ring.hasSameShape(_values) || count<_count )
+   {
+      _chartType = chartType;
+      _window = window;
+      _count  = count;
+      _values = ring;
+      build( kernel );
+      _resident = true;
+      _created  = true;
+      return true;
+   }
+   if( count==_count ) return false;
+
+   // Only the last window of new points can be visible
+   const int first = (count-_count>_window) ? count-_window : _count;
+   const int previousWrap = (_count-1)/_window;
+   const bool wrapped = ((count-1)/_window != previousWrap);
+   _batch.clear();
+   _count = count;
+   for( int p(first); p<count; ++p )
+   {
+      const int slot = p%_window;
+      for( int s(0); s<ring.getNbSeries(); ++s )
+      {
+         _values.setValue( ring.getOffset(s)+slot, ring.getValue(s,slot) );
+      }
+   }
+
+   // Positions are rebased on the start of the window when the ring wraps
+   // around, which moves every slot
+   if( wrapped ) _origin = count-_window;
+   const int firstStaged = wrapped ? count-_window : first;
+   for( int p(firstStaged); p<count; ++p )
+   {
+      const int slot = p%_window;
+      for( int s(0); s<ring.getNbSeries(); ++s )
+      {
+         if( _chartType==ctArea )
+            setWindowSegment( s, slot );
+         else
+            setColumn( s, slot );
+      }
+   }
+
+   // The oldest segment of an area chart lost its left point
+   if( _chartType==ctArea && _count>_window && !wrapped )
+   {
+      for( int s(0); s<ring.getNbSeries(); ++s ) setWindowSegment( s, _count%_window );
+   }
+
+   // Ground and lamp follow the window
+   setStatic();
+
+   // Moved columns make the boxes grow. They are rebuilt each time the ring
+   // wraps around, which keeps the cost per point constant.
+   _created = wrapped;
+
+   _batch.upload( kernel );
+   return true;
+}
+
+float ChartScene::getWindowOffset() const
+{
+   return (_window!=0 && _count>_window) ? (_count-_window-_origin)*_columnSpacing.x : 0.f;
+}
+
+int ChartScene::getPoint( const int i ) const
+{
+   if( _window==0 || _count<=_window ) return i;
+   const int last = _count-1;
+   return last - (last%_window - i + _window)%_window;
+}
+
+float ChartScene::getPointX( const int point ) const
+{
+   return -(_columnSpacing.x*_maxPoints)/2.f + _columnSpacing.x/4.f + (point-_origin)*_columnSpacing.x;
+}
+
+void ChartScene::build( GPUKernel& kernel )
+{
+   _creating = true;
+   _batch.clear();
+   if( _chartType==ctArea )
+   {
+      _columnSize.x    = 400.f; _columnSize.y    = 40.f; _columnSize.z    = 400.f;
+      _columnSpacing.x = 400.f; _columnSpacing.y = 40.f; _columnSpacing.z = 800.f;
+   }
+   else
+   {
+      _columnSize.x    = 400.f; _columnSize.y    = 40.f; _columnSize.z    = 400.f;
+      _columnSpacing.x = 440.f; _columnSpacing.y = 40.f; _columnSpacing.z = 800.f;
+   }
+   _maxPoints = _values.getMaxPoints();
+   _origin = (_window!=0 && _count>_window) ? _count-_window : 0;
+   _lampX = static_cast<float>(rand()%10000-5000);
+   _lampZ = -2000.f-static_cast<float>(rand()%5000);
+
+   setStatic();
+
+   if( _chartType==ctArea ) _batch.reserve( _batch.size() + _values.getNbValues()*12 );
+   _firstPrimitive.assign( _values.getNbValues(), -1 );
+   for( int s(0); s<_values.getNbSeries(); ++s )
+   {
+      const int nbPoints = _values.getNbPoints(s);
+      if( _chartType==ctArea )
+      {
+         if( _window!=0 )
+         {
+            for( int i(0); i<nbPoints; ++i ) setWindowSegment( s, i );
+         }
+         else
+         {
+            for( int i(0); i<nbPoints-1; ++i ) setSegment( s, i );
+         }
+      }
+      else
+      {
+         for( int i(0); i<nbPoints; ++i ) setColumn( s, i );
+      }
+   }
+   _creating = false;
+
+   // Everything goes to the kernel in one pass. Batch positions are then
+   // translated into kernel indices for later in-place updates.
+   _batch.upload( kernel );
+   _firstStatic = _batch.getIndex( 0 );
+   for( size_t i(0); i<_firstPrimitive.size(); ++i )
+   {
+      if( _firstPrimitive[i]<0 ) continue;
+      _firstPrimitive[i] = (_chartType==ctArea) ? 
+         _batch.getIndex( _firstPrimitive[i] ) :
+         _batch.getInstanceIndex( _firstPrimitive[i] );
+   }
+}
+
+void ChartScene::setStatic()
+{
+   int material = (_chartType==ctArea) ? 0 : 100;
+   const float offset = getWindowOffset();
+
+   // Large enough for both the points and the series
+   float sideSize = _columnSpacing.x*_maxPoints*0.9f;
+   const float depth = _columnSpacing.z*_values.getNbSeries();
+   sideSize = (depth>sideSize) ? depth : sideSize;
+   const float left  = offset-sideSize;
+   const float right = offset+sideSize;
+   int index(_firstStatic);
+
+   // Ground
+   setTriangle( index,
+      left,  -10.f, -sideSize,
+      right, -10.f, -sideSize,
+      right, -10.f,  sideSize,
+      material);
+   setTriangle( index,
+      right, -10.f,  sideSize,
+      left,  -10.f,  sideSize,
+      left,  -10.f, -sideSize,
+      material);
+
+   // Wall
+   setTriangle( index,
+      left,           -10.f,  sideSize,
+      right,          -10.f,  sideSize,
+      right, sideSize-10.f,  sideSize,
+      material);
+   setTriangle( index,
+      right, sideSize-10.f,  sideSize,
+      left,  sideSize-10.f,  sideSize,
+      left,           -10.f,  sideSize,
+      material);
+
+   // Right Side
+   setTriangle( index,
+      right,          -10.f, -sideSize,
+      right,          -10.f,  sideSize+10.f,
+      right, sideSize-10.f,  sideSize+10.f,
+      material);
+
+   // Left Side
+   setTriangle( index,
+      left,          -10.f, -sideSize,
+      left,          -10.f,  sideSize+10.f,
+      left, sideSize-10.f,  sideSize+10.f,
+      material);
+
+   // Lamp
+   if( _creating )
+   {
+      _batch.add( ptXZPlane,
+         offset+_lampX, 5000.f, _lampZ,
+         0.f, 0.f, 0.f,
+         0.f, 0.f, 0.f,
+         2000.f, 0.f, 500.f,
+         DEFAULT_LIGHT_MATERIAL);
+   }
+   else
+   {
+      _batch.set( index, ptXZPlane,
+         offset+_lampX, 5000.f, _lampZ,
+         0.f, 0.f, 0.f,
+         0.f, 0.f, 0.f,
+         2000.f, 0.f, 500.f,
+         DEFAULT_LIGHT_MATERIAL);
+   }
+}
+
+void ChartScene::setColumn( const int s, const int i )
+{
+   const int nbSeries = _values.getNbSeries();
+   Vertex position;
+   position.x = getPointX( getPoint(i) );
+   position.y = 0.f;
+   position.z = s*_columnSpacing.z - ( nbSeries * _columnSpacing.z )/2.f;
+   Vertex scale;
+   scale.x = _columnSize.x;
+   scale.y = getValue(s,i)*_columnSize.y;
+   scale.z = _columnSize.z;
+
+   // While building, the returned value is a position among the staged
+   // instances. Afterwards, the resident instance is overwritten.
+   int& first = _firstPrimitive[_values.getOffset(s)+i];
+   if( _creating )
+   {
+      first = static_cast<int>(_batch.addInstance( _columnMesh, position, scale, getMaterial(s) ));
+   }
+   else
+   {
+      _batch.setInstance( first, _columnMesh, position, scale, getMaterial(s) );
+   }
+}
+
+void ChartScene::setSegment( const int s, const int i )
+{
+   const int nbPoints = _values.getNbPoints(s);
+   int& first = _firstPrimitive[_values.getOffset(s)+i];
+   stageSegment( first, s, getPointX(i), getValue(s,i), getValue(s,i+1), i==0, i==nbPoints-2 );
+}
+
+void ChartScene::setWindowSegment( const int s, const int slot )
+{
+   const int point = getPoint(slot);
+   const int oldest = (_count>_window) ? _count-_window : 0;
+   const float value = getValue(s,slot);
+
+   // The point before the oldest one is gone, and points that were not
+   // received yet do not depend on their neighbours: both are flat.
+   const bool joined = (point>oldest && point<_count);
+   const float previous = joined ? getValue(s,(slot+_window-1)%_window) : value;
+
+   int& first = _firstPrimitive[_values.getOffset(s)+slot];
+   stageSegment( first, s, getPointX(point-1), previous, value, true, true );
+}
+
+void ChartScene::stageSegment( int& first, const int s, const float x,
+   const float value, const float next, const bool leftSide, const bool rightSide )
+{
+   const int nbSeries = _values.getNbSeries();
+   const int material = getMaterial(s);
+   const float w = _columnSize.x;
+   const float z = s*_columnSpacing.z - ( nbSeries * _columnSpacing.z )/2.f;
+   const float d = _columnSize.z + z;
+   const float y0 = value*_columnSize.y;
+   const float y1 = next*_columnSize.y;
+   const float ymin = ((value<next) ? value : next)*_columnSize.y;
+
+   int index = first;
+
+   // Front
+   int primitive = setTriangle( index, x, 0.f, z,  x+w, 0.f, z,  x+w, ymin, z, material );
+   setTriangle( index, x+w, ymin, z,  x, ymin, z,  x, 0.f, z, material );
+   if( value<next )
+      setTriangle( index, x, y0, z,  x+w, y0, z,  x+w, y1, z, material );
+   else
+      setTriangle( index, x, y0, z,  x, y1, z,  x+w, y1, z, material );
+
+   // Back
+   setTriangle( index, x, 0.f, d,  x+w, 0.f, d,  x+w, ymin, d, material );
+   setTriangle( index, x+w, ymin, d,  x, ymin, d,  x, 0.f, d, material );
+   if( value<next )
+      setTriangle( index, x, y0, d,  x+w, y0, d,  x+w, y1, d, material );
+   else
+      setTriangle( index, x, y0, d,  x, y1, d,  x+w, y1, d, material );
+
+   // Top
+   setTriangle( index, x, y0, z,  x+w, y1, z,  x+w, y1, d, material );
+   setTriangle( index, x+w, y1, d,  x, y0, d,  x, y0, z, material );
+
+   // Sides
+   if( leftSide )
+   {
+      setTriangle( index, x, 0.f, z,  x, y0, z,  x, y0, d, material );
+      setTriangle( index, x, y0, d,  x, 0.f, d,  x, 0.f, z, material );
+   }
+   if( rightSide )
+   {
+      setTriangle( index, x+w, 0.f, z,  x+w, y1, z,  x+w, y1, d, material );
+      setTriangle( index, x+w, y1, d,  x+w, 0.f, d,  x+w, 0.f, z, material );
+   }
+
+   first = primitive;
+}
+
+int ChartScene::setTriangle( int& index,
+   const float x0, const float y0, const float z0,
+   const float x1, const float y1, const float z1,
+   const float x2, const float y2, const float z2,
+   const int material )
+{
+   // While building, primitives are staged as new ones and the returned value
+   // is a position in the batch. Afterwards, the resident ones are overwritten
+   // in the same order.
+   int primitive(index);
+   if( _creating )
+   {
+      primitive = static_cast<int>(_batch.add( ptTriangle, x0, y0, z0, x1, y1, z1, x2, y2, z2, 0.f, 0.f, 0.f, material ));
+   }
+   else
+   {
+      _batch.set( index, ptTriangle, x0, y0, z0, x1, y1, z1, x2, y2, z2, 0.f, 0.f, 0.f, material );
+   }
+   index = primitive+1;
+   return primitive;
+}
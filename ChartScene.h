@@ -0,0 +1,154 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include <GPUKernel.h>
+
+#include "PrimitiveBatch.h"
+#include "ChartData.h"
+
+/*
+________________________________________________________________________________
+
+Chart scene model
+
+Keeps track of the chart geometry resident in the kernel. When new values
+come in with the same shape (chart type, number of series and points), only
+the primitives of the columns whose value changed are rewritten. Ground,
+walls and lamp are created once and reused.
+
+Sliding window charts keep the last points of a stream in a ring of columns.
+A new point overwrites the column of the oldest one and is placed to the
+right of the newest, the ground and the camera following along. The cost of
+an update only depends on the number of new points, not on the history.
+Positions are relative to the start of the window and rebased each time the
+ring wraps around, so they stay small however long the stream runs.
+________________________________________________________________________________
+*/
+class ChartScene
+{
+public:
+   enum ChartType
+   {
+      ctArea   = 0,
+      ctColumn = 1
+   };
+
+public:
+   ChartScene();
+
+   // The kernel was reset, nothing is resident anymore
+   void reset();
+
+   // Brings the resident geometry in line with the given series. Returns
+   // true if at least one primitive was created or modified.
+   bool update( GPUKernel& kernel, const int chartType, const ChartData& data );
+
+   // Same for a sliding window. ring holds the last points of each series,
+   // point p being in slot p%window, and count is the number of points
+   // received so far.
+   bool updateWindow( GPUKernel& kernel, const int chartType, const ChartData& ring, const int count );
+
+   // True if the last update created primitives or moved enough of them for
+   // the boxes to be rebuilt
+   bool hasNewPrimitives() const { return _created; }
+
+   // Horizontal distance the camera has to follow a sliding window, since
+   // the last time its coordinates were rebased
+   float getWindowOffset() const;
+
+   int getChartType() const { return _chartType; }
+   bool isResident() const { return _resident; }
+
+   // Identifies the set of primitives needed by a chart. Charts with the same
+   // key only differ by the height of their columns.
+   static std::string getShapeKey( const int chartType, const ChartData& data );
+
+private:
+   void build( GPUKernel& kernel );
+
+   // Ground, walls and lamp. Staged again when a sliding window moves.
+   void setStatic();
+
+   // Column chart: one instance of the column mesh per value
+   void setColumn( const int s, const int i );
+
+   // Area chart: triangles joining values i and i+1
+   void setSegment( const int s, const int i );
+
+   // Sliding area chart: triangles joining the point of a slot to the
+   // previous one. All slots are closed on both ends so that they have the
+   // same number of primitives.
+   void setWindowSegment( const int s, const int slot );
+
+   void stageSegment( int& first, const int s, const float x,
+      const float value, const float next, const bool leftSide, const bool rightSide );
+
+   // Point held by column i, and its horizontal position
+   int   getPoint( const int i ) const;
+   float getPointX( const int point ) const;
+
+   // Stages a triangle, returns the index of the primitive that was written
+   int setTriangle( int& index,
+      const float x0, const float y0, const float z0,
+      const float x1, const float y1, const float z1,
+      const float x2, const float y2, const float z2,
+      const int material );
+
+   float getValue( const int s, const int i ) const { return _values.getValue(s,i); }
+
+   // Series cycle through the randomly colored materials
+   int getMaterial( const int s ) const { return 20+(s*5)%40; }
+
+private:
+   bool _resident;
+   bool _creating;
+   bool _created;
+   int  _chartType;
+
+   int  _maxPoints;
+   int  _window;      // Number of slots of a sliding window, 0 for static charts
+   int  _count;       // Points received by the sliding window
+   int  _origin;      // Point at the start of the window when it was last rebased
+   int  _firstStatic; // Kernel index of the ground
+   int  _columnMesh;
+   float _lampX;
+   float _lampZ;
+
+   Vertex _columnSize;
+   Vertex _columnSpacing;
+
+   // Values currently in the kernel
+   ChartData _values;
+
+   // First triangle of each column (column chart) or segment (area chart),
+   // same layout as the values
+   std::vector<int> _firstPrimitive;
+
+   // Staging buffer for the primitives created or modified by an update
+   PrimitiveBatch _batch;
+};
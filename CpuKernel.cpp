@@ -0,0 +1,1029 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+#define _USE_MATH_DEFINES
+
+#include "CpuKernel.h"
+#include "AsyncLog.h"
+
+#include <xmmintrin.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+// Bitmaps returned by the kernels are RGB
+const int CPU_FRAME_DEPTH = 3;
+
+const int CPU_TILE_SIZE     = 16;
+const int CPU_MAX_LEAF_SIZE = 8;
+const size_t CPU_NB_CACHED_SCENES = 8;
+const int CPU_MAX_BOUNCES   = 10;
+const float CPU_EPSILON     = 0.5f; // World units, atoms are hundreds wide
+
+// Kernel index of the first primitive, and first instance, of consumed batches
+const int CPU_FIRST_BATCH_PRIMITIVE = 0x40000000;
+const int CPU_FIRST_INSTANCE        = 0x60000000;
+
+// Shape type of instances, after the primitive types
+const int CPU_INSTANCE = 0x100;
+
+// Instances keep some thickness, rays are divided by their scale
+const float CPU_MIN_SCALE = 1e-3f;
+
+// Half width of the screen at the camera target, in world units
+const float CPU_SCREEN_SIZE = 3200.f;
+
+const float CPU_AMBIENT = 0.2f;
+
+static inline float dot( const float* a, const float* b )
+{
+   return a[0]*b[0]+a[1]*b[1]+a[2]*b[2];
+}
+
+static inline void normalize( float* v )
+{
+   const float length = sqrtf( dot(v,v) );
+   if( length>0.f )
+   {
+      v[0] /= length; v[1] /= length; v[2] /= length;
+   }
+}
+
+static inline void copy( float* v, const Vertex& vertex )
+{
+   v[0] = vertex.x; v[1] = vertex.y; v[2] = vertex.z;
+}
+
+// Same rotation as the GPU kernels: around x, then y, then z, about the origin
+static void rotate( float* v, const Vertex& angles )
+{
+   const float cx = cosf(angles.x), sx = sinf(angles.x);
+   const float cy = cosf(angles.y), sy = sinf(angles.y);
+   const float cz = cosf(angles.z), sz = sinf(angles.z);
+   float x, y, z;
+   y = v[1]*cx-v[2]*sx; z = v[1]*sx+v[2]*cx; v[1] = y; v[2] = z;
+   x = v[0]*cy+v[2]*sy; z = v[2]*cy-v[0]*sy; v[0] = x; v[2] = z;
+   x = v[0]*cz-v[1]*sz; y = v[0]*sz+v[1]*cz; v[0] = x; v[1] = y;
+}
+
+// Deterministic jitter, so that renders are reproducible
+static inline float jitter( unsigned int seed )
+{
+   seed ^= seed>>16; seed *= 0x7feb352d;
+   seed ^= seed>>15; seed *= 0x846ca68b;
+   seed ^= seed>>16;
+   return (seed&0xffffff)/16777216.f;
+}
+
+static bool isSphere( const int type )
+{
+   return type==ptSphere || type==ptEllipsoid;
+}
+
+CpuKernel::CpuKernel( bool activeLogging, int optimalNbOfPrimitivesPerBox, int nbThreads )
+ : GPUKernel(activeLogging, optimalNbOfPrimitivesPerBox, 0, 0),
+   _scene(&_empty), _buildTime(0), _nbBuilds(0), _nbReused(0), _nbRays(0), _nbSteps(0),
+   _capacity(0), _width(0), _height(0), _iteration(0), _nbTilesX(0), _nbTiles(0),
+   _nextTile(0), _nbBusy(0), _running(true)
+{
+   if( nbThreads<=0 )
+   {
+      SYSTEM_INFO info;
+      GetSystemInfo( &info );
+      nbThreads = static_cast<int>(info.dwNumberOfProcessors);
+   }
+   _work = CreateSemaphore( NULL, 0, nbThreads, NULL );
+   _done = CreateEvent( NULL, FALSE, FALSE, NULL );
+   for( int i(0); i<nbThreads; ++i )
+   {
+      _threads.push_back( CreateThread( NULL, 0, workerThread, this, 0, NULL ) );
+   }
+}
+
+CpuKernel::~CpuKernel()
+{
+   _running = false;
+   ReleaseSemaphore( _work, static_cast<LONG>(_threads.size()), NULL );
+   for( size_t i(0); i<_threads.size(); ++i )
+   {
+      WaitForSingleObject( _threads[i], INFINITE );
+      CloseHandle( _threads[i] );
+   }
+   CloseHandle( _work );
+   CloseHandle( _done );
+   for( size_t i(0); i<_hierarchies.size(); ++i ) delete _hierarchies[i];
+}
+
+void CpuKernel::initBuffers()
+{
+   GPUKernel::initBuffers();
+
+   // Frames are never larger than the scene the buffers are created for
+   _capacity = static_cast<size_t>(m_sceneInfo.size.x)*m_sceneInfo.size.y;
+   if( !m_bitmap ) m_bitmap = new BitmapBuffer[_capacity*CPU_FRAME_DEPTH];
+   _accumulation.resize( _capacity*CPU_FRAME_DEPTH );
+}
+
+void CpuKernel::cleanup()
+{
+   GPUKernel::cleanup();
+   _batchShapes.clear();
+   _instances.clear();
+   for( size_t i(0); i<_hierarchies.size(); ++i ) delete _hierarchies[i];
+   _hierarchies.clear();
+   _scene = &_empty;
+}
+
+void CpuKernel::initializeDevice()
+{
+}
+
+void CpuKernel::releaseDevice()
+{
+}
+
+void CpuKernel::reshape()
+{
+}
+
+std::string CpuKernel::getGPUDescription()
+{
+   char description[64];
+   sprintf( description, "CPU, %d threads", static_cast<int>(_threads.size()) );
+   return description;
+}
+
+// --------------------------------------------------------------------------------
+// Bounding volume hierarchy
+// --------------------------------------------------------------------------------
+static unsigned long long hashBytes( const void* data, const size_t size, unsigned long long hash )
+{
+   // FNV-1a
+   const unsigned char* bytes = static_cast<const unsigned char*>(data);
+   for( size_t i(0); i<size; ++i )
+   {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ULL;
+   }
+   return hash;
+}
+
+int CpuKernel::compactBoxes( bool reconstructBoxes )
+{
+   // Snapshot of the primitives, the hierarchy follows whatever changed
+   std::vector<Shape> shapes;
+   std::vector<BvhBuilder::Item> items;
+   const unsigned int nbPrimitives = getNbActivePrimitives();
+   shapes.reserve( nbPrimitives+_batchShapes.size()+_instances.size() );
+   items.reserve( nbPrimitives+_batchShapes.size()+_instances.size() );
+   for( unsigned int i(0); i<nbPrimitives; ++i )
+   {
+      const CPUPrimitive* primitive = getPrimitive(i);
+      Shape shape;
+      shape.type       = primitive->type;
+      shape.materialId = primitive->materialId;
+      copy( shape.p0, primitive->p0 ); copy( shape.p1, primitive->p1 ); copy( shape.p2, primitive->p2 );
+      copy( shape.n0, primitive->n0 ); copy( shape.n1, primitive->n1 ); copy( shape.n2, primitive->n2 );
+      copy( shape.size, primitive->size );
+      shape.mesh = -1;
+      addShape( shape, shapes, items );
+   }
+   for( size_t i(0); i<_batchShapes.size(); ++i ) addShape( _batchShapes[i], shapes, items );
+   for( size_t i(0); i<_instances.size(); ++i ) addShape( _instances[i], shapes, items );
+
+   const unsigned long long key = hashBytes( shapes.empty() ? nullptr : &shapes[0], shapes.size()*sizeof(Shape), 0xcbf29ce484222325ULL );
+
+   // Scenes coming back, molecules in particular, keep their hierarchy
+   for( size_t i(0); i<_hierarchies.size(); ++i )
+   {
+      if( _hierarchies[i]->key==key && _hierarchies[i]->shapes.size()==shapes.size() )
+      {
+         _nbReused++;
+         _scene = _hierarchies[i];
+         _scene->lastUsed = _nbBuilds+_nbReused;
+         return static_cast<int>(_scene->nodes.size());
+      }
+   }
+
+   // Least recently used one makes room
+   if( _hierarchies.size()>=CPU_NB_CACHED_SCENES )
+   {
+      size_t oldest(0);
+      for( size_t i(1); i<_hierarchies.size(); ++i )
+      {
+         if( _hierarchies[i]->lastUsed<_hierarchies[oldest]->lastUsed ) oldest = i;
+      }
+      delete _hierarchies[oldest];
+      _hierarchies.erase( _hierarchies.begin()+oldest );
+   }
+
+   const DWORD start = GetTickCount();
+   std::vector<BvhBuilder::Node> nodes;
+   BvhBuilder builder( static_cast<int>(_threads.size()), CPU_MAX_LEAF_SIZE );
+   builder.build( items, nodes );
+
+   _scene = new Hierarchy;
+   _scene->key = key;
+   _scene->shapes.reserve( shapes.size() );
+   _scene->nodes.reserve( nodes.size() );
+   if( !nodes.empty() ) flatten( *_scene, nodes, 0, items, shapes );
+   _hierarchies.push_back( _scene );
+   _buildTime = GetTickCount()-start;
+   _nbBuilds++;
+   _scene->lastUsed = _nbBuilds+_nbReused;
+   LOG_INFO(1, "CPU kernel: " << _scene->shapes.size() << " shapes, " << _scene->nodes.size() << " nodes built in " << _buildTime << " ms" );
+   return static_cast<int>(_scene->nodes.size());
+}
+
+void CpuKernel::addShape( Shape shape, std::vector<Shape>& shapes, std::vector<BvhBuilder::Item>& items ) const
+{
+   if( shape.materialId<0 || shape.materialId>=NB_MAX_MATERIALS ) shape.materialId = 0;
+
+   BvhBuilder::Item item;
+   item.index = static_cast<int>(shapes.size());
+   float* bounds = item.bounds;
+   switch( shape.type )
+   {
+   case ptSphere:
+   case ptEllipsoid:
+      {
+         const float r = std::max( shape.size[0], std::max( shape.size[1], shape.size[2] ) );
+         shape.size[0] = r;
+         for( int a(0); a<3; ++a ) { bounds[a] = shape.p0[a]-r; bounds[a+3] = shape.p0[a]+r; }
+         break;
+      }
+   case ptCylinder:
+      for( int a(0); a<3; ++a )
+      {
+         bounds[a]   = std::min( shape.p0[a], shape.p1[a] )-shape.size[0];
+         bounds[a+3] = std::max( shape.p0[a], shape.p1[a] )+shape.size[0];
+      }
+      break;
+   case ptTriangle:
+      for( int a(0); a<3; ++a )
+      {
+         bounds[a]   = std::min( shape.p0[a], std::min( shape.p1[a], shape.p2[a] ) );
+         bounds[a+3] = std::max( shape.p0[a], std::max( shape.p1[a], shape.p2[a] ) );
+      }
+      break;
+   case ptCheckboard:
+   case ptXZPlane:
+   case ptXYPlane:
+   case ptYZPlane:
+      {
+         // Extents along the plane, flat along its normal
+         float extent[3] = { shape.size[0], shape.size[1], shape.size[2] };
+         extent[(shape.type==ptXYPlane) ? 2 : (shape.type==ptYZPlane) ? 0 : 1] = CPU_EPSILON;
+         for( int a(0); a<3; ++a ) { bounds[a] = shape.p0[a]-extent[a]; bounds[a+3] = shape.p0[a]+extent[a]; }
+         break;
+      }
+   case CPU_INSTANCE:
+      {
+         // Bounds of the mesh, scaled then moved
+         const Mesh& mesh = _meshes[shape.mesh];
+         if( mesh.vertices.empty() ) return;
+         for( int a(0); a<3; ++a )
+         {
+            const float low  = mesh.bounds[a]*shape.p1[a];
+            const float high = mesh.bounds[a+3]*shape.p1[a];
+            bounds[a]   = shape.p0[a]+std::min( low, high );
+            bounds[a+3] = shape.p0[a]+std::max( low, high );
+         }
+         break;
+      }
+   default:
+      // Cameras and quads are not rendered
+      return;
+   }
+   for( int a(0); a<3; ++a ) item.centroid[a] = (bounds[a]+bounds[a+3])*0.5f;
+   shapes.push_back( shape );
+   items.push_back( item );
+}
+
+int CpuKernel::flatten( Hierarchy& hierarchy, const std::vector<BvhBuilder::Node>& nodes, const int index,
+   const std::vector<BvhBuilder::Item>& items, const std::vector<Shape>& shapes )
+{
+   const BvhBuilder::Node& source = nodes[index];
+   const int position = static_cast<int>(hierarchy.nodes.size());
+   hierarchy.nodes.push_back( Node() );
+
+   Node node;
+   for( int a(0); a<6; ++a ) node.bounds[a] = source.bounds[a];
+   node.axis = source.axis;
+   if( source.count==0 )
+   {
+      // First child follows its parent
+      flatten( hierarchy, nodes, source.left, items, shapes );
+      node.next        = flatten( hierarchy, nodes, source.right, items, shapes );
+      node.firstPacket = 0;
+      node.nbShapes    = 0;
+      node.nbPackets   = 0;
+      hierarchy.nodes[position] = node;
+      return position;
+   }
+
+   // Shapes other than spheres first
+   node.next        = static_cast<int>(hierarchy.shapes.size());
+   node.firstPacket = static_cast<int>(hierarchy.packetIds.size()/4);
+   const int first = source.first;
+   const int last  = source.first+source.count;
+   for( int i(first); i<last; ++i )
+   {
+      const Shape& shape = shapes[items[i].index];
+      if( !isSphere(shape.type) ) hierarchy.shapes.push_back( shape );
+   }
+   node.nbShapes = static_cast<short>(hierarchy.shapes.size()-node.next);
+
+   // Spheres, packed 4 by 4. Lanes left over repeat the last sphere.
+   std::vector<int> spheres;
+   for( int i(first); i<last; ++i )
+   {
+      const Shape& shape = shapes[items[i].index];
+      if( isSphere(shape.type) )
+      {
+         spheres.push_back( static_cast<int>(hierarchy.shapes.size()) );
+         hierarchy.shapes.push_back( shape );
+      }
+   }
+   node.nbPackets = static_cast<short>((spheres.size()+3)/4);
+   for( size_t p(0); p<spheres.size(); p+=4 )
+   {
+      float packet[16];
+      for( int lane(0); lane<4; ++lane )
+      {
+         const int id = spheres[std::min( p+lane, spheres.size()-1 )];
+         const Shape& sphere = hierarchy.shapes[id];
+         packet[lane]    = sphere.p0[0];
+         packet[lane+4]  = sphere.p0[1];
+         packet[lane+8]  = sphere.p0[2];
+         packet[lane+12] = sphere.size[0]*sphere.size[0];
+         hierarchy.packetIds.push_back( id );
+      }
+      hierarchy.packets.insert( hierarchy.packets.end(), packet, packet+16 );
+   }
+   hierarchy.nodes[position] = node;
+   return position;
+}
+
+// --------------------------------------------------------------------------------
+// Primitive batches
+// --------------------------------------------------------------------------------
+void CpuKernel::setShape( Shape& shape, const int type, const float* values, const int material )
+{
+   // Same layout as the primitives of the base class. Triangles without
+   // vertex normals get the one of their face.
+   shape.type       = type;
+   shape.materialId = material;
+   for( int a(0); a<3; ++a )
+   {
+      shape.p0[a]   = values[a];
+      shape.p1[a]   = values[a+3];
+      shape.p2[a]   = values[a+6];
+      shape.size[a] = values[a+9];
+      shape.n0[a] = shape.n1[a] = shape.n2[a] = 0.f;
+   }
+   shape.mesh = -1;
+}
+
+int CpuKernel::findMesh( const float* vertices, const int nbTriangles )
+{
+   // Meshes are few and small, and the same ones come back with each batch
+   const size_t count = static_cast<size_t>(nbTriangles)*9;
+   for( size_t i(0); i<_meshes.size(); ++i )
+   {
+      const std::vector<float>& known = _meshes[i].vertices;
+      if( known.size()==count && (count==0 || memcmp( &known[0], vertices, count*sizeof(float) )==0) )
+      {
+         return static_cast<int>(i);
+      }
+   }
+
+   Mesh mesh;
+   mesh.vertices.assign( vertices, vertices+count );
+   for( int a(0); a<3; ++a )
+   {
+      mesh.bounds[a]   = count ? vertices[a] : 0.f;
+      mesh.bounds[a+3] = mesh.bounds[a];
+   }
+   for( size_t i(0); i<count; ++i )
+   {
+      const int a = static_cast<int>(i%3);
+      mesh.bounds[a]   = std::min( mesh.bounds[a], vertices[i] );
+      mesh.bounds[a+3] = std::max( mesh.bounds[a+3], vertices[i] );
+   }
+   _meshes.push_back( mesh );
+   return static_cast<int>(_meshes.size())-1;
+}
+
+int CpuKernel::consume( PrimitiveBatch& batch )
+{
+   // Columns go straight into the traced form, the base class is not involved
+   int created(0);
+   float values[12];
+   const size_t count = batch.size();
+   for( size_t i(0); i<count; ++i )
+   {
+      batch.getValues( i, values );
+      const int index = batch.getIndex(i);
+      if( index>=0 && index<CPU_FIRST_BATCH_PRIMITIVE )
+      {
+         // Created through the base class
+         setPrimitive( index,
+            values[0], values[1], values[2],
+            values[3], values[4], values[5],
+            values[6], values[7], values[8],
+            values[9], values[10], values[11],
+            batch.getMaterial(i) );
+         continue;
+      }
+      if( index<0 )
+      {
+         batch.setIndex( i, CPU_FIRST_BATCH_PRIMITIVE+static_cast<int>(_batchShapes.size()) );
+         _batchShapes.push_back( Shape() );
+         ++created;
+      }
+      const size_t slot = static_cast<size_t>(batch.getIndex(i)-CPU_FIRST_BATCH_PRIMITIVE);
+      if( slot<_batchShapes.size() ) setShape( _batchShapes[slot], batch.getType(i), values, batch.getMaterial(i) );
+   }
+
+   // Instances stay one record each, their mesh is stored once
+   std::vector<int> meshes( batch.getNbMeshes(), -1 );
+   const size_t nbInstances = batch.getNbInstances();
+   for( size_t i(0); i<nbInstances; ++i )
+   {
+      const int source = batch.getInstanceMesh(i);
+      int& mesh = meshes[source];
+      if( mesh<0 ) mesh = findMesh( batch.getMeshVertices(source), batch.getMeshSize(source) );
+      if( batch.getInstanceIndex(i)<0 )
+      {
+         batch.setInstanceIndex( i, CPU_FIRST_INSTANCE+static_cast<int>(_instances.size()) );
+         _instances.push_back( Shape() );
+         ++created;
+      }
+      const size_t slot = static_cast<size_t>(batch.getInstanceIndex(i)-CPU_FIRST_INSTANCE);
+      if( slot>=_instances.size() ) continue;
+
+      // Translation in p0, scale in p1
+      for( int c(0); c<12; ++c ) values[c] = 0.f;
+      batch.getInstanceTransform( i, values, values+3 );
+      for( int a(3); a<6; ++a )
+      {
+         if( fabsf(values[a])<CPU_MIN_SCALE ) values[a] = (values[a]<0.f) ? -CPU_MIN_SCALE : CPU_MIN_SCALE;
+      }
+      Shape& instance = _instances[slot];
+      setShape( instance, CPU_INSTANCE, values, batch.getInstanceMaterial(i) );
+      instance.mesh = mesh;
+   }
+   return created;
+}
+
+void CpuKernel::clearBatches()
+{
+   _batchShapes.clear();
+   _instances.clear();
+}
+
+// --------------------------------------------------------------------------------
+// Intersections
+// --------------------------------------------------------------------------------
+static inline bool intersectBox( const float* bounds, const float* origin, const float* inverse, const float tMax )
+{
+   float tNear(0.f), tFar(tMax);
+   for( int a(0); a<3; ++a )
+   {
+      float t0 = (bounds[a]-origin[a])*inverse[a];
+      float t1 = (bounds[a+3]-origin[a])*inverse[a];
+      if( t0>t1 ) std::swap( t0, t1 );
+      tNear = std::max( tNear, t0 );
+      tFar  = std::min( tFar, t1 );
+   }
+   return tNear<=tFar;
+}
+
+static inline bool intersectTriangle( const float* o, const float* d,
+   const float* p0, const float* p1, const float* p2, float& t )
+{
+   const float e1[3] = { p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2] };
+   const float e2[3] = { p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2] };
+   const float p[3]  = { d[1]*e2[2]-d[2]*e2[1], d[2]*e2[0]-d[0]*e2[2], d[0]*e2[1]-d[1]*e2[0] };
+   const float determinant = dot(e1,p);
+   if( fabsf(determinant)<1e-12f ) return false;
+   const float inverse = 1.f/determinant;
+   const float s[3] = { o[0]-p0[0], o[1]-p0[1], o[2]-p0[2] };
+   const float u = dot(s,p)*inverse;
+   if( u<0.f || u>1.f ) return false;
+   const float q[3] = { s[1]*e1[2]-s[2]*e1[1], s[2]*e1[0]-s[0]*e1[2], s[0]*e1[1]-s[1]*e1[0] };
+   const float v = dot(d,q)*inverse;
+   if( v<0.f || u+v>1.f ) return false;
+   const float hit = dot(e2,q)*inverse;
+   if( hit<=CPU_EPSILON || hit>=t ) return false;
+   t = hit;
+   return true;
+}
+
+bool CpuKernel::intersectShape( const Ray& ray, const Shape& shape, float& t, int& part ) const
+{
+   const float* o = ray.origin;
+   const float* d = ray.direction;
+   switch( shape.type )
+   {
+   case ptCylinder:
+      {
+         // Side of the cylinder, the atoms cover its ends
+         const float axis[3] = { shape.p1[0]-shape.p0[0], shape.p1[1]-shape.p0[1], shape.p1[2]-shape.p0[2] };
+         const float oc[3]   = { o[0]-shape.p0[0], o[1]-shape.p0[1], o[2]-shape.p0[2] };
+         const float length2 = dot(axis,axis);
+         const float ad  = dot(axis,d);
+         const float aoc = dot(axis,oc);
+         const float a = length2-ad*ad;
+         const float b = length2*dot(oc,d)-aoc*ad;
+         const float c = length2*dot(oc,oc)-aoc*aoc-shape.size[0]*shape.size[0]*length2;
+         const float discriminant = b*b-a*c;
+         if( a<=0.f || discriminant<0.f ) return false;
+         const float root = sqrtf(discriminant);
+         for( int i(0); i<2; ++i )
+         {
+            const float hit = (-b+(i ? root : -root))/a;
+            const float m = aoc+hit*ad;
+            if( hit>CPU_EPSILON && hit<t && m>=0.f && m<=length2 )
+            {
+               t = hit;
+               return true;
+            }
+         }
+         return false;
+      }
+   case ptTriangle:
+      return intersectTriangle( o, d, shape.p0, shape.p1, shape.p2, t );
+   case CPU_INSTANCE:
+      {
+         // In the space of the mesh, where hits are at the same distance
+         float origin[3], direction[3];
+         for( int a(0); a<3; ++a )
+         {
+            origin[a]    = (o[a]-shape.p0[a])/shape.p1[a];
+            direction[a] = d[a]/shape.p1[a];
+         }
+         const std::vector<float>& vertices = _meshes[shape.mesh].vertices;
+         bool found(false);
+         for( size_t i(0); i<vertices.size(); i+=9 )
+         {
+            const float* v = &vertices[i];
+            if( intersectTriangle( origin, direction, v, v+3, v+6, t ) )
+            {
+               part = static_cast<int>(i/9);
+               found = true;
+            }
+         }
+         return found;
+      }
+   default:
+      {
+         // Planes
+         const int normal = (shape.type==ptXYPlane) ? 2 : (shape.type==ptYZPlane) ? 0 : 1;
+         if( d[normal]==0.f ) return false;
+         const float hit = (shape.p0[normal]-o[normal])/d[normal];
+         if( hit<=CPU_EPSILON || hit>=t ) return false;
+         for( int a(0); a<3; ++a )
+         {
+            if( a!=normal && fabsf(o[a]+hit*d[a]-shape.p0[a])>shape.size[a] ) return false;
+         }
+         t = hit;
+         return true;
+      }
+   }
+}
+
+bool CpuKernel::intersect( const Ray& ray, Hit& hit, const bool shadow, TraceStats& stats ) const
+{
+   const Hierarchy& scene = *_scene;
+   if( scene.nodes.empty() ) return false;
+   stats.nbRays++;
+
+   const __m128 ox = _mm_set1_ps(ray.origin[0]);
+   const __m128 oy = _mm_set1_ps(ray.origin[1]);
+   const __m128 oz = _mm_set1_ps(ray.origin[2]);
+   const __m128 dx = _mm_set1_ps(ray.direction[0]);
+   const __m128 dy = _mm_set1_ps(ray.direction[1]);
+   const __m128 dz = _mm_set1_ps(ray.direction[2]);
+   const __m128 epsilon = _mm_set1_ps(CPU_EPSILON);
+
+   bool found(false);
+   int stack[BvhBuilder::MAX_DEPTH+1];
+   int top(0);
+   stack[top++] = 0;
+   while( top>0 )
+   {
+      const int index = stack[--top];
+      const Node& node = scene.nodes[index];
+      stats.nbSteps++;
+      if( !intersectBox( node.bounds, ray.origin, ray.inverse, hit.t ) ) continue;
+
+      if( node.nbShapes==0 && node.nbPackets==0 )
+      {
+         // Nearest child first
+         const bool forward = ray.direction[node.axis]>=0.f;
+         stack[top++] = forward ? node.next : index+1;
+         stack[top++] = forward ? index+1 : node.next;
+         continue;
+      }
+
+      for( int i(0); i<node.nbShapes; ++i )
+      {
+         const Shape& shape = scene.shapes[node.next+i];
+         if( shadow && _shading[shape.materialId].emissive ) continue;
+         if( intersectShape( ray, shape, hit.t, hit.part ) )
+         {
+            hit.primitive = node.next+i;
+            if( shadow ) return true;
+            found = true;
+         }
+      }
+
+      for( int p(node.firstPacket); p<node.firstPacket+node.nbPackets; ++p )
+      {
+         // Four spheres at once
+         const float* packet = &scene.packets[p*16];
+         const __m128 ocx = _mm_sub_ps( ox, _mm_loadu_ps(packet) );
+         const __m128 ocy = _mm_sub_ps( oy, _mm_loadu_ps(packet+4) );
+         const __m128 ocz = _mm_sub_ps( oz, _mm_loadu_ps(packet+8) );
+         const __m128 b = _mm_add_ps( _mm_add_ps( _mm_mul_ps(ocx,dx), _mm_mul_ps(ocy,dy) ), _mm_mul_ps(ocz,dz) );
+         const __m128 c = _mm_sub_ps(
+            _mm_add_ps( _mm_add_ps( _mm_mul_ps(ocx,ocx), _mm_mul_ps(ocy,ocy) ), _mm_mul_ps(ocz,ocz) ),
+            _mm_loadu_ps(packet+12) );
+         const __m128 discriminant = _mm_sub_ps( _mm_mul_ps(b,b), c );
+         const __m128 root = _mm_sqrt_ps( _mm_max_ps( discriminant, _mm_setzero_ps() ) );
+         const __m128 nearHit = _mm_sub_ps( _mm_sub_ps( _mm_setzero_ps(), b ), root );
+         const __m128 farHit  = _mm_add_ps( _mm_sub_ps( _mm_setzero_ps(), b ), root );
+
+         // Far side when the origin is inside the sphere
+         const __m128 inFront = _mm_cmpgt_ps( nearHit, epsilon );
+         const __m128 t = _mm_or_ps( _mm_and_ps( inFront, nearHit ), _mm_andnot_ps( inFront, farHit ) );
+         const __m128 valid = _mm_and_ps(
+            _mm_and_ps( _mm_cmpge_ps( discriminant, _mm_setzero_ps() ), _mm_cmpgt_ps( t, epsilon ) ),
+            _mm_cmplt_ps( t, _mm_set1_ps(hit.t) ) );
+         int mask = _mm_movemask_ps( valid );
+         if( !mask ) continue;
+
+         float lanes[4];
+         _mm_storeu_ps( lanes, t );
+         for( int lane(0); lane<4; ++lane )
+         {
+            if( !(mask&(1<<lane)) || lanes[lane]>=hit.t ) continue;
+            const int id = scene.packetIds[p*4+lane];
+            if( shadow && _shading[scene.shapes[id].materialId].emissive ) continue;
+            hit.t = lanes[lane];
+            hit.primitive = id;
+            if( shadow ) return true;
+            found = true;
+         }
+      }
+   }
+   return found;
+}
+
+void CpuKernel::normalAt( const Shape& shape, const int part, const float* point, float* normal ) const
+{
+   switch( shape.type )
+   {
+   case ptSphere:
+   case ptEllipsoid:
+      for( int a(0); a<3; ++a ) normal[a] = point[a]-shape.p0[a];
+      break;
+   case ptCylinder:
+      {
+         const float axis[3] = { shape.p1[0]-shape.p0[0], shape.p1[1]-shape.p0[1], shape.p1[2]-shape.p0[2] };
+         const float v[3]    = { point[0]-shape.p0[0], point[1]-shape.p0[1], point[2]-shape.p0[2] };
+         const float length2 = dot(axis,axis);
+         const float m = (length2>0.f) ? dot(v,axis)/length2 : 0.f;
+         for( int a(0); a<3; ++a ) normal[a] = v[a]-axis[a]*m;
+         break;
+      }
+   case ptTriangle:
+      {
+         // Vertex normals weighted by the barycentric coordinates of the point
+         const float e1[3] = { shape.p1[0]-shape.p0[0], shape.p1[1]-shape.p0[1], shape.p1[2]-shape.p0[2] };
+         const float e2[3] = { shape.p2[0]-shape.p0[0], shape.p2[1]-shape.p0[1], shape.p2[2]-shape.p0[2] };
+         const float v[3]  = { point[0]-shape.p0[0], point[1]-shape.p0[1], point[2]-shape.p0[2] };
+         const float d00 = dot(e1,e1), d01 = dot(e1,e2), d11 = dot(e2,e2);
+         const float d20 = dot(v,e1), d21 = dot(v,e2);
+         const float denominator = d00*d11-d01*d01;
+         const float b1 = (denominator!=0.f) ? (d11*d20-d01*d21)/denominator : 0.f;
+         const float b2 = (denominator!=0.f) ? (d00*d21-d01*d20)/denominator : 0.f;
+         const float b0 = 1.f-b1-b2;
+         for( int a(0); a<3; ++a ) normal[a] = shape.n0[a]*b0+shape.n1[a]*b1+shape.n2[a]*b2;
+         if( dot(normal,normal)==0.f )
+         {
+            normal[0] = e1[1]*e2[2]-e1[2]*e2[1];
+            normal[1] = e1[2]*e2[0]-e1[0]*e2[2];
+            normal[2] = e1[0]*e2[1]-e1[1]*e2[0];
+         }
+         break;
+      }
+   case CPU_INSTANCE:
+      {
+         // Normal of the face in the mesh, divided by the scale
+         const float* v = &_meshes[shape.mesh].vertices[part*9];
+         const float e1[3] = { v[3]-v[0], v[4]-v[1], v[5]-v[2] };
+         const float e2[3] = { v[6]-v[0], v[7]-v[1], v[8]-v[2] };
+         normal[0] = (e1[1]*e2[2]-e1[2]*e2[1])/shape.p1[0];
+         normal[1] = (e1[2]*e2[0]-e1[0]*e2[2])/shape.p1[1];
+         normal[2] = (e1[0]*e2[1]-e1[1]*e2[0])/shape.p1[2];
+         break;
+      }
+   default:
+      normal[0] = normal[1] = normal[2] = 0.f;
+      normal[(shape.type==ptXYPlane) ? 2 : (shape.type==ptYZPlane) ? 0 : 1] = 1.f;
+      break;
+   }
+   normalize( normal );
+}
+
+// --------------------------------------------------------------------------------
+// Shading
+// --------------------------------------------------------------------------------
+static void setInverse( const float* direction, float* inverse )
+{
+   for( int a(0); a<3; ++a )
+   {
+      inverse[a] = (direction[a]!=0.f) ? 1.f/direction[a] : 1e30f;
+   }
+}
+
+void CpuKernel::trace( const Ray& ray, const int depth, float* color, TraceStats& stats ) const
+{
+   Hit hit;
+   hit.t = m_sceneInfo.viewDistance.x;
+   hit.primitive = -1;
+   hit.part = 0;
+   if( !intersect( ray, hit, false, stats ) )
+   {
+      color[0] = m_sceneInfo.backgroundColor.x;
+      color[1] = m_sceneInfo.backgroundColor.y;
+      color[2] = m_sceneInfo.backgroundColor.z;
+      return;
+   }
+
+   const Shape& shape = _scene->shapes[hit.primitive];
+   const Shading& shading = _shading[shape.materialId];
+   if( shading.emissive )
+   {
+      for( int a(0); a<3; ++a ) color[a] = shading.color[a];
+      return;
+   }
+
+   float point[3], normal[3];
+   for( int a(0); a<3; ++a ) point[a] = ray.origin[a]+ray.direction[a]*hit.t;
+   normalAt( shape, hit.part, point, normal );
+   if( dot(normal,ray.direction)>0.f )
+   {
+      normal[0] = -normal[0]; normal[1] = -normal[1]; normal[2] = -normal[2];
+   }
+
+   float albedo[3] = { shading.color[0], shading.color[1], shading.color[2] };
+   if( shape.type==ptCheckboard )
+   {
+      const int checker = static_cast<int>(floorf(point[0]/500.f)+floorf(point[2]/500.f));
+      if( checker&1 ) { albedo[0] *= 0.5f; albedo[1] *= 0.5f; albedo[2] *= 0.5f; }
+   }
+
+   float diffuse[3]  = { CPU_AMBIENT, CPU_AMBIENT, CPU_AMBIENT };
+   float specular[3] = { 0.f, 0.f, 0.f };
+   for( size_t l(0); l<_lamps.size(); ++l )
+   {
+      const Lamp& lamp = _lamps[l];
+      Ray shadow;
+      float distance(0.f);
+      for( int a(0); a<3; ++a )
+      {
+         shadow.origin[a]    = point[a]+normal[a]*CPU_EPSILON;
+         shadow.direction[a] = lamp.position[a]-point[a];
+      }
+      distance = sqrtf( dot(shadow.direction,shadow.direction) );
+      normalize( shadow.direction );
+      const float lambert = dot(normal,shadow.direction);
+      if( lambert<=0.f ) continue;
+
+      setInverse( shadow.direction, shadow.inverse );
+      Hit blocker;
+      blocker.t = distance;
+      blocker.primitive = -1;
+      blocker.part = 0;
+      const float light = intersect( shadow, blocker, true, stats ) ? 1.f-m_sceneInfo.shadowIntensity.x : 1.f;
+
+      // Blinn-Phong highlight
+      float half[3] = { shadow.direction[0]-ray.direction[0], shadow.direction[1]-ray.direction[1], shadow.direction[2]-ray.direction[2] };
+      normalize( half );
+      const float highlight = shading.specularValue*powf( std::max( dot(normal,half), 0.f ), shading.specularPower )*light;
+      for( int a(0); a<3; ++a )
+      {
+         diffuse[a]  += lamp.color[a]*lambert*light;
+         specular[a] += lamp.color[a]*highlight;
+      }
+   }
+   for( int a(0); a<3; ++a ) color[a] = albedo[a]*diffuse[a]+specular[a];
+
+   if( depth>=std::min( m_sceneInfo.nbRayIterations.x, CPU_MAX_BOUNCES ) ) return;
+
+   if( shading.reflection>0.f )
+   {
+      Ray reflected;
+      const float projection = 2.f*dot(ray.direction,normal);
+      for( int a(0); a<3; ++a )
+      {
+         reflected.origin[a]    = point[a]+normal[a]*CPU_EPSILON;
+         reflected.direction[a] = ray.direction[a]-normal[a]*projection;
+      }
+      setInverse( reflected.direction, reflected.inverse );
+      float reflection[3];
+      trace( reflected, depth+1, reflection, stats );
+      for( int a(0); a<3; ++a ) color[a] = color[a]*(1.f-shading.reflection)+reflection[a]*shading.reflection;
+   }
+   if( shading.transparency>0.f )
+   {
+      Ray through;
+      for( int a(0); a<3; ++a )
+      {
+         through.origin[a]    = point[a]+ray.direction[a]*CPU_EPSILON;
+         through.direction[a] = ray.direction[a];
+         through.inverse[a]   = ray.inverse[a];
+      }
+      float behind[3];
+      trace( through, depth+1, behind, stats );
+      for( int a(0); a<3; ++a ) color[a] = color[a]*(1.f-shading.transparency)+behind[a]*shading.transparency;
+   }
+}
+
+// --------------------------------------------------------------------------------
+// Rendering
+// --------------------------------------------------------------------------------
+void CpuKernel::render_begin( const float timer )
+{
+   _width     = m_sceneInfo.size.x;
+   _height    = m_sceneInfo.size.y;
+   _iteration = m_sceneInfo.pathTracingIteration.x;
+   if( static_cast<size_t>(_width)*_height>_capacity )
+   {
+      LOG_ERROR( "CPU kernel: frame larger than the buffers" );
+      _width = _height = 0;
+   }
+
+   if( _iteration==0 )
+   {
+      // Materials, and the lamps they make, may have changed since the last frame
+      _shading.resize( NB_MAX_MATERIALS );
+      for( int i(0); i<NB_MAX_MATERIALS; ++i )
+      {
+         const Material* material = getMaterial(i);
+         Shading& shading = _shading[i];
+         shading.color[0]      = material->color.x;
+         shading.color[1]      = material->color.y;
+         shading.color[2]      = material->color.z;
+         shading.specularValue = material->specular.x;
+         shading.specularPower = material->specular.y;
+         shading.reflection    = std::min( std::max( material->reflection.x, 0.f ), 1.f );
+         shading.transparency  = std::min( std::max( material->transparency.x, 0.f ), 1.f );
+         shading.emissive      = material->innerIllumination.x>0.f;
+      }
+      _lamps.clear();
+      for( size_t i(0); i<_scene->shapes.size(); ++i )
+      {
+         const Shape& shape = _scene->shapes[i];
+         if( !_shading[shape.materialId].emissive ) continue;
+         Lamp lamp;
+         for( int a(0); a<3; ++a )
+         {
+            lamp.position[a] = shape.p0[a];
+            lamp.color[a]    = _shading[shape.materialId].color[a];
+         }
+         _lamps.push_back( lamp );
+      }
+   }
+
+   // A lamp at the eye when the scene has none
+   copy( _eye, m_viewPos );
+   if( _lamps.empty() )
+   {
+      Lamp lamp;
+      for( int a(0); a<3; ++a ) { lamp.position[a] = _eye[a]; lamp.color[a] = 1.f; }
+      _lamps.push_back( lamp );
+   }
+
+   // Screen at the target, rotated about the origin with the eye
+   const float step = 2.f*CPU_SCREEN_SIZE/std::max( _width, 1 );
+   float target[3];
+   copy( target, m_viewDir );
+   for( int a(0); a<3; ++a ) _stepX[a] = _stepY[a] = 0.f;
+   _stepX[0] = -step;
+   _stepY[1] = -step;
+   for( int a(0); a<3; ++a ) _corner[a] = target[a]-_stepX[a]*_width*0.5f-_stepY[a]*_height*0.5f;
+   rotate( _eye, m_angles );
+   rotate( _corner, m_angles );
+   rotate( _stepX, m_angles );
+   rotate( _stepY, m_angles );
+
+   _nbTilesX  = (_width+CPU_TILE_SIZE-1)/CPU_TILE_SIZE;
+   _nbTiles   = _nbTilesX*((_height+CPU_TILE_SIZE-1)/CPU_TILE_SIZE);
+   _nextTile  = 0;
+   _nbBusy    = static_cast<LONG>(_threads.size());
+   _nbRays    = 0;
+   _nbSteps   = 0;
+   ReleaseSemaphore( _work, static_cast<LONG>(_threads.size()), NULL );
+}
+
+void CpuKernel::render_end()
+{
+   WaitForSingleObject( _done, INFINITE );
+}
+
+void CpuKernel::renderTile( const int tile )
+{
+   const int x0 = (tile%_nbTilesX)*CPU_TILE_SIZE;
+   const int y0 = (tile/_nbTilesX)*CPU_TILE_SIZE;
+   const int x1 = std::min( x0+CPU_TILE_SIZE, _width );
+   const int y1 = std::min( y0+CPU_TILE_SIZE, _height );
+   const float weight = 1.f/(_iteration+1);
+
+   TraceStats stats;
+   stats.nbRays  = 0;
+   stats.nbSteps = 0;
+   Ray ray;
+   for( int a(0); a<3; ++a ) ray.origin[a] = _eye[a];
+   for( int y(y0); y<y1; ++y )
+   {
+      for( int x(x0); x<x1; ++x )
+      {
+         const unsigned int pixel = static_cast<unsigned int>(y*_width+x);
+
+         // Pixel centers first, then random positions in the pixel
+         float u(0.5f), v(0.5f);
+         if( _iteration>0 )
+         {
+            u = jitter( pixel*2+_iteration*0x9e3779b9 );
+            v = jitter( pixel*2+1+_iteration*0x9e3779b9 );
+         }
+         for( int a(0); a<3; ++a )
+         {
+            ray.direction[a] = _corner[a]+_stepX[a]*(x+u)+_stepY[a]*(y+v)-_eye[a];
+         }
+         normalize( ray.direction );
+         setInverse( ray.direction, ray.inverse );
+
+         float color[3];
+         trace( ray, 0, color, stats );
+
+         float* accumulated = &_accumulation[pixel*CPU_FRAME_DEPTH];
+         BitmapBuffer* output = m_bitmap+pixel*CPU_FRAME_DEPTH;
+         for( int a(0); a<3; ++a )
+         {
+            accumulated[a] = (_iteration==0) ? color[a] : accumulated[a]+(color[a]-accumulated[a])*weight;
+            const float value = std::min( std::max( accumulated[a], 0.f ), 1.f );
+            output[a] = static_cast<BitmapBuffer>(value*255.f);
+         }
+      }
+   }
+   InterlockedExchangeAdd64( &_nbRays, stats.nbRays );
+   InterlockedExchangeAdd64( &_nbSteps, stats.nbSteps );
+}
+
+DWORD WINAPI CpuKernel::workerThread( LPVOID param )
+{
+   CpuKernel* self = static_cast<CpuKernel*>(param);
+   while( true )
+   {
+      WaitForSingleObject( self->_work, INFINITE );
+      if( !self->_running ) break;
+
+      // Tiles go to whichever thread is free
+      LONG tile;
+      while( (tile = InterlockedIncrement( &self->_nextTile )-1)<self->_nbTiles )
+      {
+         self->renderTile( tile );
+      }
+      if( InterlockedDecrement( &self->_nbBusy )==0 ) SetEvent( self->_done );
+   }
+   return 0;
+}
@@ -0,0 +1,225 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+#include <windows.h>
+
+#include <string>
+#include <vector>
+
+#include <GPUKernel.h>
+
+#include "BvhBuilder.h"
+#include "PrimitiveBatch.h"
+
+/*
+________________________________________________________________________________
+
+CPU kernel
+
+Software ray tracer behind the GPUKernel interface, for machines without a GPU
+(--cpu). Scenes are set up exactly as for the GPU kernels: primitives,
+materials and camera go through the base class, and the frame is read back
+with getBitmap.
+
+Primitive batches (see PrimitiveBatch) are consumed in one call and kept in
+the traced form, next to the primitives of the base class, which they never
+go through. Instances stay one record each: rays are moved into the space of
+their mesh, which is stored once, instead of testing expanded triangles.
+
+compactBoxes takes a snapshot of the primitives and builds a bounding volume
+hierarchy over them (see BvhBuilder). Leaves keep their spheres as packets of
+4, tested at once with SSE. The hierarchies of the last scenes are kept, keyed
+by a hash of their primitives, so a molecule coming back is not built again.
+
+render_begin hands 16x16 tiles of the frame to a pool of threads, one per
+core, and render_end waits for the last one. Each iteration of a path traced
+frame adds a jittered sample per pixel, so quality still means antialiasing.
+
+Shading covers what molecules and charts use: diffuse and specular light from
+the lamps (primitives with an inner illumination), shadows, reflection and
+transparency. Textures and post processing are not rendered.
+________________________________________________________________________________
+*/
+class CpuKernel : public GPUKernel, public BatchConsumer
+{
+public:
+   // nbThreads 0 is one thread per core
+   CpuKernel( bool activeLogging, int optimalNbOfPrimitivesPerBox, int nbThreads );
+   ~CpuKernel();
+
+   virtual void initBuffers();
+   virtual void cleanup();
+   virtual void initializeDevice();
+   virtual void releaseDevice();
+   virtual void reshape();
+   virtual std::string getGPUDescription();
+
+   virtual int compactBoxes( bool reconstructBoxes );
+
+   virtual void render_begin( const float timer );
+   virtual void render_end();
+
+   virtual int consume( PrimitiveBatch& batch );
+   virtual void clearBatches();
+
+   // Time of the last hierarchy build, builds, and builds saved by the cache
+   DWORD getBuildTime() const { return _buildTime; }
+   int getNbBuilds() const { return _nbBuilds; }
+   int getNbReused() const { return _nbReused; }
+
+   // Hierarchy nodes visited per ray, over the last frame
+   float getStepsPerRay() const { return _nbRays ? static_cast<float>(_nbSteps)/_nbRays : 0.f; }
+
+private:
+   struct Ray
+   {
+      float origin[3];
+      float direction[3];
+      float inverse[3];
+   };
+
+   struct Hit
+   {
+      float t;
+      int   primitive;
+      int   part; // Triangle of an instance
+   };
+
+   struct TraceStats
+   {
+      LONGLONG nbRays;
+      LONGLONG nbSteps;
+   };
+
+   // Primitive as traced, in the order of the hierarchy leaves
+   struct Shape
+   {
+      int   type;
+      int   materialId;
+      float p0[3];
+      float p1[3];
+      float p2[3];
+      float n0[3];
+      float n1[3];
+      float n2[3];
+      float size[3];
+      int   mesh; // Instances only, scaled by p1 then moved by p0
+   };
+
+   // Base mesh of instances
+   struct Mesh
+   {
+      std::vector<float> vertices; // 9 coordinates per triangle
+      float              bounds[6];
+   };
+
+   // Material as shaded
+   struct Shading
+   {
+      float color[3];
+      float specularValue;
+      float specularPower;
+      float reflection;
+      float transparency;
+      bool  emissive; // Lamps cast no shadow
+   };
+
+   // Leaves have their shapes first, then their spheres also as packets
+   struct Node
+   {
+      float bounds[6];  // Min x, y, z then max x, y, z
+      int   next;       // Second child, or first shape of a leaf
+      int   firstPacket;
+      short nbShapes;   // Shapes other than spheres
+      short nbPackets;  // Both 0 for an inner node
+      int   axis;
+   };
+
+   struct Lamp
+   {
+      float position[3];
+      float color[3];
+   };
+
+   // Traced form of a scene
+   struct Hierarchy
+   {
+      unsigned long long key;   // Hash of the shapes
+      int                lastUsed;
+      std::vector<Shape> shapes;    // In leaf order
+      std::vector<Node>  nodes;
+      std::vector<float> packets;   // 16 floats per packet: x[4], y[4], z[4], radius^2[4]
+      std::vector<int>   packetIds;
+   };
+
+   static void setShape( Shape& shape, const int type, const float* values, const int material );
+   int findMesh( const float* vertices, const int nbTriangles );
+   void addShape( Shape shape, std::vector<Shape>& shapes, std::vector<BvhBuilder::Item>& items ) const;
+   int flatten( Hierarchy& hierarchy, const std::vector<BvhBuilder::Node>& nodes, const int index,
+      const std::vector<BvhBuilder::Item>& items, const std::vector<Shape>& shapes );
+
+   bool intersect( const Ray& ray, Hit& hit, const bool shadow, TraceStats& stats ) const;
+   bool intersectShape( const Ray& ray, const Shape& shape, float& t, int& part ) const;
+   void normalAt( const Shape& shape, const int part, const float* point, float* normal ) const;
+   void trace( const Ray& ray, const int depth, float* color, TraceStats& stats ) const;
+   void renderTile( const int tile );
+
+   static DWORD WINAPI workerThread( LPVOID param );
+
+private:
+   std::vector<Shape>   _batchShapes; // Consumed batches
+   std::vector<Shape>   _instances;
+   std::vector<Mesh>    _meshes;      // Kept, cached hierarchies refer to them
+   std::vector<Hierarchy*> _hierarchies; // Most recent scenes
+   Hierarchy*           _scene;
+   Hierarchy            _empty;
+   DWORD                _buildTime;
+   int                  _nbBuilds;
+   int                  _nbReused;
+   volatile LONGLONG    _nbRays;   // Of the last frame
+   volatile LONGLONG    _nbSteps;
+   std::vector<Shading> _shading;
+   std::vector<Lamp>    _lamps;
+   std::vector<float>   _accumulation;
+   size_t               _capacity; // Pixels of the bitmap
+
+   // Frame being rendered
+   float  _eye[3];
+   float  _corner[3]; // Direction of the top left pixel, before the eye is removed
+   float  _stepX[3];
+   float  _stepY[3];
+   int    _width;
+   int    _height;
+   int    _iteration;
+   int    _nbTilesX;
+   int    _nbTiles;
+
+   std::vector<HANDLE> _threads;
+   HANDLE _work;      // One count per thread joining the frame
+   HANDLE _done;      // Set by the last thread to leave the frame
+   volatile LONG _nextTile;
+   volatile LONG _nbBusy;
+   bool   _running;
+};
@@ -0,0 +1,323 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "FrameReadback.h"
+#include "Metrics.h"
+
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+extern bool jo_write_jpg_to_memory(std::vector<unsigned char> &out, const void *data, int width, int height, int comp, int quality);
+extern char *base64_encode(const unsigned char *data, size_t input_length, size_t *output_length);
+
+// Bitmaps returned by the kernel are RGB
+const int FRAME_DEPTH = 3;
+
+// Separates the frames of a batch
+#define FRAME_BOUNDARY "imvframe"
+
+FrameReadback::FrameReadback( Lacewing::Pump& pump )
+ : _pump(pump), _next(0), _encode(0), _running(true), _nbSubmissions(0)
+{
+   for( int i(0); i<NB_SLOTS; ++i )
+   {
+      _slots[i].buffer   = nullptr;
+      _slots[i].capacity = 0;
+      _slots[i].width    = 0;
+      _slots[i].height   = 0;
+      _slots[i].request  = nullptr;
+      _slots[i].listener = nullptr;
+      _slots[i].tiles    = nullptr;
+      _slots[i].trace    = nullptr;
+      _slots[i].submission = 0;
+      _slots[i].part     = 0;
+      _slots[i].nbParts  = 0;
+      _slots[i].idle     = CreateEvent( NULL, FALSE, TRUE, NULL );
+   }
+   _ready  = CreateSemaphore( NULL, 0, NB_SLOTS, NULL );
+   _thread = CreateThread( NULL, 0, encoderThread, this, 0, NULL );
+}
+
+FrameReadback::~FrameReadback()
+{
+   _running = false;
+   ReleaseSemaphore( _ready, 1, NULL );
+   WaitForSingleObject( _thread, INFINITE );
+   CloseHandle( _thread );
+   CloseHandle( _ready );
+   for( int i(0); i<NB_SLOTS; ++i )
+   {
+      if( _slots[i].buffer )
+      {
+         VirtualUnlock( _slots[i].buffer, _slots[i].capacity );
+         VirtualFree( _slots[i].buffer, 0, MEM_RELEASE );
+      }
+      CloseHandle( _slots[i].idle );
+   }
+}
+
+void FrameReadback::reserve( Slot& slot, const size_t size )
+{
+   if( slot.capacity >= size ) return;
+
+   if( slot.buffer )
+   {
+      VirtualUnlock( slot.buffer, slot.capacity );
+      VirtualFree( slot.buffer, 0, MEM_RELEASE );
+   }
+
+   // Page-locked so that the copy out of the kernel never faults. The working
+   // set has to be grown first, otherwise VirtualLock fails on large frames.
+   SIZE_T minimum(0), maximum(0);
+   HANDLE process = GetCurrentProcess();
+   GetProcessWorkingSetSize( process, &minimum, &maximum );
+   SetProcessWorkingSetSize( process, minimum+size, maximum+size );
+
+   slot.buffer   = static_cast<unsigned char*>(VirtualAlloc( NULL, size, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE ));
+   slot.capacity = size;
+   if( !VirtualLock( slot.buffer, size ) )
+   {
+      // Not fatal, the buffer is simply pageable
+   }
+}
+
+const char* FrameReadback::getMultipartType()
+{
+   return "multipart/mixed; boundary=" FRAME_BOUNDARY;
+}
+
+void FrameReadback::readback( GPUKernel& kernel, Lacewing::Webserver::Request& request, const SceneInfo& sceneInfo )
+{
+   readbackPart( kernel, request, sceneInfo, 0, 0 );
+}
+
+FrameReadback::Slot& FrameReadback::copy( GPUKernel& kernel, const SceneInfo& sceneInfo )
+{
+   Slot& slot = _slots[_next];
+   WaitForSingleObject( slot.idle, INFINITE );
+
+   StageTimer timer( msReadback );
+   size_t size = sceneInfo.size.x*sceneInfo.size.y*FRAME_DEPTH;
+   reserve( slot, size );
+
+   // Single device-to-host transfer for the whole render
+   BitmapBuffer* bitmap = kernel.getBitmap();
+   memcpy( slot.buffer, bitmap, size );
+   slot.width    = sceneInfo.size.x;
+   slot.height   = sceneInfo.size.y;
+   slot.request  = nullptr;
+   slot.listener = nullptr;
+   slot.tiles    = nullptr;
+   slot.trace    = Tracer::getCurrent();
+   slot.part     = 0;
+   slot.nbParts  = 0;
+   if( slot.trace ) slot.trace->acquire();
+   return slot;
+}
+
+template<class T> unsigned int FrameReadback::submit( std::map<T*, unsigned int>& pending, T* target )
+{
+   // The parts of a batch, or the frames of a listener, keep the number they
+   // were first given while their client is there
+   typename std::map<T*, unsigned int>::iterator it = pending.find( target );
+   if( it != pending.end() ) return it->second;
+   const unsigned int submission = ++_nbSubmissions;
+   pending[target] = submission;
+   return submission;
+}
+
+void FrameReadback::queue()
+{
+   _next = (_next+1)%NB_SLOTS;
+   ReleaseSemaphore( _ready, 1, NULL );
+}
+
+void FrameReadback::readbackPart( GPUKernel& kernel, Lacewing::Webserver::Request& request, const SceneInfo& sceneInfo,
+   const int part, const int nbParts )
+{
+   Slot& slot = copy( kernel, sceneInfo );
+   slot.request = &request;
+   slot.part    = part;
+   slot.nbParts = nbParts;
+   slot.submission = submit( _pending, &request );
+   queue();
+}
+
+void FrameReadback::readback( GPUKernel& kernel, FrameListener& listener, const SceneInfo& sceneInfo,
+   TileEncoder* tiles )
+{
+   Slot& slot = copy( kernel, sceneInfo );
+   slot.listener = &listener;
+   slot.tiles    = tiles;
+   slot.submission = submit( _listeners, &listener );
+   queue();
+}
+
+void FrameReadback::onDisconnect( Lacewing::Webserver::Request& request )
+{
+   _pending.erase( &request );
+}
+
+void FrameReadback::onDisconnect( FrameListener& listener )
+{
+   _listeners.erase( &listener );
+}
+
+void FrameReadback::encode( Slot& slot )
+{
+   TraceScope scope( slot.trace );
+   EncodedFrame* frame = new EncodedFrame;
+   std::vector<unsigned char> jpeg;
+   {
+      StageTimer timer( msJpeg );
+      if( slot.tiles )
+      {
+         // Only the tiles that changed are encoded
+         slot.tiles->encode( slot.buffer, slot.width, slot.height, frame->response );
+      }
+      else
+      {
+         jo_write_jpg_to_memory( jpeg, slot.buffer, slot.width, slot.height, FRAME_DEPTH, 100 );
+      }
+   }
+   Lacewing::Webserver::Request* request = slot.request;
+   FrameListener* listener = slot.listener;
+   TileEncoder* tiles = slot.tiles;
+   RequestTrace* trace = slot.trace;
+   const unsigned int submission = slot.submission;
+   const int part = slot.part;
+   const int nbParts = slot.nbParts;
+   const bool raw = (nbParts!=0 || listener);
+
+   // Pixels are no longer needed, the renderer can reuse the slot. Nothing
+   // is read from it past this point.
+   slot.request  = nullptr;
+   slot.listener = nullptr;
+   slot.tiles    = nullptr;
+   slot.trace    = nullptr;
+   SetEvent( slot.idle );
+
+   frame->owner    = this;
+   frame->request  = request;
+   frame->listener = listener;
+   frame->tiles    = tiles;
+   frame->trace    = trace;
+   frame->submission = submission;
+   frame->first    = (part==0);
+   frame->last     = (part+1>=nbParts);
+   if( nbParts!=0 )
+   {
+      // Batch frames are not base64 encoded
+      char header[128];
+      sprintf( header, "--" FRAME_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %d\r\nX-Frame: %d\r\n\r\n",
+         static_cast<int>(jpeg.size()), part );
+      frame->response.reserve( strlen(header)+jpeg.size()+32 );
+      frame->response = header;
+      if( !jpeg.empty() ) frame->response.append( reinterpret_cast<const char*>(&jpeg[0]), jpeg.size() );
+      frame->response += "\r\n";
+      if( frame->last ) frame->response += "--" FRAME_BOUNDARY "--\r\n";
+   }
+   else if( listener )
+   {
+      // Tile deltas are already in the response
+      if( !tiles && !jpeg.empty() ) frame->response.assign( reinterpret_cast<const char*>(&jpeg[0]), jpeg.size() );
+   }
+   else
+   {
+      frame->response = "data:image/jpg;base64,";
+   }
+   if( !raw && !jpeg.empty() )
+   {
+      StageTimer timer( msBase64 );
+      size_t len(0);
+      char* encoded = base64_encode( &jpeg[0], jpeg.size(), &len );
+      if( encoded )
+      {
+         frame->response.append( encoded, len );
+         free( encoded );
+      }
+   }
+   _pump.Post( (void*)onEncoded, frame );
+}
+
+DWORD WINAPI FrameReadback::encoderThread( LPVOID param )
+{
+   FrameReadback* self = static_cast<FrameReadback*>(param);
+   Tracer::setThreadName( "readback encoder" );
+   while( true )
+   {
+      WaitForSingleObject( self->_ready, INFINITE );
+      if( !self->_running ) break;
+      self->encode( self->_slots[self->_encode] );
+      self->_encode = (self->_encode+1)%NB_SLOTS;
+   }
+   return 0;
+}
+
+void FrameReadback::onEncoded( EncodedFrame* frame )
+{
+   // Runs on the event pump thread
+   {
+      TraceScope scope( frame->trace );
+      StageTimer timer( msSend );
+      frame->owner->deliver( *frame );
+   }
+   // Completes the trace after the last frame of the request
+   if( frame->trace ) frame->trace->release();
+   delete frame;
+}
+
+void FrameReadback::deliver( EncodedFrame& frame )
+{
+   if( frame.listener )
+   {
+      std::map<FrameListener*, unsigned int>::iterator it = _listeners.find( frame.listener );
+      if( it != _listeners.end() && it->second==frame.submission )
+      {
+         _listeners.erase( it );
+         frame.listener->onFrame( frame.response, frame.tiles );
+      }
+      else
+      {
+         delete frame.tiles;
+      }
+      return;
+   }
+
+   std::map<Lacewing::Webserver::Request*, unsigned int>::iterator it = _pending.find( frame.request );
+   if( it != _pending.end() && it->second==frame.submission )
+   {
+      Lacewing::Webserver::Request& request = *frame.request;
+      if( frame.first ) request.AddHeader("Access-Control-Allow-Origin", "*"); // Needed by Chrome!!
+      request.Write( frame.response.c_str(), static_cast<int>(frame.response.length()) );
+      if( frame.last )
+      {
+         _pending.erase( it );
+         request.Finish();
+      }
+   }
+}
@@ -0,0 +1,153 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+#include <windows.h>
+#include <lacewing.h>
+
+#include <map>
+#include <string>
+
+#include <GPUKernel.h>
+
+#include "TileEncoder.h"
+#include "Tracer.h"
+
+// Receives the frames of live streams, which are not answered through the
+// web server. Called on the event pump thread.
+class FrameListener
+{
+public:
+   virtual ~FrameListener() {}
+
+   // JPEG image of the frame, or tile delta message when the frame was
+   // read back with a tile encoder. The encoder is handed back to its owner.
+   virtual void onFrame( const std::string& image, TileEncoder* tiles ) = 0;
+
+   // The frame could not be rendered
+   virtual void onFrameDropped() = 0;
+};
+
+/*
+________________________________________________________________________________
+
+Frame readback stage
+
+The final frame of a render is copied once from the kernel into one of two
+page-locked host buffers. A background thread JPEG/base64 encodes that buffer
+while the event loop goes on rendering the next job into the other one. The
+encoded response is handed back to the event pump, which writes it and
+finishes the request.
+
+Frames of a batch are sent as the parts of a multipart response, in raw JPEG.
+The request is finished after its last part. Frames of live streams are handed
+to their listener in raw JPEG as well, or as the tiles that changed since the
+previous frame when the listener has a tile encoder.
+________________________________________________________________________________
+*/
+class FrameReadback
+{
+public:
+   FrameReadback( Lacewing::Pump& pump );
+   ~FrameReadback();
+
+   // Copies the last rendered frame into a free slot and queues it for
+   // encoding. Blocks only if both slots are still being encoded.
+   void readback( GPUKernel& kernel, Lacewing::Webserver::Request& request, const SceneInfo& sceneInfo );
+
+   // Same for frame 'part' of a batch of nbParts frames
+   void readbackPart( GPUKernel& kernel, Lacewing::Webserver::Request& request, const SceneInfo& sceneInfo,
+      const int part, const int nbParts );
+
+   // Same for the frame of a live stream. The tile encoder, if any, belongs to
+   // the readback stage until it is handed back with the frame.
+   void readback( GPUKernel& kernel, FrameListener& listener, const SceneInfo& sceneInfo,
+      TileEncoder* tiles = nullptr );
+
+   // Content type of batch responses
+   static const char* getMultipartType();
+
+   // Must be called when a client goes away before its frame is sent
+   void onDisconnect( Lacewing::Webserver::Request& request );
+   void onDisconnect( FrameListener& listener );
+
+private:
+   static const int NB_SLOTS = 2;
+
+   struct Slot
+   {
+      unsigned char* buffer;
+      size_t         capacity;
+      int            width;
+      int            height;
+      Lacewing::Webserver::Request* request;
+      FrameListener* listener;
+      TileEncoder*   tiles;
+      RequestTrace*  trace;   // Reference held while the slot is in use
+      unsigned int   submission; // Identifies the request or listener it is for
+      int            part;    // Index in the batch
+      int            nbParts; // 0 for a single frame
+      HANDLE         idle;  // Signaled when the encoder has released the pixels
+   };
+
+   struct EncodedFrame
+   {
+      FrameReadback* owner;
+      Lacewing::Webserver::Request* request;
+      FrameListener* listener;
+      TileEncoder* tiles;
+      RequestTrace* trace;
+      unsigned int submission;
+      bool first;
+      bool last;
+      std::string response;
+   };
+
+   void reserve( Slot& slot, const size_t size );
+   Slot& copy( GPUKernel& kernel, const SceneInfo& sceneInfo );
+   void queue();
+   void encode( Slot& slot );
+   template<class T> unsigned int submit( std::map<T*, unsigned int>& pending, T* target );
+
+   static DWORD WINAPI encoderThread( LPVOID param );
+   static void onEncoded( EncodedFrame* frame );
+   void deliver( EncodedFrame& frame );
+
+private:
+   Lacewing::Pump& _pump;
+   Slot   _slots[NB_SLOTS];
+   int    _next;    // Next slot handed to the renderer
+   int    _encode;  // Next slot picked by the encoder
+   HANDLE _ready;   // Counts slots waiting to be encoded
+   HANDLE _thread;
+   bool   _running;
+
+   // Requests and listeners with a frame in flight, only touched from the
+   // event pump thread. Each one gets a new submission number, so that a
+   // frame is not delivered to another client at the address of one that
+   // went away.
+   std::map<Lacewing::Webserver::Request*, unsigned int> _pending;
+   std::map<FrameListener*, unsigned int> _listeners;
+   unsigned int _nbSubmissions;
+};
@@ -38,7 +38,25 @@
 
 #include <PDBReader.h>
 #include <FileMarshaller.h>
-#include <Logging.h>
+
+#include "FrameReadback.h"
+#include "ChartScene.h"
+#include "ChartData.h"
+#include "NumberParser.h"
+#include "QueryParser.h"
+#include "RenderContext.h"
+#include "RenderScheduler.h"
+#include "OverloadController.h"
+#include "MjpegServer.h"
+#include "WebSocketServer.h"
+#include "Metrics.h"
+#include "AsyncLog.h"
+#include "RequestCapture.h"
+#include "CpuKernel.h"
+#include "PdbFetcher.h"
+#include "MoleculeCache.h"
+#include "MoleculeLod.h"
+#include "PdbStore.h"
 
 #ifdef USE_CUDA
 #include <Cuda/CudaKernel.h>
@@ -51,72 +69,42 @@
 
 extern bool jo_write_jpg(const char *filename, const void *data, int width, int height, int comp, int quality);
 
-const int NB_MAX_SERIES = 5;
-
-// Structures
-struct MoleculeInfo
-{
-   std::string moleculeId;
-   int structureType;
-   int scheme;
-   Vertex viewPos;
-   Vertex rotationAngles;
-   SceneInfo sceneInfo;
-   PostProcessingInfo postProcessingInfo;
-};
-
-struct ChartInfo
-{
-   int chartType;
-   std::vector<float> values[NB_MAX_SERIES];
-   Vertex viewPos;
-   Vertex rotationAngles;
-   SceneInfo sceneInfo;
-   PostProcessingInfo postProcessingInfo;
-};
-
-struct IrtInfo
-{
-   std::string filename;
-   Vertex viewPos;
-   Vertex rotationAngles;
-   SceneInfo sceneInfo;
-   PostProcessingInfo postProcessingInfo;
-};
-
-// Requests
-std::map<std::string,std::string> gRequests;
-
-// ----------------------------------------------------------------------
-// Stats
-// ----------------------------------------------------------------------
-int gNbCalls(0);
-
 // ----------------------------------------------------------------------
-// Usecases
+// Charts
 // ----------------------------------------------------------------------
-enum UseCase 
+// Streaming charts: sessions fed with new points, rendered as a sliding window
+struct ChartStream
 {
-   ucUndefined = 0,
-   ucChart = 1,
-   ucIRT   = 2,
-   ucPDB   = 3
+   int chartType;
+   int count;      // Points received so far
+   ChartData ring; // Last points of each series, point p being in slot p%window
 };
-UseCase gCurrentUsecase(ucUndefined);
-std::string gCurrentUsecaseValue("undefined");
-
-// ----------------------------------------------------------------------
-// Charts
-// ----------------------------------------------------------------------
-int gChartStartIndex=0;
+std::map<std::string,ChartStream> gChartStreams;
+const int DEFAULT_CHART_WINDOW = 60;
+const int MAX_CHART_WINDOW = 10000;
+const size_t MAX_CHART_STREAMS = 64;
 
 // ----------------------------------------------------------------------
 // Scene
 // ----------------------------------------------------------------------
 GPUKernel* gpuKernel = nullptr;
-
-unsigned int gWindowWidth  = 4096;
-unsigned int gWindowHeight = 4096;
+KernelContext* gKernelContext = nullptr;
+FrameReadback* gFrameReadback = nullptr;
+RenderScheduler* gScheduler = nullptr;
+OverloadController* gOverload = nullptr;
+MjpegServer* gMjpegServer = nullptr;
+WebSocketServer* gWebSocketServer = nullptr;
+RequestCapture* gCapture = nullptr;
+PdbFetcher* gPdbFetcher = nullptr;
+CpuKernel* gCpuKernel = nullptr;
+
+// Live streams and interactive sessions are served on ports of their own
+const int MJPEG_PORT = 10001;
+const int WEBSOCKET_PORT = 10002;
+
+// Default image size, requests choose theirs with the size parameter
+const unsigned int gWindowWidth  = 4096;
+const unsigned int gWindowHeight = 4096;
 unsigned int gWindowDepth  = 4;
 
 float4 gBkGrey  = {0.5f, 0.5f, 0.5f, 0.f};
@@ -128,8 +116,6 @@ SceneInfo gSceneInfo;
 
 bool   gSceneHasChanged(true);
 bool   gSpecular(true);
-bool   gAnimate(false);
-int    gTickCount(0);
 float  gDefaultAtomSize(100.f);
 float  gDefaultStickSize(80.f);
 int    gMaxPathTracingIterations = gTotalPathTracingIterations;
@@ -140,8 +126,6 @@ int    gBox(0);
 Vertex gRotationCenter = { 0.f, 0.f, 0.f };
 
 // Scene description and behavior
-int gNbBoxes      = 0;
-int gNbPrimitives = 0;
 int gNbLamps      = 0;
 int gNbMaterials  = 0;
 
@@ -168,59 +152,6 @@ void saturatefloat4(float4& value, const float min, const float max )
    value.z = (value.z > max) ? max : value.z;
 }
 
-void readfloats(const std::string value, std::vector<float>& values )
-{
-   std::string element;
-   int i(0);
-   for( int j(0); j<value.length(); ++j)
-   {
-      if( value[j] == ',' )
-      {
-         values.push_back(static_cast<float>(atof(element.c_str())));
-         element = "";
-         i++;
-      }
-      else
-      {
-         element += value[j];
-      }
-   }
-   if( element.length() != 0 )
-   {
-      values.push_back(static_cast<float>(atof(element.c_str())));
-   }
-}
-
-Vertex readVertex(const std::string value)
-{
-   Vertex result = {0.f,0.f,0.f};
-   std::string element;
-   int i(0);
-   for( int j(0); j<value.length(); ++j)
-   {
-      if( value[j] == ',' )
-      {
-         switch( i )
-         {
-         case 0: result.x = static_cast<float>(atof(element.c_str())); break;
-         case 1: result.y = static_cast<float>(atof(element.c_str())); break;
-         case 2: result.z = static_cast<float>(atof(element.c_str())); break;
-         }
-         element = "";
-         i++;
-      }
-      else
-      {
-         element += value[j];
-      }
-   }
-   if( element.length() != 0 )
-   {
-      result.z = static_cast<float>(atof(element.c_str()));
-   }
-   return result;
-}
-
 /*
 ________________________________________________________________________________
 
@@ -401,12 +332,12 @@ void createMaterials( GPUKernel* gpuKernel, const bool& random )
    gpuKernel->compactBoxes(false);
 }
 
-void initializeKernel( const bool& random )
+void initializeKernel( KernelContext& kernel, const bool& random )
 {
-   gpuKernel->resetAll();
-   gpuKernel->setFrame(0);
+   PrimitiveBatch::reset( *kernel.kernel );
+   kernel.kernel->setFrame(0);
 
-   createMaterials( gpuKernel, random );
+   createMaterials( kernel.kernel, random );
 
    /*
 	// Textures
@@ -422,7 +353,7 @@ void initializeKernel( const bool& random )
    {
       std::string fullPath(path);
       fullPath+=FindData.cFileName;
-      int slot = gpuKernel->loadTextureFromFile(i,fullPath);
+      int slot = kernel.kernel->loadTextureFromFile(i,fullPath);
       LOG_INFO(3, "Texture " << fullPath << " loaded into slot " << slot );
       i++;
    }
@@ -472,14 +403,62 @@ char *base64_encode(const unsigned char *data,
    return encoded_data;
 }
 
-char* convertToBMP( char* buffer )
+void build_decoding_table() 
+{
+   // Characters outside of the alphabet are marked as invalid
+   decoding_table = (char*)malloc(256);
+   memset(decoding_table, -1, 256);
+   for (int i = 0; i < 64; i++)
+   {
+      decoding_table[(unsigned char) encoding_table[i]] = i;
+   }
+}
+
+bool base64_decode(const char *data,
+   size_t input_length,
+   std::vector<unsigned char>& decoded_data) 
+{
+   if (decoding_table == nullptr) build_decoding_table();
+   if (input_length % 4 != 0) return false;
+
+   size_t padding = 0;
+   if (input_length > 0 && data[input_length - 1] == '=') padding++;
+   if (input_length > 1 && data[input_length - 2] == '=') padding++;
+
+   // Anything else than the alphabet, or padding before the end, is invalid
+   for (size_t i = 0; i < input_length - padding; i++)
+   {
+      if (static_cast<signed char>(decoding_table[(unsigned char)data[i]]) < 0) return false;
+   }
+
+   size_t output_length = input_length / 4 * 3 - padding;
+   decoded_data.resize(output_length);
+
+   for (size_t i = 0, j = 0; i < input_length;) {
+
+      uint32_t sextet_a = data[i] == '=' ? 0 & i++ : decoding_table[(unsigned char)data[i++]];
+      uint32_t sextet_b = data[i] == '=' ? 0 & i++ : decoding_table[(unsigned char)data[i++]];
+      uint32_t sextet_c = data[i] == '=' ? 0 & i++ : decoding_table[(unsigned char)data[i++]];
+      uint32_t sextet_d = data[i] == '=' ? 0 & i++ : decoding_table[(unsigned char)data[i++]];
+
+      uint32_t triple = (sextet_a << 3 * 6)
+         + (sextet_b << 2 * 6)
+         + (sextet_c << 1 * 6)
+         + (sextet_d << 0 * 6);
+
+      if (j < output_length) decoded_data[j++] = (triple >> 2 * 8) & 0xFF;
+      if (j < output_length) decoded_data[j++] = (triple >> 1 * 8) & 0xFF;
+      if (j < output_length) decoded_data[j++] = (triple >> 0 * 8) & 0xFF;
+   }
+   return true;
+}
+
+char* convertToBMP( char* buffer, const int w, const int h )
 {
    unsigned char bmpfileheader[14] = {'B','M', 0,0,0,0, 0,0, 0,0, 54,0,  0,0};
    unsigned char bmpinfoheader[40] = {40,0,0,0, 0,0,0,0, 0,0,0,0,  1,0, 24,0};
    unsigned char bmppad[3] = {0,0,0};
 
-   int w = gWindowWidth;
-   int h = gWindowHeight;
    int filesize = 54 + gWindowDepth*w*h;
 
    bmpfileheader[ 2] = (unsigned char)(filesize    );
@@ -504,267 +483,139 @@ char* convertToBMP( char* buffer )
    return result;
 }
 
-void saveToJPeg( Lacewing::Webserver::Request& request, const std::string& filename, const SceneInfo& sceneInfo, const unsigned char* image )
-{
-   size_t len(0);
-   char* buffer = nullptr;
-   long bufferLength;
-   jo_write_jpg(filename.c_str(), image, sceneInfo.size.x, sceneInfo.size.y, 3, 100 );
-   FILE * pFile;
-   size_t result;
-
-   pFile = fopen ( filename.c_str(), "rb" );
-   if (pFile!=NULL) 
-   {
-      // obtain file size:
-      fseek (pFile , 0 , SEEK_END);
-      bufferLength = ftell (pFile);
-      rewind (pFile);
-
-      // allocate memory to contain the whole file:
-      buffer = new char[bufferLength];
-
-      // copy the file into the buffer:
-      result = fread (buffer,1,bufferLength,pFile);
-      if (result != bufferLength) 
-      {
-         //fputs ("Reading error",stderr); exit (3);
-      }
-
-      /* the whole file is now loaded in the memory buffer. */
-
-      // terminate
-      fclose (pFile);
+/*
+________________________________________________________________________________
 
-      request << "data:image/jpg;base64,";
-      request << base64_encode( (const unsigned char*)buffer, bufferLength, &len );
-      request.AddHeader("Access-Control-Allow-Origin", "*"); // Needed by Chrome!!
-      delete [] buffer;
-   }
+Sets up the frame of a request whose scene is resident. The scheduler then
+path-traces it one iteration at a time and queues the final frame for
+encoding. Only the last iteration is read back from the kernel.
+________________________________________________________________________________
+*/
+void setupFrame( 
+   RenderContext& ctx, const SceneInfo& sceneInfo, const PostProcessingInfo& postProcessingInfo,
+   const Vertex& cameraOrigin, const Vertex& cameraTarget, const Vertex& cameraAngles )
+{
+   FrameInfo& frame = ctx.frame;
+   frame.sceneInfo = sceneInfo;
+   frame.postProcessingInfo = postProcessingInfo;
+   frame.cameraOrigin = cameraOrigin;
+   frame.cameraTarget = cameraTarget;
+   frame.cameraAngles = cameraAngles;
+   frame.sceneInfo.maxPathTracingIterations.x = (ctx.iterations<1) ? 1 : ctx.iterations;
 }
 
-void buildAreaChart( Lacewing::Webserver::Request& request, ChartInfo& chartInfo, const bool& update )
+/*
+________________________________________________________________________________
+
+Returns true when the scene identified by sceneKey is not the one resident in
+the kernel. The kernel is then reset and the caller has to build the scene.
+Otherwise the request only changes the camera or the rendering settings and
+goes straight to the rendering loop.
+________________________________________________________________________________
+*/
+bool prepareScene( RenderContext& ctx, const UseCase usecase, const std::string& sceneKey, const bool& randomMaterials )
 {
-   int frame(0);
-   Vertex cameraOrigin = chartInfo.viewPos;
-   Vertex cameraTarget = chartInfo.viewPos;
-   cameraTarget.z += 10000.f;
-   Vertex cameraAngles = gViewAngles;
+   const bool resident = (ctx.kernel.usecase==usecase && ctx.kernel.sceneKey==sceneKey);
+   Metrics::getInstance().countCache( mcScene, resident );
+   if( resident ) return false;
+
+   initializeKernel( ctx.kernel, randomMaterials );
+   ctx.kernel.usecase = usecase;
+   ctx.kernel.sceneKey = sceneKey;
+   return true;
+}
 
-   Vertex columnSize    = { 400.f, 40.f, 400.f };
-   Vertex columnSpacing = { 400.f, 40.f, 800.f };
-   Vertex size = {500.f,500.f,500.f};
-   int material = 0;
+/*
+________________________________________________________________________________
 
-   SceneInfo sceneInfo = chartInfo.sceneInfo;
-   size_t len(sceneInfo.size.x*sceneInfo.size.y*gWindowDepth);
-   long renderingTime = GetTickCount();
-   int index(0);
-
-   // Ground
-   float sideSize = columnSpacing.x*chartInfo.values[0].size()*0.9f;
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-   if(!update) gChartStartIndex = gNbPrimitives;
-   gpuKernel->setPrimitive( gNbPrimitives, 
-         -sideSize, -10.f, -sideSize, 
-         sideSize, -10.f, -sideSize,
-         sideSize, -10.f,  sideSize,
-               0.f, -10.f,       0.f, 
-         material);
-
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-   gpuKernel->setPrimitive( gNbPrimitives, 
-         sideSize, -10.f,  sideSize, 
-         -sideSize, -10.f,  sideSize,
-         -sideSize, -10.f, -sideSize,
-               0.f, 0.f,       0.f, 
-         material);
-
-   // Wall
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-   gpuKernel->setPrimitive( gNbPrimitives, 
-         -sideSize,         -10.f,  sideSize, 
-         sideSize,         -10.f,  sideSize,
-         sideSize, sideSize-10.f,  sideSize,
-               0.f,      0.f,       0.f, 
-         material);
-      
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-   gpuKernel->setPrimitive( gNbPrimitives, 
-         sideSize, sideSize-10.f,  sideSize, 
-         -sideSize, sideSize-10.f,  sideSize,
-         -sideSize,         -10.f,  sideSize,
-               0.f,      0.f,       0.f, 
-         material);
-
-   // Right Side
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-   gpuKernel->setPrimitive( gNbPrimitives, 
-         sideSize,         -10.f, -sideSize, 
-         sideSize,         -10.f,  sideSize+10.f,
-         sideSize, sideSize-10.f,  sideSize+10.f,
-               0.f,      0.f,       0.f, 
-         material);
-
-   // Left Side
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-   gpuKernel->setPrimitive( gNbPrimitives, 
-         -sideSize,         -10.f, -sideSize, 
-         -sideSize,         -10.f,  sideSize+10.f,
-         -sideSize, sideSize-10.f,  sideSize+10.f,
-               0.f,      0.f,       0.f, 
-         material);
-
-   // Lamp
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptXZPlane ) : gChartStartIndex+(index++);
-   gpuKernel->setPrimitive( gNbPrimitives,  static_cast<float>(rand()%10000-5000), 5000.f, -2000.f-static_cast<float>(rand()%5000), 2000.f, 0.f, 500.f, DEFAULT_LIGHT_MATERIAL);
-
-   // Build Chart
-   for( int s(0); s<NB_MAX_SERIES; ++s )
+Camera and rendering parameters shared by all use cases
+________________________________________________________________________________
+*/
+void applyViewParameters( RenderContext& ctx, const int maxQuality,
+   Vertex& viewPos, Vertex& rotationAngles, SceneInfo& sceneInfo, PostProcessingInfo& postProcessingInfo )
+{
+   if( ctx.params.has(rpDistance) )
    {
-      material = 20+s*5;
-      float x=-(columnSpacing.x*chartInfo.values[s].size())/2.f + columnSpacing.x/4.f;
-
-      std::vector<float>::const_iterator it = chartInfo.values[s].begin();
-      float value=(*it);
-      ++it;
-      for( int i(0); i<chartInfo.values[s].size()-1; ++i )
+      // View distance
+      viewPos.z = ctx.params.distance;
+   }
+   if( ctx.params.has(rpRotation) )
+   {
+      // Rotation angles
+      rotationAngles.x = ctx.params.rotation.x/180.f*static_cast<float>(M_PI);
+      rotationAngles.y = ctx.params.rotation.y/180.f*static_cast<float>(M_PI);
+      rotationAngles.z = ctx.params.rotation.z/180.f*static_cast<float>(M_PI);
+   }
+   if( ctx.params.has(rpBkColor) )
+   {
+      // Background color
+      sceneInfo.backgroundColor.x = ctx.params.bkColor.x/255.f;
+      sceneInfo.backgroundColor.y = ctx.params.bkColor.y/255.f;
+      sceneInfo.backgroundColor.z = ctx.params.bkColor.z/255.f;
+      saturatefloat4(sceneInfo.backgroundColor,0.f,255.f);
+   }
+   if( ctx.params.has(rpQuality) )
+   {
+      // Quality
+      sceneInfo.maxPathTracingIterations.x = (ctx.params.quality>maxQuality) ? maxQuality : ctx.params.quality;
+   }
+   if( ctx.params.has(rpSize) )
+   {
+      // Image Size
+      switch( ctx.params.size ) 
       {
-         float ymin = (value< (*it)) ? value : (*it);
-
-         float offsetZ = s*columnSpacing.z - ( NB_MAX_SERIES * columnSpacing.z )/2.f;
-            
-         // Front
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-         gpuKernel->setPrimitive( gNbPrimitives, 
-                           x,                0.f, offsetZ, 
-            x+columnSize.x,                0.f, offsetZ,
-            x+columnSize.x, ymin*columnSize.y, offsetZ,
-                        0.f,                0.f, 0.f, 
-                  material);
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-         gpuKernel->setPrimitive( gNbPrimitives, 
-            x+columnSize.x, ymin*columnSize.y, offsetZ,
-                           x, ymin*columnSize.y, offsetZ,
-                           x,                0.f, offsetZ, 
-                        0.f,                0.f, 0.f, 
-                  material);
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-         if( value < (*it ) )
-         {
-            gpuKernel->setPrimitive( gNbPrimitives, 
-                              x, value*columnSize.y, offsetZ, 
-               x+columnSize.x, value*columnSize.y, offsetZ,
-               x+columnSize.x, (*it)*columnSize.y, offsetZ,
-                           0.f,                0.f, 0.f, 
-                     material);
-         }
-         else
-         {
-            gpuKernel->setPrimitive( gNbPrimitives, 
-                              x, value*columnSize.y, offsetZ, 
-                              x, (*it)*columnSize.y, offsetZ,
-               x+columnSize.x, (*it)*columnSize.y, offsetZ,
-                           0.f,                0.f, 0.f, 
-                     material);
-         }
-
-         // Back
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-         gpuKernel->setPrimitive( gNbPrimitives, 
-                           x,                0.f, columnSize.z + offsetZ, 
-            x+columnSize.x,                0.f, columnSize.z + offsetZ,
-            x+columnSize.x,  ymin*columnSize.y, columnSize.z + offsetZ,
-                        0.f,                0.f, 0.f, 
-                  material);
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-         gpuKernel->setPrimitive( gNbPrimitives, 
-            x+columnSize.x, ymin*columnSize.y, columnSize.z + offsetZ,
-                           x, ymin*columnSize.y, columnSize.z + offsetZ,
-                           x,               0.f, columnSize.z + offsetZ, 
-                        0.f,               0.f, 0.f, 
-                  material);
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-         if( value < (*it ) )
-         {
-            gpuKernel->setPrimitive( gNbPrimitives, 
-                              x, value*columnSize.y, columnSize.z + offsetZ, 
-               x+columnSize.x, value*columnSize.y, columnSize.z + offsetZ,
-               x+columnSize.x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                           0.f,                0.f, 0.f, 
-                     material);
-         }
-         else
-         {
-            gpuKernel->setPrimitive( gNbPrimitives, 
-                              x, value*columnSize.y, columnSize.z + offsetZ, 
-                              x, (*it)*columnSize.y, columnSize.z + offsetZ,
-               x+columnSize.x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                           0.f,                0.f, 0.f, 
-                     material);
-         }
+      case  1: ctx.width=1024; ctx.height=1024; break;
+      case  2: ctx.width=1600; ctx.height=1600; break;
+      case  3: ctx.width=1920; ctx.height=1920; break;
+      case  4: ctx.width=2048; ctx.height=2048; break;
+      case  5: ctx.width=4096; ctx.height=4096; break;
+      default: ctx.width=512;  ctx.height=512;  
+      }
+      sceneInfo.size.x = ctx.width;
+      sceneInfo.size.y = ctx.height;
+   }
+   if( ctx.params.has(rpPostProcessing) )
+   {
+      // Post Processing
+      int postProcessing = ctx.params.postProcessing;
+      if( postProcessing<0 || postProcessing>2 ) postProcessing = 0;
+      postProcessingInfo.type.x = postProcessing;
+   }
 
-         //top
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-         gpuKernel->setPrimitive( gNbPrimitives, 
-                           x, value*columnSize.y, offsetZ, 
-            x+columnSize.x, (*it)*columnSize.y, offsetZ,
-            x+columnSize.x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                        0.f,                0.f, 0.f, 
-                  material);
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-         gpuKernel->setPrimitive( gNbPrimitives, 
-            x+columnSize.x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                           x, value*columnSize.y, columnSize.z + offsetZ,
-                           x, value*columnSize.y, offsetZ, 
-                        0.f,                0.f, 0.f, 
-                  material);
-
-         // Sides
-         if( i==0 )
-         {
-            gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-            gpuKernel->setPrimitive( gNbPrimitives, 
-                              x,                0.f, offsetZ, 
-                              x, value*columnSize.y, offsetZ,
-                              x, value*columnSize.y, columnSize.z + offsetZ,
-                           0.f,                0.f, 0.f, 
-                     material);
-            gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-            gpuKernel->setPrimitive( gNbPrimitives, 
-                              x, value*columnSize.y, columnSize.z + offsetZ, 
-                              x,                0.f, columnSize.z + offsetZ,
-                              x,                0.f, offsetZ,
-                           0.f,                0.f, 0.f, 
-                     material);
-         }
+   // Cheaper settings when the render queue backs up
+   gOverload->degrade( ctx, sceneInfo, postProcessingInfo );
 
-         if( i==chartInfo.values[s].size()-2 )
-         {
-            gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-            gpuKernel->setPrimitive( gNbPrimitives, 
-               x+columnSize.x,                0.f, offsetZ, 
-               x+columnSize.x, (*it)*columnSize.y, offsetZ,
-               x+columnSize.x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                           0.f,                0.f, 0.f, 
-                     material);
-            gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+(index++);
-            gpuKernel->setPrimitive( gNbPrimitives, 
-               x+columnSize.x, (*it)*columnSize.y, columnSize.z + offsetZ, 
-               x+columnSize.x,                0.f, columnSize.z + offsetZ,
-               x+columnSize.x,                0.f, offsetZ,
-                           0.f,                0.f, 0.f, 
-                     material);
-         }
+   // Estimated cost of the request, for the scheduler
+   ctx.iterations = (sceneInfo.maxPathTracingIterations.x<1) ? 1 : sceneInfo.maxPathTracingIterations.x;
+}
 
-         value = (*it);
-         x += columnSpacing.x;
-         ++it;
-      }
-      material++;
+void renderChart( RenderContext& ctx, const ChartInfo& chartInfo, const ChartStream* stream, const bool& update )
+{
+   // Only the columns whose value changed are rewritten. Ground, walls and
+   // lamp stay resident as long as the shape of the chart does not change.
+   // Streams only rewrite the columns of the new points.
+   if( update ) ctx.kernel.chartScene.reset();
+   bool modified(false);
+   {
+      StageTimer timer( msLoad );
+      modified = stream ? 
+         ctx.kernel.chartScene.updateWindow( *ctx.kernel.kernel, chartInfo.chartType, stream->ring, stream->count ) :
+         ctx.kernel.chartScene.update( *ctx.kernel.kernel, chartInfo.chartType, chartInfo.data );
+   }
+   if( modified )
+   {
+      StageTimer timer( msCompact );
+      ctx.kernel.nbBoxes = ctx.kernel.kernel->compactBoxes( ctx.kernel.chartScene.hasNewPrimitives() );
    }
 
-   gNbBoxes = gpuKernel->compactBoxes(update);
+   // The camera follows sliding windows
+   Vertex cameraOrigin = chartInfo.viewPos;
+   cameraOrigin.x += ctx.kernel.chartScene.getWindowOffset();
+   Vertex cameraTarget = cameraOrigin;
+   cameraTarget.z += (chartInfo.chartType==ChartScene::ctArea) ? 10000.f : 5000.f;
+   Vertex cameraAngles = chartInfo.rotationAngles;
+
+   SceneInfo sceneInfo = chartInfo.sceneInfo;
 
    // Post processing effects
    PostProcessingInfo postProcessingInfo = chartInfo.postProcessingInfo;
@@ -775,254 +626,133 @@ void buildAreaChart( Lacewing::Webserver::Request& request, ChartInfo& chartInfo
    // Shadows
    sceneInfo.graphicsLevel.x = (postProcessingInfo.type.x == 2) ? 4 : 5;
 
-   // Rotation
-   //gpuKernel->rotatePrimitives( gRotationCenter, chartInfo.rotationAngles, 0, gNbBoxes );
-
    // Background color
    sceneInfo.backgroundColor = (postProcessingInfo.type.x == 2 ) ? gBkBlack : sceneInfo.backgroundColor;
 
    // Rendering process
-   unsigned char* image = nullptr;
-   for( int i(0); i<sceneInfo.maxPathTracingIterations.x; ++i)
-   {
-      sceneInfo.pathTracingIteration.x = i;
-      gpuKernel->setPostProcessingInfo( postProcessingInfo );
-      gpuKernel->setSceneInfo( sceneInfo );
-      cameraAngles = chartInfo.rotationAngles;
-      gpuKernel->setCamera( cameraOrigin, cameraTarget, cameraAngles );
-      gpuKernel->render_begin(0.f);
-      gpuKernel->render_end();
-      image = gpuKernel->getBitmap();
-   }
-   std::string filename = "chart.jpg";
-   saveToJPeg( request, filename, sceneInfo, image );
+   setupFrame( ctx, sceneInfo, postProcessingInfo, cameraOrigin, cameraTarget, cameraAngles );
 }
 
-void buildColumnChart( Lacewing::Webserver::Request& request, ChartInfo& chartInfo, const bool& update )
-{
-   Vertex cameraOrigin = chartInfo.viewPos;
-   Vertex cameraTarget = chartInfo.viewPos;
-   cameraTarget.z += 5000.f;
-   Vertex cameraAngles = gViewAngles;
+/*
+________________________________________________________________________________
 
-   Vertex columnSize    = { 400.f, 40.f, 400.f };
-   Vertex columnSpacing = { 440.f, 40.f, 800.f };
-   Vertex size = {500.f,500.f,500.f};
-   int material = 100;
+Chart values are read from the "values" parameter of the query string or of a
+POST form (numbers separated by commas, series by semicolons or line breaks).
+Large data sets can also be posted in binary form: "values32" holds base64
+encoded float32 values, and "points" the number of points of each series.
+________________________________________________________________________________
+*/
+bool readChartValues( RenderContext& ctx, ChartData& data )
+{
+   if( !ctx.params.values.empty() ) return data.parseText( ctx.params.values.data, ctx.params.values.end() );
 
-   SceneInfo sceneInfo = chartInfo.sceneInfo;
-   size_t len(sceneInfo.size.x*sceneInfo.size.y*gWindowDepth);
-   long renderingTime = GetTickCount();
+   const char* values = ctx.getPostValue("values");
+   if( values && *values ) return data.parseText( values, values+strlen(values) );
 
-   // Ground
-   float sideSize = columnSpacing.x*chartInfo.values[0].size()*0.9f;
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex;
-   if(!update) gChartStartIndex = gNbPrimitives;
-
-   gpuKernel->setPrimitive( gNbPrimitives, 
-         -sideSize, -10.f, -sideSize, 
-         sideSize, -10.f, -sideSize,
-         sideSize, -10.f,  sideSize,
-               0.f, -10.f,       0.f, 
-         material);
-
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+1;
-   gpuKernel->setPrimitive( gNbPrimitives, 
-         sideSize, -10.f,  sideSize, 
-         -sideSize, -10.f,  sideSize,
-         -sideSize, -10.f, -sideSize,
-               0.f, 0.f,       0.f, 
-         material);
-
-   // Wall
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+2;
-   gpuKernel->setPrimitive( gNbPrimitives, 
-         -sideSize,         -10.f,  sideSize, 
-         sideSize,         -10.f,  sideSize,
-         sideSize, sideSize-10.f,  sideSize,
-               0.f,      0.f,       0.f, 
-         material);
-      
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+3;
-   gpuKernel->setPrimitive( gNbPrimitives, 
-         sideSize, sideSize-10.f,  sideSize, 
-         -sideSize, sideSize-10.f,  sideSize,
-         -sideSize,         -10.f,  sideSize,
-               0.f,      0.f,       0.f, 
-         material);
-
-   // Lamp
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptXZPlane ) : gChartStartIndex+4;
-   gpuKernel->setPrimitive( gNbPrimitives,  static_cast<float>(rand()%10000-5000), 5000.f, -2000.f-static_cast<float>(rand()%5000), 2000.f, 0.f, 500.f, DEFAULT_LIGHT_MATERIAL);
-
-   // Build Chart
-   int index(0);
-   for( int s(0); s<NB_MAX_SERIES; ++s )
+   values = ctx.getPostValue("values32");
+   if( values && *values )
    {
-      material = 20+s*5;
-      float x=-(columnSpacing.x*chartInfo.values[s].size())/2.f + columnSpacing.x/4.f;
-      std::vector<float>::const_iterator it = chartInfo.values[s].begin();
-      while( it != chartInfo.values[s].end() )
+      std::vector<int> points;
+      const char* p = ctx.getPostValue("points");
+      if( p )
       {
-         float offsetZ = s*columnSpacing.z - ( NB_MAX_SERIES * columnSpacing.z )/2.f;
-         // Front
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+5+index;
-         gpuKernel->setPrimitive( gNbPrimitives, 
-                           x,                0.f, offsetZ, 
-            x+columnSize.x,                0.f, offsetZ,
-            x+columnSize.x, (*it)*columnSize.y, offsetZ,
-                        0.f,                0.f, 0.f, 
-                  material);
-
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+6+index;
-         gpuKernel->setPrimitive( gNbPrimitives, 
-            x+columnSize.x, (*it)*columnSize.y, offsetZ,
-                           x, (*it)*columnSize.y, offsetZ,
-                           x,                0.f, offsetZ, 
-                        0.f,                0.f, 0.f, 
-               material);
-
-         // Back
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+7+index;
-         gpuKernel->setPrimitive( gNbPrimitives, 
-                     x,            0.f, columnSize.z + offsetZ, 
-            x+columnSize.x,            0.f, columnSize.z + offsetZ,
-            x+columnSize.x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                     0.f,            0.f,      0.f, 
-               material);
-
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+8+index;
-         gpuKernel->setPrimitive( gNbPrimitives, 
-            x+columnSize.x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                     x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                     x,            0.f, columnSize.z + offsetZ, 
-                     0.f,            0.f,      0.f, 
-               material);
-
-         // Right side
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+9+index;
-         gpuKernel->setPrimitive( gNbPrimitives, 
-            x+columnSize.x,                0.f,          0.f + offsetZ, 
-            x+columnSize.x,                0.f, columnSize.z + offsetZ,
-            x+columnSize.x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                     0.f,            0.f,      0.f, 
-               material);
-
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+10+index;
-         gpuKernel->setPrimitive( gNbPrimitives, 
-            x+columnSize.x, (*it)*columnSize.y, columnSize.z + offsetZ,
-            x+columnSize.x, (*it)*columnSize.y,          0.f + offsetZ,
-            x+columnSize.x,                0.f,          0.f + offsetZ, 
-                     0.f,            0.f,         0.f, 
-               material);
-
-         // Left side
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+11+index;
-         gpuKernel->setPrimitive( gNbPrimitives, 
-                     x,                0.f,          0.f + offsetZ, 
-                     x,                0.f, columnSize.z + offsetZ,
-                     x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                     0.f,            0.f,      0.f, 
-               material);
-
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+12+index;
-         gpuKernel->setPrimitive( gNbPrimitives, 
-                     x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                     x, (*it)*columnSize.y,      0.f + offsetZ,
-                     x,            0.f,      0.f + offsetZ, 
-                     0.f,            0.f,      0.f, 
-               material);
-
-         // Top side
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+13+index;
-         gpuKernel->setPrimitive( gNbPrimitives, 
-                     x, (*it)*columnSize.y,      0.f + offsetZ, 
-            x+columnSize.x, (*it)*columnSize.y,      0.f + offsetZ,
-            x+columnSize.x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                     0.f,            0.f,      0.f, 
-               material);
-
-         gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+14+index;
-         gpuKernel->setPrimitive( gNbPrimitives, 
-            x+columnSize.x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                     x, (*it)*columnSize.y, columnSize.z + offsetZ,
-                     x, (*it)*columnSize.y,      0.f + offsetZ, 
-                     0.f,            0.f,      0.f, 
-               material);
-
-         x += columnSpacing.x;
-         ++it;
-         index+=10;
+         const char* last = p+strlen(p);
+         while( p<last )
+         {
+            int count(0);
+            const char* next = parseInt( p, last, count );
+            if( next==p ) return false;
+            points.push_back( count );
+            p = (next<last && *next==',') ? next+1 : next;
+         }
       }
-      material++;
+      std::vector<unsigned char> buffer;
+      if( !base64_decode( values, strlen(values), buffer ) ) return false;
+      return data.parseBinary( buffer.empty() ? nullptr : &buffer[0], buffer.size(), points );
    }
+   return false;
+}
 
-   material = 100;
-   // Right Side
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+index+15;
-   gpuKernel->setPrimitive( gNbPrimitives, 
-         sideSize,         -10.f, -sideSize, 
-         sideSize,         -10.f,  sideSize+10.f,
-         sideSize, sideSize-10.f,  sideSize+10.f,
-               0.f,      0.f,       0.f, 
-         material);
-
-   // Left Side
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptTriangle ) : gChartStartIndex+index+16;
-   gpuKernel->setPrimitive( gNbPrimitives, 
-         -sideSize,         -10.f, -sideSize, 
-         -sideSize,         -10.f,  sideSize+10.f,
-         -sideSize, sideSize-10.f,  sideSize+10.f,
-               0.f,      0.f,       0.f, 
-         material);
-
-   gNbBoxes = gpuKernel->compactBoxes(update);
+/*
+________________________________________________________________________________
 
-   // Post processing effects
-   PostProcessingInfo postProcessingInfo = chartInfo.postProcessingInfo;
-   postProcessingInfo.param2.x = 200.f;
-   //postProcessingInfo.param2.x = (postProcessingInfo.type.x==0) ? sceneInfo.maxPathTracingIterations.x*10.f : 5000.f;
-   //postProcessingInfo.param3.x = (postProcessingInfo.type.x != 2 ) ? 40+sceneInfo.maxPathTracingIterations.x*5 : 16;
+Streaming charts
 
-   // Shadows
-   sceneInfo.graphicsLevel.x = (postProcessingInfo.type.x == 2) ? 4 : 5;
+get?stream=id[&window=n][&type=t]&append=values feeds new points to a chart
+session, created on first use. Values have the same syntax as for static
+charts, each series receiving the same number of new points. The session
+only keeps the last 'window' points of each series. close=1 ends it.
+________________________________________________________________________________
+*/
+ChartStream* appendChartStream( RenderContext& ctx, ChartInfo& chartInfo )
+{
+   ChartData points;
+   const char* values = ctx.params.append.data;
+   if( ctx.params.append.empty() ) values = ctx.getPostValue("append");
+   const char* last = ctx.params.append.empty() ? (values ? values+strlen(values) : nullptr) : ctx.params.append.end();
+   if( values && values<last && !points.parseText( values, last ) ) return nullptr;
+
+   // All series move forward together
+   const int nbSeries = points.empty() ? 0 : points.getNbSeries();
+   const int nbPoints = points.empty() ? 0 : points.getNbPoints(0);
+   for( int s(1); s<nbSeries; ++s )
+   {
+      if( points.getNbPoints(s)!=nbPoints ) return nullptr;
+   }
 
-   // Rotation
-   //gpuKernel->rotatePrimitives( gRotationCenter, chartInfo.rotationAngles, 0, gNbBoxes );
+   int window = (chartInfo.window>0) ? chartInfo.window : DEFAULT_CHART_WINDOW;
+   window = (window<2) ? 2 : (window>MAX_CHART_WINDOW) ? MAX_CHART_WINDOW : window;
 
-   // Background color
-   sceneInfo.backgroundColor = (postProcessingInfo.type.x == 2 ) ? gBkBlack : sceneInfo.backgroundColor;
+   // (Re)create the session when it does not exist or changes shape
+   std::map<std::string,ChartStream>::iterator it = gChartStreams.find( chartInfo.stream );
+   bool create = (it==gChartStreams.end());
+   if( !create )
+   {
+      const ChartStream& current = it->second;
+      create = 
+         (nbSeries!=0 && nbSeries!=current.ring.getNbSeries()) ||
+         (chartInfo.window>0 && window!=current.ring.getMaxPoints()) ||
+         (chartInfo.chartType>=0 && chartInfo.chartType!=current.chartType);
+   }
+   if( create )
+   {
+      if( it==gChartStreams.end() && gChartStreams.size()>=MAX_CHART_STREAMS ) return nullptr;
+      ChartStream& stream = gChartStreams[chartInfo.stream];
+      stream.chartType = (chartInfo.chartType>=0) ? chartInfo.chartType : rand()%2;
+      stream.count = 0;
+      stream.ring.resize( (nbSeries!=0) ? nbSeries : 1, window );
+      it = gChartStreams.find( chartInfo.stream );
+   }
 
-   // Rendering process
-   unsigned char* image = nullptr;
-   for( int i(0); i<sceneInfo.maxPathTracingIterations.x; ++i)
+   ChartStream& stream = it->second;
+   window = stream.ring.getMaxPoints();
+   for( int i(0); i<nbPoints; ++i )
    {
-      sceneInfo.pathTracingIteration.x = i;
-      gpuKernel->setPostProcessingInfo( postProcessingInfo );
-      gpuKernel->setSceneInfo( sceneInfo );
-      cameraAngles = chartInfo.rotationAngles;
-      gpuKernel->setCamera( cameraOrigin, cameraTarget, cameraAngles );
-      gpuKernel->render_begin(0.f);
-      gpuKernel->render_end();
-      image = gpuKernel->getBitmap();
+      const int slot = stream.count%window;
+      for( int s(0); s<nbSeries; ++s )
+      {
+         stream.ring.setValue( stream.ring.getOffset(s)+slot, points.getValue(s,i) );
+      }
+      ++stream.count;
    }
-   std::string filename = "chart.jpg";
-   saveToJPeg( request, filename, sceneInfo, image );
+   chartInfo.chartType = stream.chartType;
+   return &stream;
 }
 
-void renderChart( Lacewing::Webserver::Request& request, ChartInfo& chartInfo, const bool& update )
+// The resident window is moved forward as long as the stream keeps its shape
+std::string getStreamKey( const std::string& id, const ChartStream& stream )
 {
-   switch( rand()%2 )
-   {
-   case 0: buildAreaChart( request, chartInfo, true ); break;
-   case 1: buildColumnChart( request, chartInfo, true ); break;
-   }
+   char buffer[64];
+   sprintf( buffer, ":%d:%d:%d", stream.chartType, stream.ring.getNbSeries(), stream.ring.getMaxPoints() );
+   return "stream:" + id + buffer;
 }
 
-void parseChart( Lacewing::Webserver::Request& request, std::string& requestStr, const bool& update )
+bool parseChart( RenderContext& ctx )
 {
    LOG_INFO(1, "parseChart" );
    ChartInfo chartInfo;
+   chartInfo.chartType = -1;
+   chartInfo.window = 0;
    chartInfo.viewPos = gViewPos;
    chartInfo.rotationAngles.x = 0.f;
    chartInfo.rotationAngles.y = 0.f;
@@ -1030,165 +760,96 @@ void parseChart( Lacewing::Webserver::Request& request, std::string& requestStr,
    chartInfo.sceneInfo = gSceneInfo;
    chartInfo.postProcessingInfo = gPostProcessingInfo;
 
-   Lacewing::Webserver::Request::Parameter* p=request.GET();
-   while( p != nullptr )
+   chartInfo.chartType = ctx.params.type;
+   chartInfo.stream = ctx.params.stream.str();
+   chartInfo.window = ctx.params.window;
+   bool close = (ctx.params.close!=0);
+   applyViewParameters( ctx, gMaxPathTracingIterations,
+      chartInfo.viewPos, chartInfo.rotationAngles, chartInfo.sceneInfo, chartInfo.postProcessingInfo );
+
+   std::string sceneKey;
+   if( !chartInfo.stream.empty() )
    {
-      requestStr += p->Name();
-      requestStr += "=";
-      requestStr += p->Value();
-      if( strcmp(p->Name(),"type")==0 )
-      {
-         // --------------------------------------------------------------------------------
-         // Chart Type
-         // --------------------------------------------------------------------------------
-         chartInfo.chartType = atoi(p->Value());
-      }
-      else if ( strcmp(p->Name(),"values") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // values
-         // --------------------------------------------------------------------------------
-#if 0
-         readfloats(p->Value(), chartInfo.values[0] );
-#else
-         for( int s(0); s<NB_MAX_SERIES; ++s) 
-         {
-            for( int i(0); i<10; ++i )
-            {
-               chartInfo.values[s].push_back(10.f+static_cast<float>(rand()%30));
-            }
-         }
-#endif 
-      }
-      else if ( strcmp(p->Name(),"distance") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // View Distance
-         // --------------------------------------------------------------------------------
-         chartInfo.viewPos.z = static_cast<float>(atoi(p->Value()));
-      }
-      else if ( strcmp(p->Name(),"rotation") == 0 )
+      // Streaming chart
+      if( close )
       {
-         // --------------------------------------------------------------------------------
-         // rotation angles
-         // --------------------------------------------------------------------------------
-         chartInfo.rotationAngles = readVertex(p->Value());
-         chartInfo.rotationAngles.x = chartInfo.rotationAngles.x/180.f*static_cast<float>(M_PI);
-         chartInfo.rotationAngles.y = chartInfo.rotationAngles.y/180.f*static_cast<float>(M_PI);
-         chartInfo.rotationAngles.z = chartInfo.rotationAngles.z/180.f*static_cast<float>(M_PI);
+         gChartStreams.erase( chartInfo.stream );
+         ctx.write( "Stream closed" );
+         return false;
       }
-      else if ( strcmp(p->Name(),"bkcolor") == 0 )
+      ChartStream* stream = appendChartStream( ctx, chartInfo );
+      if( !stream )
       {
-         // --------------------------------------------------------------------------------
-         // Backgroud color
-         // --------------------------------------------------------------------------------
-         Vertex c = readVertex(p->Value());
-         chartInfo.sceneInfo.backgroundColor.x = c.x/255.f;
-         chartInfo.sceneInfo.backgroundColor.y = c.y/255.f;
-         chartInfo.sceneInfo.backgroundColor.z = c.z/255.f;
-         saturatefloat4(chartInfo.sceneInfo.backgroundColor,0.f,255.f);
+         ctx.write( "No valid stream values" );
+         return false;
       }
-      else if ( strcmp(p->Name(),"quality") == 0 )
+      sceneKey = getStreamKey( chartInfo.stream, *stream );
+   }
+   else
+   {
+      // Values
+      if( !readChartValues( ctx, chartInfo.data ) || chartInfo.data.empty() )
       {
-         // --------------------------------------------------------------------------------
-         // Quality
-         // --------------------------------------------------------------------------------
-         chartInfo.sceneInfo.maxPathTracingIterations.x = atoi(p->Value());
-         chartInfo.sceneInfo.maxPathTracingIterations.x = 
-            (chartInfo.sceneInfo.maxPathTracingIterations.x>gMaxPathTracingIterations) ? 
-            gMaxPathTracingIterations : 
-            chartInfo.sceneInfo.maxPathTracingIterations.x;
+         ctx.write( "No valid chart values" );
+         return false;
       }
-      else if ( strcmp(p->Name(),"size") == 0 )
+
+      // The resident chart keeps its type unless one is specified
+      if( chartInfo.chartType<0 )
       {
-         // --------------------------------------------------------------------------------
-         // Image Size
-         // --------------------------------------------------------------------------------
-         switch( atoi(p->Value()) ) 
-         {
-         case  1: gWindowWidth=1024; gWindowHeight=1024; break;
-         case  2: gWindowWidth=1600; gWindowHeight=1600; break;
-         case  3: gWindowWidth=1920; gWindowHeight=1920; break;
-         case  4: gWindowWidth=2048; gWindowHeight=2048; break;
-         case  5: gWindowWidth=4096; gWindowHeight=4096; break;
-         default: gWindowWidth=512;  gWindowHeight=512;  
-         }
-         chartInfo.sceneInfo.size.x  = gWindowWidth;
-         chartInfo.sceneInfo.size.y = gWindowHeight;
+         chartInfo.chartType = ctx.kernel.chartScene.isResident() ? ctx.kernel.chartScene.getChartType() : rand()%2;
       }
-      else if ( strcmp(p->Name(),"postprocessing") == 0 )
+
+      // Only the shape of the chart defines the scene. Values are diffed against
+      // the resident geometry, everything else is camera or rendering settings.
+      sceneKey = ChartScene::getShapeKey( chartInfo.chartType, chartInfo.data );
+   }
+   ctx.description += " [" + sceneKey + "]";
+   ctx.usecase  = ucChart;
+   ctx.sceneKey = sceneKey;
+   ctx.chart    = chartInfo;
+   return true;
+}
+
+bool setupChart( RenderContext& ctx )
+{
+   const ChartStream* stream = nullptr;
+   if( !ctx.chart.stream.empty() )
+   {
+      // Points appended since the request came in are rendered as well
+      std::map<std::string,ChartStream>::const_iterator it = gChartStreams.find( ctx.chart.stream );
+      if( it==gChartStreams.end() )
       {
-         // --------------------------------------------------------------------------------
-         // Post Processing
-         // --------------------------------------------------------------------------------
-         int postProcessing = atoi(p->Value());
-         if( postProcessing<0 || postProcessing>2 ) postProcessing = 0;
-         chartInfo.postProcessingInfo.type.x = postProcessing;
+         ctx.write( "Stream closed" );
+         return false;
       }
-
-      p = p->Next();
-      if(p != nullptr) requestStr += "&";
+      stream = &it->second;
+      ctx.sceneKey = getStreamKey( ctx.chart.stream, *stream );
    }
+   bool update = prepareScene( ctx, ucChart, ctx.sceneKey, true );
 
    // Render Chart
-   renderChart( request, chartInfo, update );
+   renderChart( ctx, ctx.chart, stream, update );
+   return true;
 }
 
-void loadPDB( Lacewing::Webserver::Request& request, const MoleculeInfo& moleculeInfo )
+// Gets wait for their PDB file before they are submitted
+void onPdbFetched( RenderContext* ctx, const bool found )
 {
-   // --------------------------------------------------------------------------------
-   // PDB File management
-   // --------------------------------------------------------------------------------
-   std::string fileName("./Pdb/");
-   std::string moleculeName;
-   moleculeName += moleculeInfo.moleculeId;
-   moleculeName += ".pdb";
-
-   fileName += moleculeName;
-   LOG_INFO(1, "Loading " << fileName );
-
-   // Check file existence
-   std::ifstream file( fileName.c_str() );
-   if( file.is_open() )
+   if( found )
    {
-      file.close();
+      ctx->write( "<p align=center>PDB File was not in the cache and had to be downloaded from <a href=http://www.rcsb.org>Protein Data Bank</a></p>" );
+      gScheduler->submit( ctx );
    }
    else
    {
-      // If file is not in the cache, download it
-
-      std::string url("http://www.rcsb.org/pdb/files/");
-      url += moleculeName;
-      HINTERNET IntOpen = ::InternetOpen("Sample", LOCAL_INTERNET_ACCESS, NULL, 0, 0);
-      HINTERNET handle = ::InternetOpenUrl(IntOpen, url.c_str(), NULL, NULL, NULL, NULL);
-
-      if( handle )
-      {
-         std::ofstream myfile(fileName);
-         if (myfile.is_open())
-         {
-            request << "<p align=center>PDB File was not in the cache and had to be downloaded from <a href=http://www.rcsb.org>Protein Data Bank</a></p>";
-            char buffer[2];
-            DWORD dwRead=0;
-            while(::InternetReadFile(handle, buffer, sizeof(buffer)-1, &dwRead) == TRUE)
-            {
-               if ( dwRead == 0) 
-                  break;
-               myfile << buffer;
-            }
-            myfile.close();
-         }
-      }
-      else
-      {
-         // TODO!!!!
-         request << "<p align=center>Unknown molecule</p>";
-      }
-      ::InternetCloseHandle(handle);   
+      ctx->write( "<p align=center>Unknown molecule</p>" );
+      ctx->request->Finish();
+      delete ctx;
    }
 }
 
-void renderPDB( Lacewing::Webserver::Request& request, const MoleculeInfo& moleculeInfo, const bool& update )
+void renderPDB( RenderContext& ctx, const MoleculeInfo& moleculeInfo, const bool& update )
 {
    Vertex cameraOrigin = moleculeInfo.viewPos;
    Vertex cameraTarget = moleculeInfo.viewPos;
@@ -1196,9 +857,7 @@ void renderPDB( Lacewing::Webserver::Request& request, const MoleculeInfo& molec
    cameraTarget.z += 9000.f;
    Vertex cameraAngles = gViewAngles;
 
-   std::string fileName("./Pdb/");
-   fileName += moleculeInfo.moleculeId;
-   fileName += ".pdb";
+   std::string fileName = PdbStore::find( moleculeInfo.moleculeId );
 
    // --------------------------------------------------------------------------------
    // Create 3D Scene
@@ -1207,21 +866,61 @@ void renderPDB( Lacewing::Webserver::Request& request, const MoleculeInfo& molec
    size_t len(sceneInfo.size.x*sceneInfo.size.y*gWindowDepth);
    long renderingTime = GetTickCount();
 
-   // Lamp
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptSphere ) : gChartStartIndex;
-   gpuKernel->setPrimitive( gNbPrimitives,  -10000.f, 10000.f, -10000.f, 50.f, 0.f, 0.f, DEFAULT_LIGHT_MATERIAL);
-
    if( update )
    {
+      // Lamp
+      ctx.kernel.nbPrimitives = ctx.kernel.kernel->addPrimitive( ptSphere );
+      ctx.kernel.kernel->setPrimitive( ctx.kernel.nbPrimitives,  -10000.f, 10000.f, -10000.f, 50.f, 0.f, 0.f, DEFAULT_LIGHT_MATERIAL);
+
       Vertex objectScale = { 20.f,20.f,20.f };
-      PDBReader reader;
-      Vertex size = reader.loadAtomsFromFile(
-         fileName,*gpuKernel,
-         static_cast<GeometryType>(moleculeInfo.structureType),50.f, 20.f,
-         moleculeInfo.scheme,
-         objectScale,false);
+      {
+         StageTimer timer( msLoad );
+         std::string cacheFileName = MoleculeCache::getFileName( moleculeInfo.moleculeId, moleculeInfo.structureType, moleculeInfo.scheme );
+         bool cached(false);
+         if( moleculeInfo.lod!=lodAtoms )
+         {
+            cached = MoleculeCache::load( *ctx.kernel.kernel, fileName,
+               MoleculeCache::getFileName( moleculeInfo.moleculeId, moleculeInfo.structureType, moleculeInfo.scheme, moleculeInfo.lod ) );
+         }
+         if( !cached ) cached = MoleculeCache::load( *ctx.kernel.kernel, fileName, cacheFileName );
+         if( !cached )
+         {
+            // Parsed once, then saved for the next loads in that structure and scheme
+            const int first = ctx.kernel.nbPrimitives+1;
+            std::string textFileName;
+            if( PdbStore::extract( fileName, textFileName ) )
+            {
+               PDBReader reader;
+               Vertex size = reader.loadAtomsFromFile(
+                  textFileName,*ctx.kernel.kernel,
+                  static_cast<GeometryType>(moleculeInfo.structureType),50.f, 20.f,
+                  moleculeInfo.scheme,
+                  objectScale,false);
+               PdbStore::release( fileName, textFileName );
+
+               MoleculeGeometry atoms;
+               MoleculeCache::read( *ctx.kernel.kernel, first, ctx.kernel.kernel->getNbActivePrimitives(), atoms );
+               MoleculeCache::save( atoms, fileName, cacheFileName );
+
+               // Coarser levels, for smaller images of the molecule
+               for( int level(lodAtoms+1); level<NB_LOD_LEVELS; ++level )
+               {
+                  MoleculeGeometry coarse;
+                  MoleculeLod::build( atoms, level, coarse );
+                  MoleculeCache::save( coarse, fileName,
+                     MoleculeCache::getFileName( moleculeInfo.moleculeId, moleculeInfo.structureType, moleculeInfo.scheme, level ) );
+               }
+            }
+            else
+            {
+               LOG_ERROR( "Could not read " << fileName );
+            }
+         }
+         Metrics::getInstance().countCache( mcMolecule, cached );
+      }
+      StageTimer timer( msCompact );
+      ctx.kernel.nbBoxes = ctx.kernel.kernel->compactBoxes(update);
    }
-   gNbBoxes = gpuKernel->compactBoxes(update);
 
    // Post processing effects
    PostProcessingInfo postProcessingInfo = moleculeInfo.postProcessingInfo;
@@ -1235,35 +934,54 @@ void renderPDB( Lacewing::Webserver::Request& request, const MoleculeInfo& molec
    sceneInfo.viewDistance.x = 100000.f;
 
    // Rotation
-   //gpuKernel->rotatePrimitives( gRotationCenter, moleculeInfo.rotationAngles, 0, gNbBoxes );
+   //ctx.kernel.kernel->rotatePrimitives( gRotationCenter, moleculeInfo.rotationAngles, 0, ctx.kernel.nbBoxes );
 
    // Background color
    sceneInfo.backgroundColor = (postProcessingInfo.type.x == 2 ) ? gBkBlack : sceneInfo.backgroundColor;
 
    // Rendering process
-   unsigned char* image = nullptr;
-   for( int i(0); i<sceneInfo.maxPathTracingIterations.x; ++i)
+   cameraAngles = moleculeInfo.rotationAngles;
+   setupFrame( ctx, sceneInfo, postProcessingInfo, cameraOrigin, cameraTarget, cameraAngles );
+}
+
+bool setupPDB( RenderContext& ctx )
+{
+   // Live streams and sessions drop frames until the file is downloaded
+   if( !gPdbFetcher->request( ctx.molecule.moleculeId, nullptr ) ) return false;
+
+   // Level of detail from the image size. Coarse levels are other scenes.
+   MoleculeInfo& molecule = ctx.molecule;
+   molecule.lod = MoleculeLod::select( PdbStore::find( molecule.moleculeId ), molecule.moleculeId,
+      molecule.structureType, molecule.scheme, molecule.sceneInfo.size.x, molecule.sceneInfo.size.y, ctx.listener!=nullptr );
+   std::string sceneKey = ctx.sceneKey;
+   if( molecule.lod!=lodAtoms )
    {
-      sceneInfo.pathTracingIteration.x = i;
-      gpuKernel->setPostProcessingInfo( postProcessingInfo );
-      gpuKernel->setSceneInfo( sceneInfo );
-      cameraAngles = moleculeInfo.rotationAngles;
-      gpuKernel->setCamera( cameraOrigin, cameraTarget, cameraAngles );
-      gpuKernel->render_begin(0.f);
-      gpuKernel->render_end();
-      image = gpuKernel->getBitmap();
+      char level[16];
+      sprintf( level, ":lod%d", molecule.lod );
+      sceneKey += level;
    }
-   std::string filename = "molecule.jpg";
-   saveToJPeg( request, filename, sceneInfo, image );
+
+   bool update = prepareScene( ctx, ucPDB, sceneKey, false );
+
+   // Once per scene, not for every frame of live streams and sessions
+   if( update && molecule.lod!=lodAtoms )
+   {
+      LOG_INFO(1, "Molecule " << molecule.moleculeId << " at level of detail " << molecule.lod );
+   }
+
+   // Render molecule
+   renderPDB( ctx, ctx.molecule, update );
+   return true;
 }
 
-void parsePDB( Lacewing::Webserver::Request& request, std::string& requestStr, const bool& update )
+bool parsePDB( RenderContext& ctx )
 {
    LOG_INFO(1, "parsePDB" );
    MoleculeInfo moleculeInfo;
    moleculeInfo.moleculeId = "";
    moleculeInfo.structureType = 0;
    moleculeInfo.scheme=0;
+   moleculeInfo.lod = lodAtoms;
    moleculeInfo.viewPos = gViewPos;
    moleculeInfo.rotationAngles.x = 0.f;
    moleculeInfo.rotationAngles.y = 0.f;
@@ -1271,123 +989,36 @@ void parsePDB( Lacewing::Webserver::Request& request, std::string& requestStr, c
    moleculeInfo.sceneInfo = gSceneInfo;
    moleculeInfo.postProcessingInfo = gPostProcessingInfo;
 
-   requestStr += request.GetAddress().ToString();
-   requestStr += ": ";
-   requestStr += request.URL();
-   requestStr += "?";
-
-   Lacewing::Webserver::Request::Parameter* p=request.GET();
-   while( p != nullptr )
+   moleculeInfo.moleculeId = ctx.params.molecule.str();
+   if( !PdbStore::isValidId( moleculeInfo.moleculeId ) )
    {
-      requestStr += p->Name();
-      requestStr += "=";
-      requestStr += p->Value();
-      if( strcmp(p->Name(),"molecule")==0 )
-      {
-         // --------------------------------------------------------------------------------
-         // Molecule
-         // --------------------------------------------------------------------------------
-         moleculeInfo.moleculeId = p->Value();
-      }
-      else if ( strcmp(p->Name(),"rotation") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // rotation angles
-         // --------------------------------------------------------------------------------
-         moleculeInfo.rotationAngles = readVertex(p->Value());
-         moleculeInfo.rotationAngles.x = moleculeInfo.rotationAngles.x/180.f*static_cast<float>(M_PI);
-         moleculeInfo.rotationAngles.y = moleculeInfo.rotationAngles.y/180.f*static_cast<float>(M_PI);
-         moleculeInfo.rotationAngles.z = moleculeInfo.rotationAngles.z/180.f*static_cast<float>(M_PI);
-      }
-      else if ( strcmp(p->Name(),"bkcolor") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // Backgroud color
-         // --------------------------------------------------------------------------------
-         Vertex c = readVertex(p->Value());
-         moleculeInfo.sceneInfo.backgroundColor.x = c.x/255.f;
-         moleculeInfo.sceneInfo.backgroundColor.y = c.y/255.f;
-         moleculeInfo.sceneInfo.backgroundColor.z = c.z/255.f;
-         saturatefloat4(moleculeInfo.sceneInfo.backgroundColor,0.f,255.f);
-      }
-      else if ( strcmp(p->Name(),"structure") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // structure
-         // --------------------------------------------------------------------------------
-         moleculeInfo.structureType = atoi(p->Value());
-         if( moleculeInfo.structureType<0 || moleculeInfo.structureType>4 ) moleculeInfo.structureType = 0;
-      }
-      else if ( strcmp(p->Name(),"scheme") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // scheme
-         // --------------------------------------------------------------------------------
-         moleculeInfo.scheme = atoi(p->Value());
-         if( moleculeInfo.scheme<0 || moleculeInfo.scheme>2 ) moleculeInfo.scheme = 0;
-      }
-      else if ( strcmp(p->Name(),"quality") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // Quality
-         // --------------------------------------------------------------------------------
-         moleculeInfo.sceneInfo.maxPathTracingIterations.x = atoi(p->Value());
-         moleculeInfo.sceneInfo.maxPathTracingIterations.x = (moleculeInfo.sceneInfo.maxPathTracingIterations.x>20) ? 20 : moleculeInfo.sceneInfo.maxPathTracingIterations.x;
-      }
-      else if ( strcmp(p->Name(),"distance") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // View Distance
-         // --------------------------------------------------------------------------------
-         moleculeInfo.viewPos.z = static_cast<float>(atoi(p->Value()));
-      }
-      else if ( strcmp(p->Name(),"size") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // Image Size
-         // --------------------------------------------------------------------------------
-         switch( atoi(p->Value()) ) 
-         {
-         case  1: gWindowWidth=1024; gWindowHeight=1024; break;
-         case  2: gWindowWidth=1600; gWindowHeight=1600; break;
-         case  3: gWindowWidth=1920; gWindowHeight=1920; break;
-         case  4: gWindowWidth=2048; gWindowHeight=2048; break;
-         case  5: gWindowWidth=4096; gWindowHeight=4096; break;
-         default: gWindowWidth=512;  gWindowHeight=512;  
-         }
-         moleculeInfo.sceneInfo.size.x = gWindowWidth;
-         moleculeInfo.sceneInfo.size.y = gWindowHeight;
-      }
-      else if ( strcmp(p->Name(),"postprocessing") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // Post Processing
-         // --------------------------------------------------------------------------------
-         int postProcessing = atoi(p->Value());
-         if( postProcessing<0 || postProcessing>2 ) postProcessing = 0;
-         moleculeInfo.postProcessingInfo.type.x = postProcessing;
-      }
-
-      p = p->Next();
-      if(p != nullptr) requestStr += "&";
+      // Never used in a path or a scene key
+      ctx.write( "Invalid molecule" );
+      return false;
    }
-
-   if( update )
+   if( ctx.params.has(rpStructure) )
    {
-      // Load Molecule from file
-      loadPDB( request, moleculeInfo );
+      moleculeInfo.structureType = ctx.params.structure;
+      if( moleculeInfo.structureType<0 || moleculeInfo.structureType>4 ) moleculeInfo.structureType = 0;
    }
-
-   // Render molecule
-   renderPDB( request, moleculeInfo, update );
-
-   // Store information about rendered molecule
-   LOG_INFO(1, request.GetAddress().ToString() << " - " << request.URL() << requestStr );
-   gRequests[request.GetAddress().ToString()] = requestStr;
-   gNbCalls++;
+   if( ctx.params.has(rpScheme) )
+   {
+      moleculeInfo.scheme = ctx.params.scheme;
+      if( moleculeInfo.scheme<0 || moleculeInfo.scheme>2 ) moleculeInfo.scheme = 0;
+   }
+   applyViewParameters( ctx, 20,
+      moleculeInfo.viewPos, moleculeInfo.rotationAngles, moleculeInfo.sceneInfo, moleculeInfo.postProcessingInfo );
+
+   // Molecule, structure and scheme define the scene
+   char settings[32];
+   sprintf( settings, ":%d:%d", moleculeInfo.structureType, moleculeInfo.scheme );
+   ctx.usecase  = ucPDB;
+   ctx.sceneKey = moleculeInfo.moleculeId+settings;
+   ctx.molecule = moleculeInfo;
+   return true;
 }
 
-void renderIRT( Lacewing::Webserver::Request& request, IrtInfo& irtInfo, const bool& update )
+void renderIRT( RenderContext& ctx, IrtInfo& irtInfo, const bool& update )
 {
    Vertex cameraOrigin = irtInfo.viewPos;
    Vertex cameraTarget = irtInfo.viewPos;
@@ -1404,19 +1035,23 @@ void renderIRT( Lacewing::Webserver::Request& request, IrtInfo& irtInfo, const b
    size_t len(irtInfo.sceneInfo.size.x*irtInfo.sceneInfo.size.y*gWindowDepth);
    long renderingTime = GetTickCount();
 
-   // Lamp
-   gNbPrimitives = update ? gpuKernel->addPrimitive( ptSphere ) : gChartStartIndex;
-   gpuKernel->setPrimitive( gNbPrimitives,  -10000.f, 10000.f, -10000.f, 200.f, 0.f, 50.f, DEFAULT_LIGHT_MATERIAL);
-
    if( update )
    {
-      Vertex center={0.f,0.f,0.f};
-      FileMarshaller fm;
-      Vertex size = fm.loadFromFile(*gpuKernel,fileName, center, 5000.f);
-      gNbPrimitives = gpuKernel->addPrimitive( ptXZPlane );
-      gpuKernel->setPrimitive( gNbPrimitives, 0.f, -2520.f, 0.f, 10000.f, 0.f, 10000.f, 100);
+      // Lamp
+      ctx.kernel.nbPrimitives = ctx.kernel.kernel->addPrimitive( ptSphere );
+      ctx.kernel.kernel->setPrimitive( ctx.kernel.nbPrimitives,  -10000.f, 10000.f, -10000.f, 200.f, 0.f, 50.f, DEFAULT_LIGHT_MATERIAL);
+
+      {
+         StageTimer timer( msLoad );
+         Vertex center={0.f,0.f,0.f};
+         FileMarshaller fm;
+         Vertex size = fm.loadFromFile(*ctx.kernel.kernel,fileName, center, 5000.f);
+      }
+      ctx.kernel.nbPrimitives = ctx.kernel.kernel->addPrimitive( ptXZPlane );
+      ctx.kernel.kernel->setPrimitive( ctx.kernel.nbPrimitives, 0.f, -2520.f, 0.f, 10000.f, 0.f, 10000.f, 100);
+      StageTimer timer( msCompact );
+      ctx.kernel.nbBoxes = ctx.kernel.kernel->compactBoxes(update);
    }
-   gNbBoxes = gpuKernel->compactBoxes(update);
       
    // Post processing effects
    PostProcessingInfo postProcessingInfo = irtInfo.postProcessingInfo;
@@ -1429,29 +1064,17 @@ void renderIRT( Lacewing::Webserver::Request& request, IrtInfo& irtInfo, const b
    irtInfo.sceneInfo.graphicsLevel.x = (postProcessingInfo.type.x == 2) ? 4 : 5;
 
    // Rotation
-   // gpuKernel->rotatePrimitives( gRotationCenter, irtInfo.rotationAngles, 0, gNbBoxes );
+   // ctx.kernel.kernel->rotatePrimitives( gRotationCenter, irtInfo.rotationAngles, 0, ctx.kernel.nbBoxes );
 
    // Background color
    irtInfo.sceneInfo.backgroundColor = (postProcessingInfo.type.x == 2 ) ? gBkBlack : irtInfo.sceneInfo.backgroundColor;
 
    // Rendering process
-   unsigned char* image = nullptr;
-   for( int i(0); i<irtInfo.sceneInfo.maxPathTracingIterations.x; ++i)
-   {
-      irtInfo.sceneInfo.pathTracingIteration.x = i;
-      gpuKernel->setPostProcessingInfo( postProcessingInfo );
-      gpuKernel->setSceneInfo( irtInfo.sceneInfo );
-      cameraAngles = irtInfo.rotationAngles;
-      gpuKernel->setCamera( cameraOrigin, cameraTarget, cameraAngles );
-      gpuKernel->render_begin(0.f);
-      gpuKernel->render_end();
-      image = gpuKernel->getBitmap();
-   }
-   std::string filename = "irt.jpg";
-   saveToJPeg( request, filename, irtInfo.sceneInfo, image );
+   cameraAngles = irtInfo.rotationAngles;
+   setupFrame( ctx, irtInfo.sceneInfo, postProcessingInfo, cameraOrigin, cameraTarget, cameraAngles );
 }
 
-void parseIRT( Lacewing::Webserver::Request& request, std::string& requestStr, const bool& update )
+void parseIRT( RenderContext& ctx )
 {
    LOG_INFO(1, "parseIRT" );
    IrtInfo irtInfo;
@@ -1462,142 +1085,154 @@ void parseIRT( Lacewing::Webserver::Request& request, std::string& requestStr, c
    irtInfo.sceneInfo = gSceneInfo;
    irtInfo.postProcessingInfo = gPostProcessingInfo;
 
-   Lacewing::Webserver::Request::Parameter* p=request.GET();
-   while( p != nullptr )
+   irtInfo.filename = ctx.params.model.str();
+   applyViewParameters( ctx, gMaxPathTracingIterations,
+      irtInfo.viewPos, irtInfo.rotationAngles, irtInfo.sceneInfo, irtInfo.postProcessingInfo );
+
+   ctx.usecase  = ucIRT;
+   ctx.sceneKey = irtInfo.filename;
+   ctx.irt      = irtInfo;
+}
+
+bool setupIRT( RenderContext& ctx )
+{
+   // Render
+   bool update = prepareScene( ctx, ucIRT, ctx.sceneKey, true );
+   renderIRT( ctx, ctx.irt, update );
+   return true;
+}
+
+/*
+________________________________________________________________________________
+
+Makes the scene of a parsed request resident. Called by the scheduler when
+the request gets the kernel.
+________________________________________________________________________________
+*/
+bool setupScene( RenderContext& ctx )
+{
+   switch( ctx.usecase )
    {
-      requestStr += p->Name();
-      requestStr += "=";
-      requestStr += p->Value();
-      if( strcmp(p->Name(),"model")==0 )
-      {
-         // --------------------------------------------------------------------------------
-         // Molecule
-         // --------------------------------------------------------------------------------
-         irtInfo.filename = p->Value();
-      }
-      else if ( strcmp(p->Name(),"rotation") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // rotation angles
-         // --------------------------------------------------------------------------------
-         irtInfo.rotationAngles = readVertex(p->Value());
-         irtInfo.rotationAngles.x = irtInfo.rotationAngles.x/180.f*static_cast<float>(M_PI);
-         irtInfo.rotationAngles.y = irtInfo.rotationAngles.y/180.f*static_cast<float>(M_PI);
-         irtInfo.rotationAngles.z = irtInfo.rotationAngles.z/180.f*static_cast<float>(M_PI);
-      }
-      else if ( strcmp(p->Name(),"bkcolor") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // Backgroud color
-         // --------------------------------------------------------------------------------
-         Vertex c = readVertex(p->Value());
-         irtInfo.sceneInfo.backgroundColor.x = c.x/255.f;
-         irtInfo.sceneInfo.backgroundColor.y = c.y/255.f;
-         irtInfo.sceneInfo.backgroundColor.z = c.z/255.f;
-         saturatefloat4(irtInfo.sceneInfo.backgroundColor,0.f,255.f);
-      }
-      else if ( strcmp(p->Name(),"quality") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // Quality
-         // --------------------------------------------------------------------------------
-         irtInfo.sceneInfo.maxPathTracingIterations.x = atoi(p->Value());
-         irtInfo.sceneInfo.maxPathTracingIterations.x = 
-            (irtInfo.sceneInfo.maxPathTracingIterations.x>gMaxPathTracingIterations) ? 
-            gMaxPathTracingIterations : 
-            irtInfo.sceneInfo.maxPathTracingIterations.x;
-      }
-      else if ( strcmp(p->Name(),"distance") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // View Distance
-         // --------------------------------------------------------------------------------
-         irtInfo.viewPos.z = static_cast<float>(atoi(p->Value()));
-      }
-      else if ( strcmp(p->Name(),"size") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // Image Size
-         // --------------------------------------------------------------------------------
-         switch( atoi(p->Value()) ) 
-         {
-         case  1: gWindowWidth=1024; gWindowHeight=1024; break;
-         case  2: gWindowWidth=1600; gWindowHeight=1600; break;
-         case  3: gWindowWidth=1920; gWindowHeight=1920; break;
-         case  4: gWindowWidth=2048; gWindowHeight=2048; break;
-         case  5: gWindowWidth=4096; gWindowHeight=4096; break;
-         default: gWindowWidth=512;  gWindowHeight=512;  
-         }
-         irtInfo.sceneInfo.size.x  = gWindowWidth;
-         irtInfo.sceneInfo.size.y = gWindowHeight;
-      }
-      else if ( strcmp(p->Name(),"postprocessing") == 0 )
-      {
-         // --------------------------------------------------------------------------------
-         // Post Processing
-         // --------------------------------------------------------------------------------
-         int postProcessing = atoi(p->Value());
-         if( postProcessing<0 || postProcessing>2 ) postProcessing = 0;
-         irtInfo.postProcessingInfo.type.x = postProcessing;
-      }
+   case ucChart: return setupChart( ctx );
+   case ucPDB:   return setupPDB( ctx );
+   case ucIRT:   return setupIRT( ctx );
+   default:      return false;
+   }
+}
 
-      p = p->Next();
-      if(p != nullptr) requestStr += "&";
+// name=value&name=value... built with a single allocation
+void describeRequest( RenderContext& ctx )
+{
+   Lacewing::Webserver::Request::Parameter* parameter = ctx.request->GET();
+   size_t length(0);
+   for( Lacewing::Webserver::Request::Parameter* p=parameter; p; p=p->Next() )
+   {
+      length += strlen(p->Name())+strlen(p->Value())+2;
+   }
+   ctx.description.reserve( length+64 );
+   for( Lacewing::Webserver::Request::Parameter* p=parameter; p; p=p->Next() )
+   {
+      if( p!=parameter ) ctx.description += '&';
+      ctx.description += p->Name();
+      ctx.description += '=';
+      ctx.description += p->Value();
    }
+}
 
-   // Render
-   renderIRT( request, irtInfo, update );
+// Fills in the scene of a request from its parsed parameters
+bool parseRequest( RenderContext& ctx )
+{
+   bool rendered(false);
+   if( ctx.params.first==rpMolecule )
+   {
+      rendered = parsePDB( ctx );
+   }
+   else if( ctx.params.first==rpModel )
+   {
+      parseIRT( ctx );
+      rendered = true;
+   }
+   else
+   {
+      rendered = parseChart( ctx );
+
+#if 0
+      FileMarshaller fm;
+      fm.saveToFile( *ctx.kernel.kernel, "chart.irt" );         
+#endif // 0
+   }
+   return rendered;
 }
 
-void parseURL( Lacewing::Webserver::Request& request )
+bool parseURL( RenderContext& ctx )
 {
-   bool update(false);
-   std::string requestStr;
-   Lacewing::Webserver::Request::Parameter* p=request.GET();
-   if( p )
+   bool rendered(false);
    {
-      if(!strcmp(p->Name(), "molecule"))
+      StageTimer timer( msParse );
+      QueryParser::parse( ctx.request->GET(), ctx.params );
+      describeRequest( ctx );
+      if( ctx.params.count!=0 || ctx.request->POST() )
       {
-         if( gCurrentUsecase != ucPDB || strcmp(gCurrentUsecaseValue.c_str(),p->Value()) )
-         {
-            initializeKernel(false);
-            gCurrentUsecase = ucPDB;
-            gCurrentUsecaseValue = p->Value();
-            update=true;
-         }
-         parsePDB( request, requestStr, update );
+         rendered = parseRequest( ctx );
       }
-      else if(!strcmp(p->Name(), "model"))
+   }
+   // Store information about rendered molecule
+   LOG_INFO(1, ctx.request->GetAddress().ToString() << " - " << ctx.request->URL() << ctx.description );
+   Metrics::getInstance().addRequest( ctx.request->GetAddress().ToString(), ctx.description );
+   return rendered;
+}
+
+/*
+________________________________________________________________________________
+
+Poses of a batch or of a live stream: the rotations listed in "poses"
+(x,y,z;x,y,z;... in degrees), or "turntable" frames making a full turn around
+the vertical axis from the requested rotation. Without either, there is a
+single pose.
+________________________________________________________________________________
+*/
+const size_t MAX_BATCH_FRAMES = 360;
+
+bool parsePoses( RenderContext& ctx )
+{
+   ctx.poses.clear();
+   if( !ctx.params.poses.empty() )
+   {
+      const char* p = ctx.params.poses.data;
+      const char* last = ctx.params.poses.end();
+      while( p<last && ctx.poses.size()<=MAX_BATCH_FRAMES )
       {
-         if( gCurrentUsecase != ucIRT || strcmp(gCurrentUsecaseValue.c_str(),p->Value()) )
-         {
-            initializeKernel(true);
-            gCurrentUsecase = ucIRT;
-            gCurrentUsecaseValue = p->Value();
-            update=true;
-         }
-         parseIRT( request, requestStr, update );
+         const char* end = p;
+         while( end<last && *end!=';' ) ++end;
+         ctx.poses.push_back( QueryParser::parseVertex( p, end ) );
+         p = (end<last) ? end+1 : end;
       }
-      else
+   }
+   else
+   {
+      const int nbFrames = (ctx.params.turntable>1) ? ctx.params.turntable : 1;
+      for( int i(0); i<nbFrames && ctx.poses.size()<=MAX_BATCH_FRAMES; ++i )
       {
-         //if( gCurrentUsecase != ucChart )
-         {
-            initializeKernel(true);
-            gCurrentUsecase = ucChart;
-            update=true;
-         }
-         parseChart( request, requestStr, update );
-
-#if 0
-         FileMarshaller fm;
-         fm.saveToFile( *gpuKernel, "chart.irt" );         
-#endif // 0
+         Vertex pose = ctx.params.rotation;
+         pose.y += 360.f*i/nbFrames;
+         ctx.poses.push_back( pose );
       }
    }
-   // Store information about rendered molecule
-   LOG_INFO(1, request.GetAddress().ToString() << " - " << request.URL() << requestStr );
-   gRequests[request.GetAddress().ToString()] = requestStr;
-   gNbCalls++;
+   if( ctx.poses.empty() || ctx.poses.size()>MAX_BATCH_FRAMES ) return false;
+
+   for( size_t i(0); i<ctx.poses.size(); ++i )
+   {
+      ctx.poses[i].x = ctx.poses[i].x/180.f*static_cast<float>(M_PI);
+      ctx.poses[i].y = ctx.poses[i].y/180.f*static_cast<float>(M_PI);
+      ctx.poses[i].z = ctx.poses[i].z/180.f*static_cast<float>(M_PI);
+   }
+   return true;
+}
+
+// Live streams render their scene along their poses
+bool parseLiveRequest( RenderContext& ctx )
+{
+   return parseRequest( ctx ) && parsePoses( ctx );
 }
 
 class WebServer
@@ -1606,6 +1241,8 @@ public:
    static WebServer* getInstance();
    ~WebServer() {};
    static void onGet(Lacewing::Webserver &Webserver, Lacewing::Webserver::Request &request);
+   static void onPost(Lacewing::Webserver &Webserver, Lacewing::Webserver::Request &request);
+   static void onDisconnect(Lacewing::Webserver &Webserver, Lacewing::Webserver::Request &request);
    void setGPUKernel( GPUKernel* kernel );
    GPUKernel* getGPUKernel() { return _kernel; }
 
@@ -1640,16 +1277,39 @@ void WebServer::setGPUKernel( GPUKernel* kernel )
 // 
 void WebServer::onGet(Lacewing::Webserver &Webserver, Lacewing::Webserver::Request &request)
 {
-   std::cout << "Kernel is " << (WebServer::getInstance()->getGPUKernel() ? "assigned" : "not assigned") << std::endl;
+   LOG_INFO(3, "Kernel is " << (WebServer::getInstance()->getGPUKernel() ? "assigned" : "not assigned") );
    // --------------------------------------------------------------------------------
    // Default values
    // --------------------------------------------------------------------------------
 
-   if (!strcmp(request.URL(), "get"))
+   // A batch is a get with a list of poses, rendered from a single scene setup
+   const bool batch = (strcmp(request.URL(), "batch")==0);
+   if (!strcmp(request.URL(), "get") || batch)
    {
+      // Recorded before the overload check, a replay must see the rejected ones too
+      if( gCapture ) gCapture->record( request );
+
+      if( gOverload->getLevel()==OverloadController::olReject )
+      {
+         gOverload->reject( request );
+         return;
+      }
+
+      RenderContext* ctx = new RenderContext( request, *gKernelContext, gSceneInfo.size.x, gSceneInfo.size.y );
+      if( Tracer::isEnabled() ) ctx->trace = new RequestTrace;
+      TraceScope scope( ctx->trace );
+      bool rendered(false);
       try
       {
-         parseURL( request );
+         // Rendering is up to the scheduler, which finishes the request
+         rendered = parseURL( *ctx );
+         if( ctx->trace ) ctx->trace->setDescription( ctx->description );
+         if( rendered && batch )
+         {
+            rendered = ctx->batch = parsePoses( *ctx );
+            if( rendered ) request.SetMimeType( FrameReadback::getMultipartType() );
+            else request << "Invalid poses";
+         }
 
 #if 0
          request << "<body>";
@@ -1680,27 +1340,149 @@ void WebServer::onGet(Lacewing::Webserver &Webserver, Lacewing::Webserver::Reque
       catch(...)
       {
          request << "An exception occured :-( Please try again";
+         rendered = false;
+      }
+      if( !rendered )
+      {
+         delete ctx;
+         request.Finish();
+      }
+      else if( ctx->usecase==ucPDB && !gPdbFetcher->request( ctx->molecule.moleculeId, ctx ) )
+      {
+         // Submitted once its file is downloaded
+      }
+      else
+      {
+         gScheduler->submit( ctx );
+      }
+   }
+   else if (!strcmp(request.URL(), "metrics"))
+   {
+      // Prometheus text format
+      std::string metrics;
+      Metrics::getInstance().write( metrics );
+      char line[256];
+      sprintf( line,
+         "# TYPE imv_render_queue_length gauge\nimv_render_queue_length %d\n"
+         "# TYPE imv_estimated_wait_seconds gauge\nimv_estimated_wait_seconds %.3f\n"
+         "# TYPE imv_live_streams gauge\nimv_live_streams %d\n"
+         "# TYPE imv_interactive_sessions gauge\nimv_interactive_sessions %d\n",
+         gScheduler->getQueueLength(), gOverload->getEstimatedWait()/1000.0,
+         gMjpegServer->getNbStreams(), gWebSocketServer->getNbSessions() );
+      metrics += line;
+      if( gCpuKernel )
+      {
+         sprintf( line,
+            "# TYPE imv_cpu_bvh_build_seconds gauge\nimv_cpu_bvh_build_seconds %.3f\n"
+            "# TYPE imv_cpu_bvh_builds_total counter\nimv_cpu_bvh_builds_total{result=\"built\"} %d\n"
+            "imv_cpu_bvh_builds_total{result=\"reused\"} %d\n"
+            "# TYPE imv_cpu_steps_per_ray gauge\nimv_cpu_steps_per_ray %.2f\n",
+            gCpuKernel->getBuildTime()/1000.0, gCpuKernel->getNbBuilds(), gCpuKernel->getNbReused(),
+            gCpuKernel->getStepsPerRay() );
+         metrics += line;
       }
+      request.SetMimeType( "text/plain; version=0.0.4" );
+      request.Write( metrics.c_str(), static_cast<int>(metrics.length()) );
+      request.Finish();
    }
    else
    {
-      request << gNbCalls << " calls so far<br/>";
-      std::map<std::string,std::string>::const_iterator iter = gRequests.begin();
-      while( iter != gRequests.end() )
+      request << Metrics::getInstance().getNbRequests() << " calls so far<br/>";
+      for( int c(0); c<RenderScheduler::NB_PRIORITY_CLASSES; ++c )
+      {
+         const RenderScheduler::ClassStats& stats = gScheduler->getStats(c);
+         request << RenderScheduler::getClassName(c) << ": " << stats.nbJobs << " frames, ";
+         request << (stats.nbJobs ? stats.totalWait/stats.nbJobs : 0) << " ms average wait, ";
+         request << stats.maxWait << " ms max wait, " << stats.nbPreempted << " preemptions<br/>";
+      }
+      request << "Overload: " << gOverload->getEstimatedWait() << " ms estimated wait, requests per level";
+      for( int l(0); l<OverloadController::NB_OVERLOAD_LEVELS; ++l )
+      {
+         request << " " << gOverload->getNbRequests(l);
+      }
+      request << "<br/>";
+      request << gMjpegServer->getNbStreams() << " live streams<br/>";
+      request << gWebSocketServer->getNbSessions() << " interactive sessions, ";
+      request << gWebSocketServer->getNbCoalesced() << " camera updates coalesced, ";
+      const long long nbTiles = gWebSocketServer->getNbTiles();
+      request << static_cast<int>(nbTiles ? gWebSocketServer->getNbTilesSent()*100/nbTiles : 0) << "% of the tiles sent<br/>";
+      request << gPdbFetcher->getNbDownloads() << " PDB downloads from " << gPdbFetcher->getMirror().c_str() << ", ";
+      request << gPdbFetcher->getNbJoined() << " joined, " << gPdbFetcher->getNbFailed() << " failed<br/>";
+      if( gCpuKernel )
+      {
+         request << "CPU kernel: last hierarchy built in " << static_cast<int>(gCpuKernel->getBuildTime()) << " ms, ";
+         request << gCpuKernel->getNbBuilds() << " built, " << gCpuKernel->getNbReused() << " reused, ";
+         request << static_cast<int>(gCpuKernel->getStepsPerRay()) << " nodes per ray<br/>";
+      }
+      std::vector<Metrics::RecentRequest> recent;
+      Metrics::getInstance().getRecentRequests( recent );
+      for( size_t i(0); i<recent.size(); ++i )
       {
-         request << (*iter).second.c_str() << "<br/>";
-         ++iter;
+         request << recent[i].address << " - " << recent[i].description << "<br/>";
       }
+      request.Finish();
    }
 }
 
+// Chart values too large for a query string are posted as a form
+void WebServer::onPost(Lacewing::Webserver &Webserver, Lacewing::Webserver::Request &request)
+{
+   onGet( Webserver, request );
+}
+
+void WebServer::onDisconnect(Lacewing::Webserver &Webserver, Lacewing::Webserver::Request &request)
+{
+   gScheduler->onDisconnect( request );
+   gFrameReadback->onDisconnect( request );
+   gPdbFetcher->onDisconnect( request );
+}
+
+extern int runParserBenchmark( const char* corpusFile );
+extern int runReplay( int argc, char* argv[] );
+
 int main(int argc, char * argv[])
 {
+   if( argc>2 && strcmp(argv[1],"--bench-parser")==0 )
+   {
+      return runParserBenchmark( argv[2] );
+   }
+   if( argc>2 && strcmp(argv[1],"--replay")==0 )
+   {
+      return runReplay( argc, argv );
+   }
+
+   // Logs are written by a background thread
+   AsyncLog::start( "IMVWebServer.log" );
+
+   // Software rendering on machines without a GPU
+   bool cpu(false);
+   bool compressPdb(false);
+   int nbCpuThreads(0);
+   for( int i(1); i<argc; ++i )
+   {
+      if( strcmp(argv[i],"--cpu")==0 ) cpu = true;
+      if( strcmp(argv[i],"--pdb-compress")==0 ) compressPdb = true;
+      if( strcmp(argv[i],"--cpu-threads")==0 && i+1<argc ) parseInt( argv[i+1], argv[i+1]+strlen(argv[i+1]), nbCpuThreads );
+      if( strcmp(argv[i],"--log-level")==0 && i+1<argc )
+      {
+         int level(1);
+         parseInt( argv[i+1], argv[i+1]+strlen(argv[i+1]), level );
+         AsyncLog::setLevel( level );
+      }
+   }
+   if( cpu )
+   {
+      gCpuKernel = new CpuKernel(false, 460, nbCpuThreads);
+      gpuKernel = gCpuKernel;
+   }
+   else
+   {
 #ifdef USE_CUDA
-   gpuKernel = new CudaKernel(false, 460, 0, 0);
+      gpuKernel = new CudaKernel(false, 460, 0, 0);
 #else
-   gpuKernel = new OpenCLKernel(false, 460, 0, 0);
+      gpuKernel = new OpenCLKernel(false, 460, 0, 0);
 #endif
+   }
    gSceneInfo.size.x = gWindowWidth;
 	gSceneInfo.size.y = gWindowHeight; 
    gSceneInfo.graphicsLevel.x = 5;
@@ -1727,14 +1509,70 @@ int main(int argc, char * argv[])
    gpuKernel->setSceneInfo( gSceneInfo );
    gpuKernel->setPostProcessingInfo( gPostProcessingInfo );
    gpuKernel->initBuffers();
+   gKernelContext = new KernelContext(gpuKernel);
 
    // HTTP Stuff
    Lacewing::EventPump EventPump;
    Lacewing::Webserver Webserver(EventPump);
 
+   // Frames are encoded in the background, requests are finished from the readback stage
+   gFrameReadback = new FrameReadback(EventPump);
+
+   // Cheap requests are rendered first, expensive ones between them
+   gScheduler = new RenderScheduler(EventPump, *gFrameReadback, setupScene);
+
+   // Missing PDB files are downloaded in the background
+   gPdbFetcher = new PdbFetcher(EventPump, onPdbFetched);
+   gPdbFetcher->setCompress( compressPdb );
+
+   // Requests are degraded, then rejected, when the queue backs up
+   gOverload = new OverloadController(*gScheduler);
+   const char* traceFile = nullptr;
+   int traceThreshold(-1);
+   for( int i(1); i+1<argc; ++i )
+   {
+      if( strcmp(argv[i],"--overload")==0 && !gOverload->configure( argv[i+1] ) )
+      {
+         std::cout << "Invalid overload thresholds: " << argv[i+1] << std::endl;
+      }
+      if( strcmp(argv[i],"--trace")==0 ) traceFile = argv[i+1];
+      if( strcmp(argv[i],"--trace-slow")==0 ) parseInt( argv[i+1], argv[i+1]+strlen(argv[i+1]), traceThreshold );
+      if( strcmp(argv[i],"--pdb-mirror")==0 ) gPdbFetcher->setMirror( argv[i+1] );
+      if( strcmp(argv[i],"--capture")==0 )
+      {
+         // Gets are recorded for the replay tool
+         gCapture = new RequestCapture;
+         if( !gCapture->open( argv[i+1] ) )
+         {
+            std::cout << "Cannot open capture file: " << argv[i+1] << std::endl;
+            delete gCapture;
+            gCapture = nullptr;
+         }
+      }
+   }
+
+   // Chrome traces of every request, or of the ones slower than the threshold
+   Tracer::setThreadName( "event loop" );
+   if( traceFile || traceThreshold>=0 )
+   {
+      Tracer::configure( traceFile ? traceFile : "slow-requests.json", (traceThreshold>0) ? traceThreshold : 0 );
+   }
+
    WebServer::getInstance()->setGPUKernel(gpuKernel);
+   Webserver.EnableManualRequestFinish();
    Webserver.onGet(WebServer::onGet);
+   Webserver.onPost(WebServer::onPost);
+   Webserver.onDisconnect(WebServer::onDisconnect);
    Webserver.Host(10000);    
+
+   // Continuous frames, pushed as MJPEG
+   gMjpegServer = new MjpegServer(EventPump, *gScheduler, *gFrameReadback, *gKernelContext, parseLiveRequest);
+   gMjpegServer->host(MJPEG_PORT);
+
+   // Interactive sessions, camera updates over a WebSocket
+   gWebSocketServer = new WebSocketServer(EventPump, *gScheduler, *gFrameReadback, *gKernelContext, parseRequest);
+   gWebSocketServer->host(WEBSOCKET_PORT);
+
    EventPump.StartEventLoop();
 
    return 0;
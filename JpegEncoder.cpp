@@ -26,9 +26,14 @@
 // or create jo_jpeg.h, #define JO_JPEG_HEADER_FILE_ONLY, and
 // then include jo_jpeg.c from it.
 
+#include <vector>
+
 // Returns false on failure
 extern bool jo_write_jpg(const char *filename, const void *data, int width, int height, int comp, int quality);
 
+// Same as jo_write_jpg but appends the encoded stream to 'out' instead of writing a file
+extern bool jo_write_jpg_to_memory(std::vector<unsigned char> &out, const void *data, int width, int height, int comp, int quality);
+
 #endif // JO_INCLUDE_JPEG_H
 
 #ifndef JO_JPEG_HEADER_FILE_ONLY
@@ -41,16 +46,39 @@ extern bool jo_write_jpg(const char *filename, const void *data, int width, int
 #include <stdlib.h>
 #include <math.h>
 
+// Output sink: either a FILE or a growable memory buffer
+struct jo_Sink {
+	FILE *fp;
+	std::vector<unsigned char> *mem;
+};
+
+static void jo_putc(jo_Sink &s, unsigned char c) {
+	if(s.mem) {
+		s.mem->push_back(c);
+	} else {
+		putc(c, s.fp);
+	}
+}
+
+static void jo_write(jo_Sink &s, const void *data, size_t size) {
+	if(s.mem) {
+		const unsigned char *p = (const unsigned char *)data;
+		s.mem->insert(s.mem->end(), p, p+size);
+	} else {
+		fwrite(data, size, 1, s.fp);
+	}
+}
+
 static const unsigned char s_jo_ZigZag[] = { 0,1,5,6,14,15,27,28,2,4,7,13,16,26,29,42,3,8,12,17,25,30,41,43,9,11,18,24,31,40,44,53,10,19,23,32,39,45,52,54,20,22,33,38,46,51,55,60,21,34,37,47,50,56,59,61,35,36,48,49,57,58,62,63 };
 
-static void jo_writeBits(FILE *fp, int &bitBuf, int &bitCnt, const unsigned short *bs) {
+static void jo_writeBits(jo_Sink &fp, int &bitBuf, int &bitCnt, const unsigned short *bs) {
 	bitCnt += bs[1];
 	bitBuf |= bs[0] << (24 - bitCnt);
 	while(bitCnt >= 8) {
 		unsigned char c = (bitBuf >> 16) & 255;
-		putc(c, fp);
+		jo_putc(fp, c);
 		if(c == 255) {
-			putc(0, fp);
+			jo_putc(fp, 0);
 		}
 		bitBuf <<= 8;
 		bitCnt -= 8;
@@ -110,7 +138,7 @@ static void jo_calcBits(int val, unsigned short bits[2]) {
 	bits[0] = val & ((1<<bits[1])-1);
 }
 
-static int jo_processDU(FILE *fp, int &bitBuf, int &bitCnt, float *CDU, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
+static int jo_processDU(jo_Sink &fp, int &bitBuf, int &bitCnt, float *CDU, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
 	const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
 	const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
 
@@ -170,7 +198,7 @@ static int jo_processDU(FILE *fp, int &bitBuf, int &bitCnt, float *CDU, float *f
 	return DU[0];
 }
 
-bool jo_write_jpg(const char *filename, const void *data, int width, int height, int comp, int quality) {
+static bool jo_encode(jo_Sink &fp, const void *data, int width, int height, int comp, int quality) {
 	// Constants that don't pollute global namespace
 	static const unsigned char std_dc_luminance_nrcodes[] = {0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0};
 	static const unsigned char std_dc_luminance_values[] = {0,1,2,3,4,5,6,7,8,9,10,11};
@@ -239,15 +267,6 @@ bool jo_write_jpg(const char *filename, const void *data, int width, int height,
 	static const int UVQT[] = {17,18,24,47,99,99,99,99,18,21,26,66,99,99,99,99,24,26,56,99,99,99,99,99,47,66,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99};
 	static const float aasf[] = { 1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f, 1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f };
 
-	if(!data || !filename || !width || !height || comp > 4 || comp < 1 || comp == 2) {
-		return false;
-	}
-
-	FILE *fp = fopen(filename, "wb");
-	if(!fp) {
-		return false;
-	}
-
 	quality = quality ? quality : 90;
 	quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
 	quality = quality < 50 ? 5000 / quality : 200 - quality * 2;
@@ -270,25 +289,25 @@ bool jo_write_jpg(const char *filename, const void *data, int width, int height,
 
 	// Write Headers
 	static const unsigned char head0[] = { 0xFF,0xD8,0xFF,0xE0,0,0x10,'J','F','I','F',0,1,1,0,0,1,0,1,0,0,0xFF,0xDB,0,0x84,0 };
-	fwrite(head0, sizeof(head0), 1, fp);
-	fwrite(YTable, sizeof(YTable), 1, fp);
-	putc(1, fp);
-	fwrite(UVTable, sizeof(UVTable), 1, fp);
+	jo_write(fp, head0, sizeof(head0));
+	jo_write(fp, YTable, sizeof(YTable));
+	jo_putc(fp, 1);
+	jo_write(fp, UVTable, sizeof(UVTable));
 	const unsigned char head1[] = { 0xFF,0xC0,0,0x11,8,height>>8,height&0xFF,width>>8,width&0xFF,3,1,0x11,0,2,0x11,1,3,0x11,1,0xFF,0xC4,0x01,0xA2,0 };
-	fwrite(head1, sizeof(head1), 1, fp);
-	fwrite(std_dc_luminance_nrcodes+1, sizeof(std_dc_luminance_nrcodes)-1, 1, fp);
-	fwrite(std_dc_luminance_values, sizeof(std_dc_luminance_values), 1, fp);
-	putc(0x10, fp); // HTYACinfo
-	fwrite(std_ac_luminance_nrcodes+1, sizeof(std_ac_luminance_nrcodes)-1, 1, fp);
-	fwrite(std_ac_luminance_values, sizeof(std_ac_luminance_values), 1, fp);
-	putc(1, fp); // HTUDCinfo
-	fwrite(std_dc_chrominance_nrcodes+1, sizeof(std_dc_chrominance_nrcodes)-1, 1, fp);
-	fwrite(std_dc_chrominance_values, sizeof(std_dc_chrominance_values), 1, fp);
-	putc(0x11, fp); // HTUACinfo
-	fwrite(std_ac_chrominance_nrcodes+1, sizeof(std_ac_chrominance_nrcodes)-1, 1, fp);
-	fwrite(std_ac_chrominance_values, sizeof(std_ac_chrominance_values), 1, fp);
+	jo_write(fp, head1, sizeof(head1));
+	jo_write(fp, std_dc_luminance_nrcodes+1, sizeof(std_dc_luminance_nrcodes)-1);
+	jo_write(fp, std_dc_luminance_values, sizeof(std_dc_luminance_values));
+	jo_putc(fp, 0x10); // HTYACinfo
+	jo_write(fp, std_ac_luminance_nrcodes+1, sizeof(std_ac_luminance_nrcodes)-1);
+	jo_write(fp, std_ac_luminance_values, sizeof(std_ac_luminance_values));
+	jo_putc(fp, 1); // HTUDCinfo
+	jo_write(fp, std_dc_chrominance_nrcodes+1, sizeof(std_dc_chrominance_nrcodes)-1);
+	jo_write(fp, std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
+	jo_putc(fp, 0x11); // HTUACinfo
+	jo_write(fp, std_ac_chrominance_nrcodes+1, sizeof(std_ac_chrominance_nrcodes)-1);
+	jo_write(fp, std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
 	static const unsigned char head2[] = { 0xFF,0xDA,0,0xC,3,1,0,2,0x11,3,0x11,0,0x3F,0 };
-	fwrite(head2, sizeof(head2), 1, fp);
+	jo_write(fp, head2, sizeof(head2));
 
 	// Encode 8x8 macroblocks
 	const unsigned char *imageData = (const unsigned char *)data;
@@ -326,11 +345,36 @@ bool jo_write_jpg(const char *filename, const void *data, int width, int height,
 	jo_writeBits(fp, bitBuf, bitCnt, fillBits);
 
 	// EOI
-	putc(0xFF, fp);
-	putc(0xD9, fp);
-
-   fclose(fp);
+	jo_putc(fp, 0xFF);
+	jo_putc(fp, 0xD9);
 	return true;
 }
 
+bool jo_write_jpg(const char *filename, const void *data, int width, int height, int comp, int quality) {
+	if(!data || !filename || !width || !height || comp > 4 || comp < 1 || comp == 2) {
+		return false;
+	}
+
+	FILE *fp = fopen(filename, "wb");
+	if(!fp) {
+		return false;
+	}
+
+	jo_Sink sink = { fp, 0 };
+	bool result = jo_encode(sink, data, width, height, comp, quality);
+	fclose(fp);
+	return result;
+}
+
+bool jo_write_jpg_to_memory(std::vector<unsigned char> &out, const void *data, int width, int height, int comp, int quality) {
+	if(!data || !width || !height || comp > 4 || comp < 1 || comp == 2) {
+		return false;
+	}
+
+	// Compressed output is rarely larger than a quarter of the raw RGB frame
+	out.reserve(out.size() + width*height*comp/4);
+	jo_Sink sink = { 0, &out };
+	return jo_encode(sink, data, width, height, comp, quality);
+}
+
 #endif
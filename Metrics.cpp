@@ -0,0 +1,205 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "Metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Upper bounds of the histogram buckets, in microseconds
+static const LONGLONG BUCKET_BOUNDS[LatencyHistogram::NB_BUCKETS-1] =
+{
+   100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+   100000, 250000, 500000, 1000000, 2500000, 5000000
+};
+
+static const char* CACHE_NAMES[NB_METRIC_CACHES] =
+{
+   "scene", "pdb", "molecule"
+};
+
+static const char* STAGE_NAMES[NB_METRIC_STAGES] =
+{
+   "parse", "fetch", "load", "compact", "render", "readback", "jpeg", "base64", "send"
+};
+
+// ----------------------------------------------------------------------
+// Histogram
+// ----------------------------------------------------------------------
+LatencyHistogram::LatencyHistogram()
+ : _count(0), _sum(0)
+{
+   for( int i(0); i<NB_BUCKETS; ++i ) _buckets[i] = 0;
+}
+
+void LatencyHistogram::record( const LONGLONG microseconds )
+{
+   int bucket(0);
+   while( bucket<NB_BUCKETS-1 && microseconds>BUCKET_BOUNDS[bucket] ) ++bucket;
+   InterlockedIncrement( &_buckets[bucket] );
+   InterlockedIncrement( &_count );
+   InterlockedExchangeAdd64( &_sum, microseconds );
+}
+
+void LatencyHistogram::write( std::string& out, const char* name, const char* stage ) const
+{
+   char line[256];
+   LONG cumulated(0);
+   for( int i(0); i<NB_BUCKETS; ++i )
+   {
+      cumulated += _buckets[i];
+      if( i<NB_BUCKETS-1 )
+      {
+         sprintf( line, "%s_bucket{stage=\"%s\",le=\"%g\"} %ld\n", name, stage, BUCKET_BOUNDS[i]/1000000.0, cumulated );
+      }
+      else
+      {
+         sprintf( line, "%s_bucket{stage=\"%s\",le=\"+Inf\"} %ld\n", name, stage, cumulated );
+      }
+      out += line;
+   }
+   sprintf( line, "%s_sum{stage=\"%s\"} %.6f\n", name, stage, _sum/1000000.0 );
+   out += line;
+   sprintf( line, "%s_count{stage=\"%s\"} %ld\n", name, stage, _count );
+   out += line;
+}
+
+// ----------------------------------------------------------------------
+// Metrics
+// ----------------------------------------------------------------------
+LONGLONG Metrics::_frequency = 0;
+
+Metrics& Metrics::getInstance()
+{
+   // Built before main, no thread can race on it
+   static Metrics instance;
+   return instance;
+}
+
+// Forces the construction of the instance during static initialization
+static Metrics& gMetrics = Metrics::getInstance();
+
+Metrics::Metrics()
+ : _nbRequests(0)
+{
+   LARGE_INTEGER frequency;
+   QueryPerformanceFrequency( &frequency );
+   _frequency = frequency.QuadPart;
+   memset( _recent, 0, sizeof(_recent) );
+   for( int c(0); c<NB_METRIC_CACHES; ++c )
+   {
+      _cacheHits[c] = 0;
+      _cacheMisses[c] = 0;
+   }
+}
+
+LONGLONG Metrics::getTicks()
+{
+   LARGE_INTEGER ticks;
+   QueryPerformanceCounter( &ticks );
+   return ticks.QuadPart;
+}
+
+LONGLONG Metrics::getMicroseconds( const LONGLONG ticks )
+{
+   // Split so that absolute times do not overflow
+   return _frequency ? (ticks/_frequency)*1000000+(ticks%_frequency)*1000000/_frequency : 0;
+}
+
+const char* Metrics::getStageName( const int stage )
+{
+   return (stage>=0 && stage<NB_METRIC_STAGES) ? STAGE_NAMES[stage] : "unknown";
+}
+
+void Metrics::record( const MetricStage stage, const LONGLONG microseconds )
+{
+   _stages[stage].record( microseconds );
+}
+
+void Metrics::countCache( const MetricCache cache, const bool hit )
+{
+   InterlockedIncrement( hit ? &_cacheHits[cache] : &_cacheMisses[cache] );
+}
+
+void Metrics::addRequest( const std::string& address, const std::string& description )
+{
+   // Unsigned, the counter goes negative after 2^31 requests
+   const ULONG index = static_cast<ULONG>(InterlockedIncrement( &_nbRequests ))-1;
+   RecentRequest& request = _recent[index%NB_RECENT_REQUESTS];
+   InterlockedExchange( &request.sequence, 0 );
+   request.time = GetTickCount();
+   strncpy( request.address, address.c_str(), sizeof(request.address)-1 );
+   request.address[sizeof(request.address)-1] = 0;
+   strncpy( request.description, description.c_str(), sizeof(request.description)-1 );
+   request.description[sizeof(request.description)-1] = 0;
+   InterlockedExchange( &request.sequence, static_cast<LONG>(index+1) );
+}
+
+void Metrics::getRecentRequests( std::vector<RecentRequest>& requests ) const
+{
+   requests.clear();
+   const ULONG last = static_cast<ULONG>(_nbRequests);
+   const ULONG count = (last<NB_RECENT_REQUESTS) ? last : NB_RECENT_REQUESTS;
+   for( ULONG i(0); i<count; ++i )
+   {
+      const ULONG index = last-1-i;
+      const LONG sequence = static_cast<LONG>(index+1);
+      const RecentRequest& slot = _recent[index%NB_RECENT_REQUESTS];
+      if( slot.sequence!=sequence ) continue;
+      RecentRequest copy;
+      memcpy( &copy, const_cast<const RecentRequest*>(&slot), sizeof(copy) );
+      MemoryBarrier();
+      // Overwritten while copied
+      if( slot.sequence!=sequence ) continue;
+      requests.push_back( copy );
+   }
+}
+
+void Metrics::write( std::string& out ) const
+{
+   char line[256];
+   out += "# HELP imv_requests_total Requests parsed since startup\n";
+   out += "# TYPE imv_requests_total counter\n";
+   sprintf( line, "imv_requests_total %lu\n", static_cast<ULONG>(_nbRequests) );
+   out += line;
+
+   out += "# HELP imv_cache_requests_total Cache lookups by result\n";
+   out += "# TYPE imv_cache_requests_total counter\n";
+   for( int c(0); c<NB_METRIC_CACHES; ++c )
+   {
+      sprintf( line, "imv_cache_requests_total{cache=\"%s\",result=\"hit\"} %ld\n", CACHE_NAMES[c], _cacheHits[c] );
+      out += line;
+      sprintf( line, "imv_cache_requests_total{cache=\"%s\",result=\"miss\"} %ld\n", CACHE_NAMES[c], _cacheMisses[c] );
+      out += line;
+   }
+
+   out += "# HELP imv_stage_duration_seconds Time spent in each stage of the pipeline\n";
+   out += "# TYPE imv_stage_duration_seconds histogram\n";
+   for( int s(0); s<NB_METRIC_STAGES; ++s )
+   {
+      _stages[s].write( out, "imv_stage_duration_seconds", STAGE_NAMES[s] );
+   }
+}
@@ -0,0 +1,161 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#pragma once
+
+#include <windows.h>
+
+#include <string>
+#include <vector>
+
+#include "Tracer.h"
+
+// Stages of the pipeline with a latency histogram
+enum MetricStage
+{
+   msParse    = 0, // Query string to render context
+   msFetch    = 1, // PDB file download, on a fetcher thread
+   msLoad     = 2, // PDB parsing, model loading, chart update
+   msCompact  = 3, // compactBoxes
+   msRender   = 4, // One path tracing iteration
+   msReadback = 5, // Copy of the frame out of the kernel
+   msJpeg     = 6,
+   msBase64   = 7,
+   msSend     = 8, // Writing the response or the frame to the client
+   NB_METRIC_STAGES
+};
+
+// Caches with a hit rate
+enum MetricCache
+{
+   mcScene    = 0, // Scene already resident in the kernel
+   mcPdb      = 1, // PDB file found on disk, not downloaded
+   mcMolecule = 2, // Molecule loaded from its binary cache, not parsed
+   NB_METRIC_CACHES
+};
+
+/*
+________________________________________________________________________________
+
+Latency histogram
+
+Fixed buckets, from 100 microseconds to 5 seconds. Updated with interlocked
+operations, so that stages on the readback thread can record without a lock.
+________________________________________________________________________________
+*/
+class LatencyHistogram
+{
+public:
+   static const int NB_BUCKETS = 16; // The last one is +Inf
+
+public:
+   LatencyHistogram();
+
+   void record( const LONGLONG microseconds );
+
+   // Prometheus text, cumulative buckets in seconds
+   void write( std::string& out, const char* name, const char* stage ) const;
+
+private:
+   volatile LONG     _buckets[NB_BUCKETS];
+   volatile LONG     _count;
+   volatile LONGLONG _sum; // Microseconds
+};
+
+/*
+________________________________________________________________________________
+
+Server metrics
+
+Latency per stage and the last requests, cheap enough to always be on. Recent
+requests are kept in a fixed ring: writers claim a slot with an interlocked
+increment and publish it with its sequence number, readers skip the slots
+being written. Exposed on /metrics in Prometheus text format.
+________________________________________________________________________________
+*/
+class Metrics
+{
+public:
+   static const int NB_RECENT_REQUESTS = 64;
+
+   struct RecentRequest
+   {
+      volatile LONG sequence; // Index of the request + 1, 0 while written
+      DWORD time;             // GetTickCount when parsed
+      char  address[48];
+      char  description[208];
+   };
+
+public:
+   static Metrics& getInstance();
+
+   void record( const MetricStage stage, const LONGLONG microseconds );
+   void countCache( const MetricCache cache, const bool hit );
+
+   void addRequest( const std::string& address, const std::string& description );
+   unsigned int getNbRequests() const { return static_cast<ULONG>(_nbRequests); }
+
+   // Most recent first
+   void getRecentRequests( std::vector<RecentRequest>& requests ) const;
+
+   // Prometheus text format
+   void write( std::string& out ) const;
+
+   static const char* getStageName( const int stage );
+
+   // High resolution clock
+   static LONGLONG getTicks();
+   static LONGLONG getMicroseconds( const LONGLONG ticks );
+
+private:
+   Metrics();
+
+private:
+   LatencyHistogram _stages[NB_METRIC_STAGES];
+   volatile LONG    _cacheHits[NB_METRIC_CACHES];
+   volatile LONG    _cacheMisses[NB_METRIC_CACHES];
+   volatile LONG    _nbRequests;
+   RecentRequest    _recent[NB_RECENT_REQUESTS];
+
+   static LONGLONG  _frequency; // Ticks per second
+};
+
+// Records the time spent in a scope, and adds it to the trace of the current
+// request when tracing
+class StageTimer
+{
+public:
+   StageTimer( const MetricStage stage ) : _stage(stage), _start(Metrics::getTicks()) {}
+   ~StageTimer()
+   {
+      const LONGLONG end = Metrics::getTicks();
+      Metrics::getInstance().record( _stage, Metrics::getMicroseconds( end-_start ) );
+      RequestTrace* trace = Tracer::getCurrent();
+      if( trace ) trace->addEvent( Metrics::getStageName( _stage ), _start, end );
+   }
+
+private:
+   MetricStage _stage;
+   LONGLONG    _start;
+};
@@ -0,0 +1,252 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "MjpegServer.h"
+#include "QueryParser.h"
+#include "AsyncLog.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Frames per second
+const int DEFAULT_FPS = 10;
+const int MAX_FPS     = 30;
+
+// Frames of a turn when the request has neither poses nor turntable
+const int DEFAULT_TURNTABLE = 120;
+
+// Size of the HTTP request, query string included
+const size_t MAX_HEADER_SIZE = 8192;
+
+// Highest rate of a stream, at which its backlog is assumed to drain, and
+// backlog above which frames are skipped
+const double STREAM_BYTES_PER_SECOND = 1024.0*1024.0;
+const double MAX_STREAM_BACKLOG      = 512.0*1024.0;
+
+#define STREAM_BOUNDARY "imvstream"
+
+// ----------------------------------------------------------------------
+// Stream
+// ----------------------------------------------------------------------
+MjpegStream::MjpegStream( MjpegServer& server, Lacewing::Server::Client& client )
+ : _server(server), _client(client), _template(nullptr), _timer(server._pump),
+   _started(false), _inFlight(false), _frame(0), _iterations(1), _maxIterations(1),
+   _iterationTime(0.f), _interval(1000/DEFAULT_FPS), _submitted(0), _backlog(0.0), _drained(GetTickCount())
+{
+   _timer.Tag = this;
+   _timer.onTick( onTick );
+   _server._nbStreams++;
+}
+
+MjpegStream::~MjpegStream()
+{
+   _timer.Stop();
+   _server._scheduler.onDisconnect( *this );
+   _server._readback.onDisconnect( *this );
+   delete _template;
+   _server._nbStreams--;
+}
+
+bool MjpegStream::receive( const char* data, const int size )
+{
+   // Anything sent once the stream has started is ignored
+   if( _started ) return true;
+
+   _header.append( data, size );
+   size_t end = _header.find( "\r\n\r\n" );
+   if( end==std::string::npos ) end = _header.find( "\n\n" );
+   if( end==std::string::npos ) return _header.size()<MAX_HEADER_SIZE;
+
+   const char* first = _header.c_str();
+   const char* last = first+_header.find( '\n' );
+   if( last>first && last[-1]=='\r' ) --last;
+
+   bool started(false);
+   try
+   {
+      started = start( first, last );
+   }
+   catch(...)
+   {
+   }
+   if( !started )
+   {
+      const char* response = 
+         "HTTP/1.0 400 Bad Request\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n"
+         "Syntax: GET /stream?molecule=XXXX|model=XXXX|values=...[&fps=1-30][&poses=x,y,z;...|&turntable=N]";
+      _client.Send( response, static_cast<int>(strlen(response)) );
+   }
+   return started;
+}
+
+bool MjpegStream::start( const char* first, const char* last )
+{
+   // Request line: GET /path?query HTTP/1.x
+   if( last-first<4 || strncmp( first, "GET ", 4 )!=0 ) return false;
+   const char* target = first+4;
+   const char* end = target;
+   while( end<last && *end!=' ' ) ++end;
+   const char* query = target;
+   while( query<end && *query!='?' ) ++query;
+   if( query==end ) return false;
+
+   // Parameters point into the query buffers, which live as long as the stream
+   _query.assign( query, end );
+   _scratch.resize( _query.size() );
+   _template = new RenderContext( *this, _server._kernel, 512, 512 );
+   RequestParams& params = _template->params;
+   QueryParser::parse( &_query[0], &_query[0]+_query.size(), params, &_scratch[0] );
+   if( params.count==0 ) return false;
+
+   // Streams default to small frames and a turn every few seconds
+   if( !params.has(rpSize) )
+   {
+      params.present |= (1u<<rpSize);
+      params.size = 0;
+   }
+   if( params.poses.empty() && params.turntable<2 ) params.turntable = DEFAULT_TURNTABLE;
+   int fps = params.has(rpFps) ? params.fps : DEFAULT_FPS;
+   fps = (fps<1) ? 1 : (fps>MAX_FPS) ? MAX_FPS : fps;
+   _interval = 1000/fps;
+
+   _template->description.assign( target, end );
+   if( !_server._parser( *_template ) || _template->poses.empty() ) return false;
+   _maxIterations = _template->iterations;
+   LOG_INFO(1, "MJPEG stream " << _client.GetAddress().ToString() << " - " << _template->description );
+
+   const char* response =
+      "HTTP/1.0 200 OK\r\n"
+      "Content-Type: multipart/x-mixed-replace; boundary=" STREAM_BOUNDARY "\r\n"
+      "Cache-Control: no-cache\r\n"
+      "Connection: close\r\n"
+      "Access-Control-Allow-Origin: *\r\n\r\n";
+   _client.Send( response, static_cast<int>(strlen(response)) );
+
+   _started = true;
+   _header.clear();
+   _timer.Start( _interval );
+   next();
+   return true;
+}
+
+void MjpegStream::next()
+{
+   if( _inFlight ) return;
+
+   // The client is behind, this frame is skipped
+   const DWORD now = GetTickCount();
+   _backlog -= (now-_drained)*STREAM_BYTES_PER_SECOND/1000.0;
+   _backlog = (_backlog<0.0) ? 0.0 : _backlog;
+   _drained = now;
+   if( _backlog>MAX_STREAM_BACKLOG ) return;
+
+   // Same scene, next pose of the path
+   RenderContext* ctx = _template->clone();
+   ctx->poses.assign( 1, _template->poses[_frame%_template->poses.size()] );
+   ctx->iterations = _iterations;
+
+   _inFlight = true;
+   _submitted = GetTickCount();
+   _server._scheduler.submit( ctx );
+}
+
+void MjpegStream::onFrame( const std::string& jpeg, TileEncoder* tiles )
+{
+   _inFlight = false;
+   ++_frame;
+
+   char header[128];
+   sprintf( header, "--" STREAM_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %d\r\n\r\n",
+      static_cast<int>(jpeg.size()) );
+   _client.Send( header, static_cast<int>(strlen(header)) );
+   _client.Send( jpeg.c_str(), static_cast<int>(jpeg.size()) );
+   _client.Send( "\r\n", 2 );
+   _backlog += static_cast<double>(strlen(header)+jpeg.size()+2);
+
+   // Iterations that fit in the frame interval, keeping some of it for
+   // the encoding and the transfer
+   const float perIteration = static_cast<float>(GetTickCount()-_submitted)/_iterations;
+   _iterationTime = (_iterationTime>0.f) ? 0.75f*_iterationTime+0.25f*perIteration : perIteration;
+   int iterations = _maxIterations;
+   if( _iterationTime>0.f )
+   {
+      const float fit = 0.8f*_interval/_iterationTime;
+      if( fit<iterations ) iterations = static_cast<int>(fit);
+   }
+   _iterations = (iterations<1) ? 1 : iterations;
+}
+
+void MjpegStream::onFrameDropped()
+{
+   // The scene of the stream can no longer be rendered
+   _inFlight = false;
+   _timer.Stop();
+   _client.Disconnect();
+}
+
+void MjpegStream::onTick( Lacewing::Timer& timer )
+{
+   static_cast<MjpegStream*>(timer.Tag)->next();
+}
+
+// ----------------------------------------------------------------------
+// Server
+// ----------------------------------------------------------------------
+MjpegServer* MjpegServer::_instance = nullptr;
+
+MjpegServer::MjpegServer( Lacewing::Pump& pump, RenderScheduler& scheduler, FrameReadback& readback,
+   KernelContext& kernel, RequestParser parser )
+ : _pump(pump), _server(pump), _scheduler(scheduler), _readback(readback), _kernel(kernel),
+   _parser(parser), _nbStreams(0)
+{
+   _instance = this;
+   _server.onConnect( onConnect );
+   _server.onReceive( onReceive );
+   _server.onDisconnect( onDisconnect );
+}
+
+void MjpegServer::host( const int port )
+{
+   _server.DisableNagling();
+   _server.Host( port );
+}
+
+void MjpegServer::onConnect( Lacewing::Server& server, Lacewing::Server::Client& client )
+{
+   client.Tag = new MjpegStream( *_instance, client );
+}
+
+void MjpegServer::onReceive( Lacewing::Server& server, Lacewing::Server::Client& client, const char* data, int size )
+{
+   MjpegStream* stream = static_cast<MjpegStream*>(client.Tag);
+   if( stream && !stream->receive( data, size ) ) client.Disconnect();
+}
+
+void MjpegServer::onDisconnect( Lacewing::Server& server, Lacewing::Server::Client& client )
+{
+   delete static_cast<MjpegStream*>(client.Tag);
+   client.Tag = nullptr;
+}
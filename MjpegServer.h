@@ -0,0 +1,142 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#pragma once
+
+#include <windows.h>
+#include <lacewing.h>
+
+#include <string>
+#include <vector>
+
+#include "FrameReadback.h"
+#include "RenderContext.h"
+#include "RenderScheduler.h"
+
+class MjpegServer;
+
+/*
+________________________________________________________________________________
+
+MJPEG stream
+
+One client of the MJPEG server. The query string of its HTTP request is parsed
+once, then frames are rendered continuously along the camera path (poses) or
+the turntable of the request, and pushed as the parts of a
+multipart/x-mixed-replace response.
+
+A frame is only submitted once the previous one was handed to the client, at
+most fps times per second. lacewing buffers what the socket cannot take and
+does not tell how much is left, so each stream estimates its backlog: the
+bytes it sent, drained at the highest rate a stream may use. Frames are
+skipped while the backlog is too large, which bounds what a slow client can
+make the server hold. The number of path tracing iterations follows the time
+taken by the last frames so that the stream holds its frame rate, up to the
+quality of the request.
+________________________________________________________________________________
+*/
+class MjpegStream : public FrameListener
+{
+public:
+   MjpegStream( MjpegServer& server, Lacewing::Server::Client& client );
+   ~MjpegStream();
+
+   // Accumulates the HTTP request. Returns false when the client has to be
+   // disconnected.
+   bool receive( const char* data, const int size );
+
+   virtual void onFrame( const std::string& jpeg, TileEncoder* tiles );
+   virtual void onFrameDropped();
+
+private:
+   bool start( const char* first, const char* last );
+   void next();
+
+   static void onTick( Lacewing::Timer& timer );
+
+private:
+   MjpegServer& _server;
+   Lacewing::Server::Client& _client;
+
+   std::string       _header;   // HTTP request, until it is complete
+   std::vector<char> _query;    // Parameters of the request point in there
+   std::vector<char> _scratch;
+   RenderContext*    _template; // Parsed request, copied for each frame
+   Lacewing::Timer   _timer;
+
+   bool  _started;
+   bool  _inFlight;
+   int   _frame;
+   int   _iterations;
+   int   _maxIterations;
+   float _iterationTime; // Milliseconds per iteration, moving average
+   DWORD _interval;      // Milliseconds between frames
+   DWORD _submitted;
+   double _backlog;      // Bytes sent and possibly still queued, estimated
+   DWORD  _drained;      // Last update of the backlog
+};
+
+/*
+________________________________________________________________________________
+
+MJPEG server
+
+Serves live streams on a port of its own: the web server only sends a
+response once it is finished, which a stream never is. Any path is accepted,
+the query string takes the parameters of get plus fps (1 to 30 frames per
+second).
+________________________________________________________________________________
+*/
+class MjpegServer
+{
+public:
+   // Fills in the scene of a request from its parsed parameters
+   typedef bool (*RequestParser)( RenderContext& ctx );
+
+public:
+   MjpegServer( Lacewing::Pump& pump, RenderScheduler& scheduler, FrameReadback& readback,
+      KernelContext& kernel, RequestParser parser );
+
+   void host( const int port );
+
+   int getNbStreams() const { return _nbStreams; }
+
+private:
+   friend class MjpegStream;
+
+   static void onConnect( Lacewing::Server& server, Lacewing::Server::Client& client );
+   static void onReceive( Lacewing::Server& server, Lacewing::Server::Client& client, const char* data, int size );
+   static void onDisconnect( Lacewing::Server& server, Lacewing::Server::Client& client );
+
+   static MjpegServer* _instance;
+
+private:
+   Lacewing::Pump&  _pump;
+   Lacewing::Server _server;
+   RenderScheduler& _scheduler;
+   FrameReadback&   _readback;
+   KernelContext&   _kernel;
+   RequestParser    _parser;
+   int              _nbStreams;
+};
@@ -0,0 +1,312 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "MoleculeCache.h"
+#include "PrimitiveBatch.h"
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char MOLECULE_CACHE_MAGIC[8] = { 'I','M','V','P','D','B','C','2' };
+
+struct MoleculeCacheHeader
+{
+   char         magic[8];
+   unsigned int nbSpheres;
+   unsigned int nbCylinders;
+   unsigned int nbOthers;
+   unsigned int reserved;
+   ULONGLONG    sourceSize;
+   ULONGLONG    sourceTime;
+   float        radius;
+   float        extent;
+};
+
+static bool getSourceInfo( const std::string& sourceFile, ULONGLONG& size, ULONGLONG& time )
+{
+   WIN32_FILE_ATTRIBUTE_DATA data;
+   if( !GetFileAttributesEx( sourceFile.c_str(), GetFileExInfoStandard, &data ) ) return false;
+   size = (static_cast<ULONGLONG>(data.nFileSizeHigh)<<32)|data.nFileSizeLow;
+   time = (static_cast<ULONGLONG>(data.ftLastWriteTime.dwHighDateTime)<<32)|data.ftLastWriteTime.dwLowDateTime;
+   return true;
+}
+
+static bool isValid( const MoleculeCacheHeader& header, const std::string& sourceFile )
+{
+   ULONGLONG sourceSize(0), sourceTime(0);
+   return getSourceInfo( sourceFile, sourceSize, sourceTime ) &&
+      memcmp( header.magic, MOLECULE_CACHE_MAGIC, sizeof(MOLECULE_CACHE_MAGIC) )==0 &&
+      header.sourceSize==sourceSize && header.sourceTime==sourceTime;
+}
+
+// Bound on each count, far above the largest molecules
+const unsigned int MAX_CACHED_PRIMITIVES = 1<<26;
+
+// Types other than spheres and cylinders that a cache may hold
+static const int CACHED_OTHER_TYPES[] = { ptTriangle, ptEllipsoid, ptQuad, ptCheckboard, ptXYPlane, ptYZPlane, ptXZPlane };
+const int NB_CACHED_OTHER_TYPES = sizeof(CACHED_OTHER_TYPES)/sizeof(CACHED_OTHER_TYPES[0]);
+
+static bool isCachedOtherType( const int type )
+{
+   for( int i(0); i<NB_CACHED_OTHER_TYPES; ++i )
+   {
+      if( CACHED_OTHER_TYPES[i]==type ) return true;
+   }
+   return false;
+}
+
+static bool isMaterial( const int material )
+{
+   return material>=0 && material<NB_MAX_MATERIALS;
+}
+
+// Expected size of the file, 0 if a count is out of bounds
+static ULONGLONG getFileSize( const MoleculeCacheHeader& header )
+{
+   if( header.nbSpheres>MAX_CACHED_PRIMITIVES || header.nbCylinders>MAX_CACHED_PRIMITIVES ||
+       header.nbOthers>MAX_CACHED_PRIMITIVES ) return 0;
+   return static_cast<ULONGLONG>(sizeof(MoleculeCacheHeader))+
+      static_cast<ULONGLONG>(header.nbSpheres)*5*sizeof(float)+
+      static_cast<ULONGLONG>(header.nbCylinders)*8*sizeof(float)+
+      static_cast<ULONGLONG>(header.nbOthers)*sizeof(MoleculePrimitive);
+}
+
+std::string MoleculeCache::getFileName( const std::string& moleculeId, const int structureType, const int scheme,
+   const int lod )
+{
+   char suffix[32];
+   if( lod==0 ) sprintf( suffix, ".%d.%d.pdbc", structureType, scheme );
+   else sprintf( suffix, ".%d.%d.lod%d.pdbc", structureType, scheme, lod );
+   return "./Pdb/"+moleculeId+suffix;
+}
+
+bool MoleculeCache::load( GPUKernel& kernel, const std::string& sourceFile, const std::string& cacheFile )
+{
+   HANDLE file = CreateFile( cacheFile.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+   if( file==INVALID_HANDLE_VALUE ) return false;
+   LARGE_INTEGER fileSize;
+   HANDLE mapping = NULL;
+   if( GetFileSizeEx( file, &fileSize ) && fileSize.QuadPart>=static_cast<LONGLONG>(sizeof(MoleculeCacheHeader)) )
+   {
+      mapping = CreateFileMapping( file, NULL, PAGE_READONLY, 0, 0, NULL );
+   }
+   const char* view = mapping ? static_cast<const char*>(MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 )) : nullptr;
+
+   bool loaded(false);
+   if( view )
+   {
+      const MoleculeCacheHeader& header = *reinterpret_cast<const MoleculeCacheHeader*>(view);
+      const ULONGLONG expectedSize = getFileSize( header );
+      if( isValid( header, sourceFile ) && expectedSize!=0 && expectedSize==static_cast<ULONGLONG>(fileSize.QuadPart) )
+      {
+         // Columns straight from the mapped file
+         const unsigned int n = header.nbSpheres;
+         const float* x = reinterpret_cast<const float*>(view+sizeof(MoleculeCacheHeader));
+         const float* y = x+n;
+         const float* z = y+n;
+         const float* radius = z+n;
+         const int* material = reinterpret_cast<const int*>(radius+n);
+
+         const unsigned int m = header.nbCylinders;
+         const float* x0 = reinterpret_cast<const float*>(material+n);
+         const float* y0 = x0+m; const float* z0 = y0+m;
+         const float* x1 = z0+m; const float* y1 = x1+m; const float* z1 = y1+m;
+         const float* bondRadius = z1+m;
+         const int* bondMaterial = reinterpret_cast<const int*>(bondRadius+m);
+
+         const MoleculePrimitive* others = reinterpret_cast<const MoleculePrimitive*>(bondMaterial+m);
+
+         // A damaged cache is discarded before anything reaches the kernel
+         bool valid(true);
+         for( unsigned int i(0); i<n && valid; ++i ) valid = isMaterial( material[i] );
+         for( unsigned int i(0); i<m && valid; ++i ) valid = isMaterial( bondMaterial[i] );
+         for( unsigned int i(0); i<header.nbOthers && valid; ++i )
+         {
+            valid = isCachedOtherType( others[i].type ) && isMaterial( others[i].material );
+         }
+
+         if( valid )
+         {
+            // Handed to the kernel in one batch
+            PrimitiveBatch batch;
+            batch.reserve( n+m+header.nbOthers );
+            for( unsigned int i(0); i<n; ++i )
+            {
+               batch.add( ptSphere, x[i], y[i], z[i], 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, radius[i], 0.f, 0.f, material[i] );
+            }
+            for( unsigned int i(0); i<m; ++i )
+            {
+               batch.add( ptCylinder, x0[i], y0[i], z0[i], x1[i], y1[i], z1[i], 0.f, 0.f, 0.f,
+                  bondRadius[i], 0.f, 0.f, bondMaterial[i] );
+            }
+            for( unsigned int i(0); i<header.nbOthers; ++i )
+            {
+               const float* v = others[i].values;
+               batch.add( static_cast<PrimitiveType>(others[i].type),
+                  v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9], v[10], v[11], others[i].material );
+            }
+            batch.upload( kernel );
+            loaded = true;
+         }
+      }
+      UnmapViewOfFile( view );
+   }
+   if( mapping ) CloseHandle( mapping );
+   CloseHandle( file );
+   return loaded;
+}
+
+bool MoleculeCache::getSize( const std::string& sourceFile, const std::string& cacheFile, float& radius, float& extent )
+{
+   FILE* file = fopen( cacheFile.c_str(), "rb" );
+   if( !file ) return false;
+   MoleculeCacheHeader header;
+   const bool valid = (fread( &header, sizeof(header), 1, file )==1) && isValid( header, sourceFile );
+   fclose( file );
+   if( !valid ) return false;
+   radius = header.radius;
+   extent = header.extent;
+   return true;
+}
+
+void MoleculeCache::read( GPUKernel& kernel, const int first, const int last, MoleculeGeometry& geometry )
+{
+   for( int i(first); i<last; ++i )
+   {
+      const CPUPrimitive& primitive = *kernel.getPrimitive(i);
+      switch( primitive.type )
+      {
+      case ptSphere:
+         geometry.x.push_back( primitive.p0.x );
+         geometry.y.push_back( primitive.p0.y );
+         geometry.z.push_back( primitive.p0.z );
+         geometry.radius.push_back( primitive.size.x );
+         geometry.material.push_back( primitive.materialId );
+         break;
+      case ptCylinder:
+         geometry.x0.push_back( primitive.p0.x );
+         geometry.y0.push_back( primitive.p0.y );
+         geometry.z0.push_back( primitive.p0.z );
+         geometry.x1.push_back( primitive.p1.x );
+         geometry.y1.push_back( primitive.p1.y );
+         geometry.z1.push_back( primitive.p1.z );
+         geometry.bondRadius.push_back( primitive.size.x );
+         geometry.bondMaterial.push_back( primitive.materialId );
+         break;
+      default:
+         {
+            MoleculePrimitive other;
+            other.type     = primitive.type;
+            other.material = primitive.materialId;
+            const Vertex* vertices[4] = { &primitive.p0, &primitive.p1, &primitive.p2, &primitive.size };
+            for( int v(0); v<4; ++v )
+            {
+               other.values[v*3]   = vertices[v]->x;
+               other.values[v*3+1] = vertices[v]->y;
+               other.values[v*3+2] = vertices[v]->z;
+            }
+            geometry.others.push_back( other );
+            break;
+         }
+      }
+   }
+}
+
+template<class T> static bool writeColumn( FILE* file, const std::vector<T>& column )
+{
+   return column.empty() || fwrite( &column[0], sizeof(T), column.size(), file )==column.size();
+}
+
+bool MoleculeCache::save( const MoleculeGeometry& geometry, const std::string& sourceFile, const std::string& cacheFile )
+{
+   MoleculeCacheHeader header;
+   memcpy( header.magic, MOLECULE_CACHE_MAGIC, sizeof(MOLECULE_CACHE_MAGIC) );
+   header.nbSpheres   = static_cast<unsigned int>(geometry.x.size());
+   header.nbCylinders = static_cast<unsigned int>(geometry.x0.size());
+   header.nbOthers    = static_cast<unsigned int>(geometry.others.size());
+   header.reserved    = 0;
+   if( !getSourceInfo( sourceFile, header.sourceSize, header.sourceTime ) || getFileSize( header )==0 ) return false;
+
+   // Primitives that load would reject are not cached at all
+   for( size_t i(0); i<geometry.material.size(); ++i )
+   {
+      if( !isMaterial( geometry.material[i] ) ) return false;
+   }
+   for( size_t i(0); i<geometry.bondMaterial.size(); ++i )
+   {
+      if( !isMaterial( geometry.bondMaterial[i] ) ) return false;
+   }
+   for( size_t i(0); i<geometry.others.size(); ++i )
+   {
+      if( !isCachedOtherType( geometry.others[i].type ) || !isMaterial( geometry.others[i].material ) ) return false;
+   }
+
+   // Mean atom radius and bounding box of the atoms
+   header.radius = 0.f;
+   header.extent = 0.f;
+   if( header.nbSpheres!=0 )
+   {
+      float minimum[3] = { geometry.x[0], geometry.y[0], geometry.z[0] };
+      float maximum[3] = { geometry.x[0], geometry.y[0], geometry.z[0] };
+      double radius(0.0);
+      for( unsigned int i(0); i<header.nbSpheres; ++i )
+      {
+         const float p[3] = { geometry.x[i], geometry.y[i], geometry.z[i] };
+         for( int a(0); a<3; ++a )
+         {
+            if( p[a]<minimum[a] ) minimum[a] = p[a];
+            if( p[a]>maximum[a] ) maximum[a] = p[a];
+         }
+         radius += geometry.radius[i];
+      }
+      header.radius = static_cast<float>(radius/header.nbSpheres);
+      for( int a(0); a<3; ++a )
+      {
+         if( maximum[a]-minimum[a]>header.extent ) header.extent = maximum[a]-minimum[a];
+      }
+   }
+
+   // Written aside and renamed, a reader never maps half a file
+   const std::string temporary = cacheFile+".tmp";
+   FILE* file = fopen( temporary.c_str(), "wb" );
+   if( !file ) return false;
+   bool written =
+      fwrite( &header, sizeof(header), 1, file )==1 &&
+      writeColumn( file, geometry.x ) && writeColumn( file, geometry.y ) && writeColumn( file, geometry.z ) &&
+      writeColumn( file, geometry.radius ) && writeColumn( file, geometry.material ) &&
+      writeColumn( file, geometry.x0 ) && writeColumn( file, geometry.y0 ) && writeColumn( file, geometry.z0 ) &&
+      writeColumn( file, geometry.x1 ) && writeColumn( file, geometry.y1 ) && writeColumn( file, geometry.z1 ) &&
+      writeColumn( file, geometry.bondRadius ) && writeColumn( file, geometry.bondMaterial ) &&
+      writeColumn( file, geometry.others );
+   if( fclose( file )!=0 ) written = false;
+   if( !written || !MoveFileEx( temporary.c_str(), cacheFile.c_str(), MOVEFILE_REPLACE_EXISTING ) )
+   {
+      DeleteFile( temporary.c_str() );
+      return false;
+   }
+   return true;
+}
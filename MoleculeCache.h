@@ -0,0 +1,93 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <GPUKernel.h>
+
+// Primitive other than an atom or a bond
+struct MoleculePrimitive
+{
+   int   type;
+   int   material;
+   float values[12]; // p0, p1, p2, size
+};
+
+// Primitives of a molecule, in columns
+struct MoleculeGeometry
+{
+   // Atoms (spheres)
+   std::vector<float> x, y, z, radius;
+   std::vector<int>   material;
+
+   // Bonds (cylinders)
+   std::vector<float> x0, y0, z0, x1, y1, z1, bondRadius;
+   std::vector<int>   bondMaterial;
+
+   std::vector<MoleculePrimitive> others;
+};
+
+/*
+________________________________________________________________________________
+
+Molecule cache
+
+The primitives PDBReader makes out of a .pdb file depend on the molecule, its
+structure and its scheme only. They are saved after the first parse into a
+binary file next to the .pdb, and later loads map that file instead of
+parsing the text again:
+
+   header     "IMVPDBC2", counts, size and time of the .pdb it was made from,
+              mean atom radius and extent of the molecule
+   spheres    x[n], y[n], z[n], radius[n] (floats), material[n] (ints)
+   cylinders  x0[n], y0[n], z0[n], x1[n], y1[n], z1[n], radius[n], material[n]
+   others     n times type, material, then p0, p1, p2 and size (12 floats)
+
+Spheres are the atoms and cylinders the bonds, as computed by the reader.
+Coarser levels of detail of the molecule are cached the same way. A cache is
+ignored, and written again, when its .pdb changed.
+________________________________________________________________________________
+*/
+class MoleculeCache
+{
+public:
+   // Cache of a molecule in a structure, a scheme and a level of detail
+   static std::string getFileName( const std::string& moleculeId, const int structureType, const int scheme,
+      const int lod = 0 );
+
+   // Adds the cached primitives to the kernel. False if there is no valid
+   // cache for the source file.
+   static bool load( GPUKernel& kernel, const std::string& sourceFile, const std::string& cacheFile );
+
+   // Mean atom radius and largest side of the bounding box of a valid cache
+   static bool getSize( const std::string& sourceFile, const std::string& cacheFile, float& radius, float& extent );
+
+   // Reads back the kernel primitives [first, last)
+   static void read( GPUKernel& kernel, const int first, const int last, MoleculeGeometry& geometry );
+
+   // Saves primitives read from the source file
+   static bool save( const MoleculeGeometry& geometry, const std::string& sourceFile, const std::string& cacheFile );
+};
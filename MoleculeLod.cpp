@@ -0,0 +1,184 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#include "MoleculeLod.h"
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+// Atoms per sphere of each level
+static const int LOD_ATOMS_PER_SPHERE[NB_LOD_LEVELS] = { 1, 8, 64 };
+
+// Projected atom radius, in pixels, under which a level is used
+static const float LOD_ATOM_PIXELS[NB_LOD_LEVELS] = { 0.f, 4.f, 1.5f };
+
+// Previews use coarse levels with atoms that much larger
+const float LOD_PREVIEW_FACTOR = 2.f;
+
+// Grid refinements to get the wanted number of atoms per cell
+const int LOD_GRID_PASSES = 3;
+
+typedef std::pair<unsigned long long, int> LodCell; // Cell key, atom
+
+static void assignCells( const MoleculeGeometry& atoms, const float origin[3], const float cellSize,
+   std::vector<LodCell>& cells )
+{
+   const size_t n = atoms.x.size();
+   cells.resize( n );
+   for( size_t i(0); i<n; ++i )
+   {
+      const unsigned long long cx = static_cast<unsigned long long>((atoms.x[i]-origin[0])/cellSize);
+      const unsigned long long cy = static_cast<unsigned long long>((atoms.y[i]-origin[1])/cellSize);
+      const unsigned long long cz = static_cast<unsigned long long>((atoms.z[i]-origin[2])/cellSize);
+      cells[i].first  = (cx<<42)|(cy<<21)|cz;
+      cells[i].second = static_cast<int>(i);
+   }
+   std::sort( cells.begin(), cells.end() );
+}
+
+static size_t countCells( const std::vector<LodCell>& cells )
+{
+   size_t count(cells.empty() ? 0 : 1);
+   for( size_t i(1); i<cells.size(); ++i )
+   {
+      if( cells[i].first!=cells[i-1].first ) ++count;
+   }
+   return count;
+}
+
+void MoleculeLod::build( const MoleculeGeometry& atoms, const int level, MoleculeGeometry& coarse )
+{
+   coarse = MoleculeGeometry();
+   coarse.others = atoms.others;
+   const size_t n = atoms.x.size();
+   if( n==0 ) return;
+
+   float origin[3] = { atoms.x[0], atoms.y[0], atoms.z[0] };
+   float extent(0.f);
+   double meanRadius(0.0);
+   {
+      float maximum[3] = { atoms.x[0], atoms.y[0], atoms.z[0] };
+      for( size_t i(0); i<n; ++i )
+      {
+         const float p[3] = { atoms.x[i], atoms.y[i], atoms.z[i] };
+         for( int a(0); a<3; ++a )
+         {
+            if( p[a]<origin[a] ) origin[a] = p[a];
+            if( p[a]>maximum[a] ) maximum[a] = p[a];
+         }
+         meanRadius += atoms.radius[i];
+      }
+      meanRadius /= n;
+      for( int a(0); a<3; ++a ) extent = std::max( extent, maximum[a]-origin[a] );
+   }
+
+   // Cells start as large as the atoms they hold, then are resized from the
+   // number of atoms they actually got. Grid coordinates keep to 21 bits.
+   const float target = static_cast<float>(LOD_ATOMS_PER_SPHERE[level]);
+   const float minimumCell = extent/1048576.f;
+   float cellSize = std::max( static_cast<float>(2.0*meanRadius*pow( target, 1.f/3.f )), minimumCell );
+   if( cellSize<=0.f ) cellSize = 1.f;
+   std::vector<LodCell> cells;
+   for( int pass(0); pass<LOD_GRID_PASSES; ++pass )
+   {
+      assignCells( atoms, origin, cellSize, cells );
+      const float perCell = static_cast<float>(n)/countCells( cells );
+      const float scale = pow( target/perCell, 1.f/3.f );
+      if( pass+1==LOD_GRID_PASSES || fabs( scale-1.f )<0.05f ) break;
+      cellSize = std::max( cellSize*std::min( std::max( scale, 0.5f ), 2.f ), minimumCell );
+   }
+
+   // A sphere per cell
+   std::vector< std::pair<int,int> > materials; // Material, atoms
+   size_t begin(0);
+   while( begin<n )
+   {
+      size_t end(begin+1);
+      while( end<n && cells[end].first==cells[begin].first ) ++end;
+
+      double center[3] = { 0.0, 0.0, 0.0 };
+      double radius(0.0);
+      materials.clear();
+      for( size_t i(begin); i<end; ++i )
+      {
+         const int atom = cells[i].second;
+         center[0] += atoms.x[atom];
+         center[1] += atoms.y[atom];
+         center[2] += atoms.z[atom];
+         radius += atoms.radius[atom];
+         size_t m(0);
+         while( m<materials.size() && materials[m].first!=atoms.material[atom] ) ++m;
+         if( m==materials.size() ) materials.push_back( std::make_pair( atoms.material[atom], 0 ) );
+         materials[m].second++;
+      }
+      const double count = static_cast<double>(end-begin);
+      for( int a(0); a<3; ++a ) center[a] /= count;
+      radius /= count;
+
+      double gyration(0.0);
+      for( size_t i(begin); i<end; ++i )
+      {
+         const int atom = cells[i].second;
+         const double dx = atoms.x[atom]-center[0];
+         const double dy = atoms.y[atom]-center[1];
+         const double dz = atoms.z[atom]-center[2];
+         gyration += dx*dx+dy*dy+dz*dz;
+      }
+      size_t common(0);
+      for( size_t m(1); m<materials.size(); ++m )
+      {
+         if( materials[m].second>materials[common].second ) common = m;
+      }
+
+      coarse.x.push_back( static_cast<float>(center[0]) );
+      coarse.y.push_back( static_cast<float>(center[1]) );
+      coarse.z.push_back( static_cast<float>(center[2]) );
+      coarse.radius.push_back( static_cast<float>(sqrt( gyration/count )+radius) );
+      coarse.material.push_back( materials[common].first );
+      begin = end;
+   }
+}
+
+int MoleculeLod::select( const std::string& sourceFile, const std::string& moleculeId, const int structureType, const int scheme,
+   const int width, const int height, const bool preview )
+{
+   float radius(0.f), extent(0.f);
+   const std::string fileName = MoleculeCache::getFileName( moleculeId, structureType, scheme, lodAtoms );
+   if( !MoleculeCache::getSize( sourceFile, fileName, radius, extent ) || extent<=0.f ) return lodAtoms;
+
+   // Atom radius on the image, the molecule being about as wide as the image
+   const float pixels = radius*std::min( width, height )/extent;
+   const float factor = preview ? LOD_PREVIEW_FACTOR : 1.f;
+   int lod(lodAtoms);
+   for( int level(lodAtoms+1); level<NB_LOD_LEVELS; ++level )
+   {
+      if( pixels>=LOD_ATOM_PIXELS[level]*factor ) break;
+      float levelRadius(0.f), levelExtent(0.f);
+      const std::string levelFileName = MoleculeCache::getFileName( moleculeId, structureType, scheme, level );
+      if( !MoleculeCache::getSize( sourceFile, levelFileName, levelRadius, levelExtent ) ) break;
+      lod = level;
+   }
+   return lod;
+}
@@ -0,0 +1,70 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+#include <string>
+
+#include "MoleculeCache.h"
+
+// Levels of detail of a molecule, from the finest
+enum MoleculeLodLevel
+{
+   lodAtoms    = 0, // Every atom and bond made by PDBReader
+   lodResidues = 1, // A sphere for about 8 atoms, the size of a residue
+   lodSegments = 2, // A sphere for about 64 atoms
+   NB_LOD_LEVELS
+};
+
+/*
+________________________________________________________________________________
+
+Molecule levels of detail
+
+A large molecule rendered in a small image puts several atoms in each pixel,
+and costs as much to set up and trace as in a large one. Coarser versions of
+the molecule are built from its atoms when it is first parsed, and cached
+next to it:
+
+   atoms      are grouped by the cells of a grid, sized for the wanted number
+              of atoms per cell
+   a group    becomes a sphere at its centroid, as large as its radius of
+              gyration plus the mean atom radius, in its most common material
+   bonds      are dropped, they are thinner than atoms
+
+The level is picked from the size of an atom once projected on the image: a
+molecule as wide as the image whose atoms cover a few pixels is rendered with
+residue spheres, one whose atoms are about a pixel with segment spheres.
+Previews, such as live streams, accept coarser levels.
+________________________________________________________________________________
+*/
+class MoleculeLod
+{
+public:
+   // Groups the atoms of the molecule for a coarse level
+   static void build( const MoleculeGeometry& atoms, const int level, MoleculeGeometry& coarse );
+
+   // Coarsest cached level for an image of the given size
+   static int select( const std::string& sourceFile, const std::string& moleculeId, const int structureType, const int scheme,
+      const int width, const int height, const bool preview );
+};
@@ -0,0 +1,147 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#include "NumberParser.h"
+
+#include <math.h>
+
+// Exactly representable powers of ten
+static const double gPowersOf10[] = {
+   1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+// Significant digits that fit in the 64 bit mantissa
+const int MAX_MANTISSA_DIGITS = 19;
+
+inline bool isDigit( const char c )
+{
+   return c>='0' && c<='9';
+}
+
+const char* parseFloat( const char* first, const char* last, float& value )
+{
+   const char* p = first;
+   bool negative(false);
+   if( p<last && (*p=='-' || *p=='+') )
+   {
+      negative = (*p=='-');
+      ++p;
+   }
+
+   unsigned long long mantissa(0);
+   int  digits(0);
+   int  exponent(0);
+   bool hasDigits(false);
+
+   // Integer part. Digits beyond what the mantissa can hold only scale it.
+   while( p<last && isDigit(*p) )
+   {
+      if( digits<MAX_MANTISSA_DIGITS )
+      {
+         mantissa = mantissa*10+(*p-'0');
+         if( mantissa!=0 ) ++digits;
+      }
+      else
+      {
+         ++exponent;
+      }
+      hasDigits = true;
+      ++p;
+   }
+
+   // Fractional part
+   if( p<last && *p=='.' )
+   {
+      ++p;
+      while( p<last && isDigit(*p) )
+      {
+         if( digits<MAX_MANTISSA_DIGITS )
+         {
+            mantissa = mantissa*10+(*p-'0');
+            if( mantissa!=0 ) ++digits;
+            --exponent;
+         }
+         hasDigits = true;
+         ++p;
+      }
+   }
+   if( !hasDigits ) return first;
+
+   // Exponent, only consumed if at least one digit follows
+   if( p<last && (*p=='e' || *p=='E') )
+   {
+      const char* e = p+1;
+      bool negativeExponent(false);
+      if( e<last && (*e=='-' || *e=='+') )
+      {
+         negativeExponent = (*e=='-');
+         ++e;
+      }
+      if( e<last && isDigit(*e) )
+      {
+         int n(0);
+         while( e<last && isDigit(*e) )
+         {
+            if( n<10000 ) n = n*10+(*e-'0');
+            ++e;
+         }
+         exponent += negativeExponent ? -n : n;
+         p = e;
+      }
+   }
+
+   double result = static_cast<double>(mantissa);
+   if( mantissa!=0 && exponent!=0 )
+   {
+      const int n = (exponent<0) ? -exponent : exponent;
+      const double scale = (n<=22) ? gPowersOf10[n] : pow(10.0,n);
+      result = (exponent<0) ? result/scale : result*scale;
+   }
+   // Out of range, same as from_chars
+   const float number = static_cast<float>(negative ? -result : result);
+   if( !isFinite( number ) ) return first;
+   value = number;
+   return p;
+}
+
+const char* parseInt( const char* first, const char* last, int& value )
+{
+   const char* p = first;
+   bool negative(false);
+   if( p<last && (*p=='-' || *p=='+') )
+   {
+      negative = (*p=='-');
+      ++p;
+   }
+   if( p==last || !isDigit(*p) ) return first;
+
+   long long result(0);
+   while( p<last && isDigit(*p) )
+   {
+      if( result<=0x7FFFFFFF ) result = result*10+(*p-'0');
+      ++p;
+   }
+   if( result>0x7FFFFFFF ) result = 0x7FFFFFFF;
+   value = static_cast<int>(negative ? -result : result);
+   return p;
+}
@@ -0,0 +1,48 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+/*
+________________________________________________________________________________
+
+Number parsing
+
+Reads numbers straight out of a character range, without copying, allocating
+or depending on the locale. Same contract as std::from_chars, which is not
+available with this compiler: the returned pointer is the first character
+that is not part of the number, and equals first when nothing could be read.
+Numbers too large for a float are not read, so values are always finite.
+________________________________________________________________________________
+*/
+
+#include <float.h>
+
+const char* parseFloat( const char* first, const char* last, float& value );
+const char* parseInt( const char* first, const char* last, int& value );
+
+// False for infinities and NaN
+inline bool isFinite( const float value )
+{
+   return value>=-FLT_MAX && value<=FLT_MAX;
+}
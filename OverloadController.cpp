@@ -0,0 +1,142 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "OverloadController.h"
+#include "NumberParser.h"
+#include "AsyncLog.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+// Degraded settings
+const int DEGRADED_ITERATIONS = 4;
+const unsigned int DEGRADED_SIZE = 512;
+
+OverloadController::OverloadController( const RenderScheduler& scheduler )
+ : _scheduler(scheduler)
+{
+   _thresholds[olNone]           = 0;
+   _thresholds[olQuality]        = 1000;
+   _thresholds[olSize]           = 2500;
+   _thresholds[olPostProcessing] = 5000;
+   _thresholds[olReject]         = 10000;
+   memset( _nbRequests, 0, sizeof(_nbRequests) );
+}
+
+bool OverloadController::configure( const char* thresholds )
+{
+   DWORD values[NB_OVERLOAD_LEVELS] = {0};
+   const char* first = thresholds;
+   const char* last = thresholds+strlen(thresholds);
+   for( int level(olQuality); level<NB_OVERLOAD_LEVELS; ++level )
+   {
+      int value(0);
+      const char* next = parseInt( first, last, value );
+      if( next==first || value<0 || static_cast<DWORD>(value)<values[level-1] ) return false;
+      values[level] = static_cast<DWORD>(value);
+      first = next;
+      if( level<olReject )
+      {
+         if( first==last || *first!=',' ) return false;
+         ++first;
+      }
+   }
+   if( first!=last ) return false;
+   memcpy( _thresholds, values, sizeof(_thresholds) );
+   return true;
+}
+
+DWORD OverloadController::getEstimatedWait() const
+{
+   // Every job in front takes about as long as the last frames did
+   const DWORD jobs = _scheduler.getQueueLength()+(_scheduler.isBusy() ? 1 : 0);
+   return jobs*_scheduler.getAverageRenderTime();
+}
+
+OverloadController::Level OverloadController::getLevel() const
+{
+   const DWORD wait = getEstimatedWait();
+   int level(olNone);
+   while( level<olReject && wait>=_thresholds[level+1] ) ++level;
+   return static_cast<Level>(level);
+}
+
+int OverloadController::getRetryAfter() const
+{
+   // Time for the queue to drain below the rejection threshold
+   const DWORD wait = getEstimatedWait();
+   const DWORD excess = (wait>_thresholds[olReject]) ? wait-_thresholds[olReject] : 0;
+   const int seconds = static_cast<int>((excess+999)/1000);
+   return (seconds<1) ? 1 : seconds;
+}
+
+void OverloadController::degrade( RenderContext& ctx, SceneInfo& sceneInfo, PostProcessingInfo& postProcessingInfo )
+{
+   const Level level = getLevel();
+   _nbRequests[level]++;
+   if( level==olNone ) return;
+
+   std::string degraded;
+   if( level>=olQuality && sceneInfo.maxPathTracingIterations.x>DEGRADED_ITERATIONS )
+   {
+      sceneInfo.maxPathTracingIterations.x = DEGRADED_ITERATIONS;
+      degraded += "quality";
+   }
+   if( level>=olSize && (ctx.width>DEGRADED_SIZE || ctx.height>DEGRADED_SIZE) )
+   {
+      ctx.width  = DEGRADED_SIZE;
+      ctx.height = DEGRADED_SIZE;
+      sceneInfo.size.x = ctx.width;
+      sceneInfo.size.y = ctx.height;
+      if( !degraded.empty() ) degraded += ',';
+      degraded += "size";
+   }
+   if( level>=olPostProcessing && postProcessingInfo.type.x!=ppe_none )
+   {
+      postProcessingInfo.type.x = ppe_none;
+      if( !degraded.empty() ) degraded += ',';
+      degraded += "postprocessing";
+   }
+   if( !degraded.empty() )
+   {
+      LOG_INFO(1, "Overload level " << level << ", degraded " << degraded );
+      if( ctx.request ) ctx.request->AddHeader( "X-Degraded", degraded.c_str() );
+   }
+}
+
+void OverloadController::reject( Lacewing::Webserver::Request& request )
+{
+   _nbRequests[olReject]++;
+   char retryAfter[16];
+   sprintf( retryAfter, "%d", getRetryAfter() );
+   LOG_INFO(1, "Overloaded, rejecting " << request.URL() << " for " << retryAfter << " seconds" );
+   request.Status( 503, "Service Unavailable" );
+   request.AddHeader( "Retry-After", retryAfter );
+   request.AddHeader( "Access-Control-Allow-Origin", "*" );
+   request << "Server overloaded, please try again later";
+   request.Finish();
+}
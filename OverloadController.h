@@ -0,0 +1,94 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#pragma once
+
+#include <windows.h>
+
+#include <GPUKernel.h>
+
+#include "RenderContext.h"
+#include "RenderScheduler.h"
+
+/*
+________________________________________________________________________________
+
+Overload controller
+
+Estimates how long a new request would wait for the kernel, from the depth of
+the render queue and the time taken by the last frames. When that wait goes
+over the thresholds of the ladder, requests are stepped down:
+
+   1. fewer path tracing iterations
+   2. the smallest size preset
+   3. no post processing
+   4. rejected with 503 and Retry-After
+
+Each level includes the ones below it. Degraded requests are flagged with an
+X-Degraded header listing what was taken off.
+________________________________________________________________________________
+*/
+class OverloadController
+{
+public:
+   enum Level
+   {
+      olNone           = 0,
+      olQuality        = 1,
+      olSize           = 2,
+      olPostProcessing = 3,
+      olReject         = 4,
+      NB_OVERLOAD_LEVELS
+   };
+
+public:
+   OverloadController( const RenderScheduler& scheduler );
+
+   // Estimated waits, in milliseconds, at which levels 1 to 4 kick in,
+   // separated by commas (e.g. "1000,2500,5000,10000")
+   bool configure( const char* thresholds );
+
+   Level getLevel() const;
+
+   // Time before a request submitted now would get the kernel
+   DWORD getEstimatedWait() const;
+
+   // Seconds a rejected client is asked to wait before trying again
+   int getRetryAfter() const;
+
+   // Steps a parsed request down the ladder. Called once per request, after
+   // its view parameters are known.
+   void degrade( RenderContext& ctx, SceneInfo& sceneInfo, PostProcessingInfo& postProcessingInfo );
+
+   // Answers a request that cannot be served at the current level
+   void reject( Lacewing::Webserver::Request& request );
+
+   // Requests served at each level, rejected ones included
+   int getNbRequests( const int level ) const { return _nbRequests[level]; }
+
+private:
+   const RenderScheduler& _scheduler;
+   DWORD _thresholds[NB_OVERLOAD_LEVELS]; // First one unused
+   int   _nbRequests[NB_OVERLOAD_LEVELS];
+};
@@ -0,0 +1,268 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "QueryParser.h"
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+/*
+________________________________________________________________________________
+
+Query parser micro benchmark
+
+Runs the query parser over a corpus of captured query strings, one per line
+(the part after "get?"), and compares it to the previous approach: a copy of
+each name and value, a chain of strcmp per parameter and atoi/atof on
+strings built one character at a time. Both have to produce the same
+parameters for every request of the corpus before they are timed.
+
+Usage: IMVWebServer --bench-parser Benchmarks/requests.txt
+________________________________________________________________________________
+*/
+
+// Same order as RequestParameter
+static const char* gReferenceNames[NB_REQUEST_PARAMETERS] = {
+   "molecule", "model", "type", "values", "stream", "window", "append", "close", "distance",
+   "rotation", "bkcolor", "quality", "size", "postprocessing", "structure", "scheme",
+   "poses", "turntable", "fps" };
+
+static Vertex referenceVertex( const std::string& value )
+{
+   float components[3] = { 0.f, 0.f, 0.f };
+   int nbComponents(0);
+   std::string element;
+   for( size_t j(0); j<=value.length() && nbComponents<3; ++j )
+   {
+      if( j==value.length() || value[j]==',' )
+      {
+         components[nbComponents++] = static_cast<float>(atof(element.c_str()));
+         element = "";
+      }
+      else
+      {
+         element += value[j];
+      }
+   }
+   Vertex result = { components[0], components[1], components[2] };
+   return result;
+}
+
+// Values used to be decoded by the web server
+static std::string referenceDecode( const std::string& value )
+{
+   std::string result;
+   for( size_t j(0); j<value.length(); ++j )
+   {
+      if( value[j]=='+' )
+      {
+         result += ' ';
+      }
+      else if( value[j]=='%' && j+2<value.length() && isxdigit(static_cast<unsigned char>(value[j+1])) && isxdigit(static_cast<unsigned char>(value[j+2])) )
+      {
+         result += static_cast<char>(strtol( value.substr(j+1,2).c_str(), NULL, 16 ));
+         j += 2;
+      }
+      else
+      {
+         result += value[j];
+      }
+   }
+   return result;
+}
+
+// Text values are kept in storage, which is large enough not to move
+static StringRef referenceText( std::string& storage, const std::string& value )
+{
+   StringRef result;
+   result.data   = storage.data()+storage.length();
+   result.length = value.length();
+   storage += value;
+   return result;
+}
+
+// What parseChart/parsePDB/parseIRT used to do for each parameter
+static void referenceParse( const std::string& query, RequestParams& params, std::string& storage )
+{
+   params.clear();
+   storage.clear();
+   storage.reserve( query.length() );
+   size_t p(0);
+   while( p<query.length() )
+   {
+      size_t end = query.find( '&', p );
+      if( end==std::string::npos ) end = query.length();
+      size_t equal = query.find( '=', p );
+      if( equal==std::string::npos || equal>end ) equal = end;
+      std::string name( query, p, equal-p );
+      std::string value( query, (equal<end) ? equal+1 : end, (equal<end) ? end-equal-1 : 0 );
+      p = end+1;
+      if( name.empty() ) continue;
+
+      int parameter(rpUnknown);
+      for( int i(0); i<NB_REQUEST_PARAMETERS; ++i )
+      {
+         if( strcmp( name.c_str(), gReferenceNames[i] )==0 )
+         {
+            parameter = i;
+            break;
+         }
+      }
+      if( params.count++==0 ) params.first = static_cast<RequestParameter>(parameter);
+      if( parameter==rpUnknown ) continue;
+      params.present |= (1u<<parameter);
+
+      value = referenceDecode( value );
+      switch( parameter )
+      {
+      case rpMolecule:       params.molecule = referenceText( storage, value ); break;
+      case rpModel:          params.model = referenceText( storage, value ); break;
+      case rpValues:         params.values = referenceText( storage, value ); break;
+      case rpStream:         params.stream = referenceText( storage, value ); break;
+      case rpAppend:         params.append = referenceText( storage, value ); break;
+      case rpType:           params.type = atoi(value.c_str()); break;
+      case rpWindow:         params.window = atoi(value.c_str()); break;
+      case rpClose:          params.close = atoi(value.c_str()); break;
+      case rpDistance:       params.distance = static_cast<float>(atof(value.c_str())); break;
+      case rpRotation:       params.rotation = referenceVertex(value); break;
+      case rpBkColor:        params.bkColor = referenceVertex(value); break;
+      case rpQuality:        params.quality = atoi(value.c_str()); break;
+      case rpSize:           params.size = atoi(value.c_str()); break;
+      case rpPostProcessing: params.postProcessing = atoi(value.c_str()); break;
+      case rpStructure:      params.structure = atoi(value.c_str()); break;
+      case rpScheme:         params.scheme = atoi(value.c_str()); break;
+      case rpPoses:          params.poses = referenceText( storage, value ); break;
+      case rpTurntable:      params.turntable = atoi(value.c_str()); break;
+      case rpFps:            params.fps = atoi(value.c_str()); break;
+      default: break;
+      }
+   }
+}
+
+static bool sameText( const StringRef& a, const StringRef& b )
+{
+   return a.length==b.length && memcmp( a.data, b.data, a.length )==0;
+}
+
+static bool sameVertex( const Vertex& a, const Vertex& b )
+{
+   return a.x==b.x && a.y==b.y && a.z==b.z;
+}
+
+static bool sameParams( const RequestParams& a, const RequestParams& b )
+{
+   return a.present==b.present && a.count==b.count && a.first==b.first &&
+      sameText( a.molecule, b.molecule ) && sameText( a.model, b.model ) &&
+      sameText( a.values, b.values ) && sameText( a.stream, b.stream ) &&
+      sameText( a.append, b.append ) && sameText( a.poses, b.poses ) &&
+      a.type==b.type && a.window==b.window && a.close==b.close && a.distance==b.distance &&
+      sameVertex( a.rotation, b.rotation ) && sameVertex( a.bkColor, b.bkColor ) &&
+      a.quality==b.quality && a.size==b.size && a.postProcessing==b.postProcessing &&
+      a.structure==b.structure && a.scheme==b.scheme && a.turntable==b.turntable && a.fps==b.fps;
+}
+
+static int checksum( const RequestParams& params )
+{
+   return params.present + params.quality + static_cast<int>(params.distance);
+}
+
+int runParserBenchmark( const char* corpusFile )
+{
+   std::vector<std::string> corpus;
+   std::ifstream file( corpusFile );
+   std::string line;
+   size_t longest(0);
+   while( std::getline( file, line ) )
+   {
+      if( !line.empty() && line[line.length()-1]=='\r' ) line.erase( line.length()-1 );
+      if( line.empty() ) continue;
+      corpus.push_back( line );
+      longest = (line.length()>longest) ? line.length() : longest;
+   }
+   if( corpus.empty() )
+   {
+      std::cout << "No request found in " << corpusFile << std::endl;
+      return 1;
+   }
+
+   std::vector<char> scratch( longest+1 );
+   RequestParams reference;
+   RequestParams params;
+   std::string storage;
+
+   // Timings only mean something if both give the same result
+   for( size_t i(0); i<corpus.size(); ++i )
+   {
+      referenceParse( corpus[i], reference, storage );
+      QueryParser::parse( corpus[i].c_str(), corpus[i].c_str()+corpus[i].length(), params, &scratch[0] );
+      if( !sameParams( reference, params ) )
+      {
+         std::cout << "Parsers disagree on " << corpus[i] << std::endl;
+         return 1;
+      }
+   }
+
+   LARGE_INTEGER frequency;
+   QueryPerformanceFrequency( &frequency );
+
+   const int NB_ROUNDS = 20000;
+   int total(0);
+   double timings[2];
+   for( int method(0); method<2; ++method )
+   {
+      LARGE_INTEGER start, stop;
+      QueryPerformanceCounter( &start );
+      for( int round(0); round<NB_ROUNDS; ++round )
+      {
+         for( size_t i(0); i<corpus.size(); ++i )
+         {
+            if( method==0 )
+            {
+               referenceParse( corpus[i], reference, storage );
+               total += checksum( reference );
+            }
+            else
+            {
+               QueryParser::parse( corpus[i].c_str(), corpus[i].c_str()+corpus[i].length(), params, &scratch[0] );
+               total += checksum( params );
+            }
+         }
+      }
+      QueryPerformanceCounter( &stop );
+      timings[method] = static_cast<double>(stop.QuadPart-start.QuadPart)*1e9/frequency.QuadPart/(NB_ROUNDS*corpus.size());
+   }
+
+   std::cout << corpus.size() << " requests, " << NB_ROUNDS << " rounds (checksum " << total << ")" << std::endl;
+   std::cout << "strcmp chain : " << timings[0] << " ns/request" << std::endl;
+   std::cout << "query parser : " << timings[1] << " ns/request" << std::endl;
+   return 0;
+}
@@ -0,0 +1,222 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "PdbFetcher.h"
+#include "PdbStore.h"
+#include "RenderContext.h"
+#include "Metrics.h"
+#include "AsyncLog.h"
+
+#include <stdio.h>
+
+// Downloads running at once
+const int NB_FETCH_THREADS = 4;
+
+const DWORD FETCH_CHUNK_SIZE = 64*1024;
+
+PdbFetcher::PdbFetcher( Lacewing::Pump& pump, Completion completion )
+ : _pump(pump), _completion(completion), _mirror("http://www.rcsb.org/pdb/files/"), _compress(false), _running(true),
+   _nbDownloads(0), _nbJoined(0), _nbFailed(0)
+{
+   _internet = InternetOpen( "IMVWebServer", LOCAL_INTERNET_ACCESS, NULL, NULL, 0 );
+   InitializeCriticalSection( &_lock );
+   _ready = CreateSemaphore( NULL, 0, 0x7fffffff, NULL );
+   for( int i(0); i<NB_FETCH_THREADS; ++i )
+   {
+      _threads.push_back( CreateThread( NULL, 0, fetchThread, this, 0, NULL ) );
+   }
+}
+
+PdbFetcher::~PdbFetcher()
+{
+   _running = false;
+   ReleaseSemaphore( _ready, static_cast<LONG>(_threads.size()), NULL );
+   for( size_t i(0); i<_threads.size(); ++i )
+   {
+      WaitForSingleObject( _threads[i], INFINITE );
+      CloseHandle( _threads[i] );
+   }
+   CloseHandle( _ready );
+   DeleteCriticalSection( &_lock );
+   InternetCloseHandle( _internet );
+}
+
+std::string PdbFetcher::getFileName( const std::string& moleculeId )
+{
+   return "./Pdb/"+moleculeId+".pdb";
+}
+
+bool PdbFetcher::request( const std::string& moleculeId, RenderContext* ctx )
+{
+   // Each get counts once, live streams and sessions ask on every frame
+   const bool found = !PdbStore::find( moleculeId ).empty();
+   if( ctx ) Metrics::getInstance().countCache( mcPdb, found );
+   if( found ) return true;
+
+   std::map<std::string, Download*>::iterator it = _downloads.find( moleculeId );
+   if( it != _downloads.end() )
+   {
+      if( ctx )
+      {
+         it->second->waiting.push_back( ctx );
+         _nbJoined++;
+      }
+      return false;
+   }
+
+   Download* download = new Download;
+   download->owner      = this;
+   download->moleculeId = moleculeId;
+   download->found      = false;
+   if( ctx ) download->waiting.push_back( ctx );
+   _downloads[moleculeId] = download;
+   _nbDownloads++;
+
+   EnterCriticalSection( &_lock );
+   _queue.push_back( download );
+   LeaveCriticalSection( &_lock );
+   ReleaseSemaphore( _ready, 1, NULL );
+   return false;
+}
+
+void PdbFetcher::onDisconnect( Lacewing::Webserver::Request& request )
+{
+   std::map<std::string, Download*>::iterator it;
+   for( it=_downloads.begin(); it!=_downloads.end(); ++it )
+   {
+      std::vector<RenderContext*>& waiting = it->second->waiting;
+      for( size_t i(0); i<waiting.size(); ++i )
+      {
+         if( waiting[i]->request==&request )
+         {
+            delete waiting[i];
+            waiting.erase( waiting.begin()+i );
+            return;
+         }
+      }
+   }
+}
+
+bool PdbFetcher::download( const Download& download )
+{
+   StageTimer timer( msFetch );
+
+   // The identifier ends up in a path and a URL
+   const std::string& id = download.moleculeId;
+   if( !PdbStore::isValidId( id ) ) return false;
+
+   const std::string url = _mirror+id+".pdb";
+   HINTERNET handle = InternetOpenUrl( _internet, url.c_str(), NULL, 0, INTERNET_FLAG_RELOAD|INTERNET_FLAG_NO_CACHE_WRITE, 0 );
+   if( !handle ) return false;
+
+   // Error pages are not molecules
+   DWORD status(0);
+   DWORD size(sizeof(status));
+   HttpQueryInfo( handle, HTTP_QUERY_STATUS_CODE|HTTP_QUERY_FLAG_NUMBER, &status, &size, NULL );
+   if( status!=200 )
+   {
+      InternetCloseHandle( handle );
+      return false;
+   }
+
+   const std::string fileName = getFileName( id );
+   const std::string temporary = fileName+".download";
+   FILE* file = fopen( temporary.c_str(), "wb" );
+   if( !file )
+   {
+      InternetCloseHandle( handle );
+      return false;
+   }
+   std::vector<char> buffer( FETCH_CHUNK_SIZE );
+   DWORD read(0);
+   size_t total(0);
+   bool complete(false);
+   while( true )
+   {
+      if( !InternetReadFile( handle, &buffer[0], FETCH_CHUNK_SIZE, &read ) ) break;
+      if( read==0 )
+      {
+         complete = true;
+         break;
+      }
+      if( fwrite( &buffer[0], 1, read, file )!=read ) break;
+      total += read;
+   }
+   InternetCloseHandle( handle );
+   if( fclose( file )!=0 ) complete = false;
+
+   // Readers see the whole file or nothing
+   if( complete && total!=0 && _compress )
+   {
+      complete = PdbStore::compress( temporary, fileName+".gz" );
+      DeleteFile( temporary.c_str() );
+      if( !complete ) return false;
+   }
+   else if( !complete || total==0 || !MoveFileEx( temporary.c_str(), fileName.c_str(), MOVEFILE_REPLACE_EXISTING ) )
+   {
+      DeleteFile( temporary.c_str() );
+      return false;
+   }
+   LOG_INFO(1, "Downloaded " << url << " (" << total << " bytes)" );
+   return true;
+}
+
+DWORD WINAPI PdbFetcher::fetchThread( LPVOID param )
+{
+   PdbFetcher* self = static_cast<PdbFetcher*>(param);
+   Tracer::setThreadName( "pdb fetcher" );
+   while( true )
+   {
+      WaitForSingleObject( self->_ready, INFINITE );
+      if( !self->_running ) break;
+
+      EnterCriticalSection( &self->_lock );
+      Download* download = self->_queue.front();
+      self->_queue.pop_front();
+      LeaveCriticalSection( &self->_lock );
+
+      download->found = self->download( *download );
+      self->_pump.Post( (void*)onFetched, download );
+   }
+   return 0;
+}
+
+void PdbFetcher::onFetched( Download* download )
+{
+   // Runs on the event pump thread
+   PdbFetcher* self = download->owner;
+   self->_downloads.erase( download->moleculeId );
+   if( !download->found )
+   {
+      LOG_ERROR( "Could not download molecule " << download->moleculeId );
+      self->_nbFailed++;
+   }
+   for( size_t i(0); i<download->waiting.size(); ++i )
+   {
+      self->_completion( download->waiting[i], download->found );
+   }
+   delete download;
+}
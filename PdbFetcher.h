@@ -0,0 +1,121 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+#include <windows.h>
+#include <wininet.h>
+#include <lacewing.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+struct RenderContext;
+
+/*
+________________________________________________________________________________
+
+PDB fetcher
+
+Downloads the PDB files missing from ./Pdb/ on background threads, so that
+neither the event loop nor the render queue waits for the network. Files are
+read in 64 KB chunks into a temporary file, which is renamed once complete:
+a file in ./Pdb/ is never partial.
+
+Gets for a missing molecule wait here, outside the scheduler, and are handed
+back through the completion callback when their file arrives (or does not).
+Gets for a molecule already being downloaded join that download. Live
+streams and sessions do not wait, they drop frames until the file is there.
+
+Files come from the Protein Data Bank unless another server is set with
+--pdb-mirror, a local mirror or a test stand-in. With compression on, they
+are stored gzip compressed as ID.pdb.gz.
+________________________________________________________________________________
+*/
+class PdbFetcher
+{
+public:
+   // Called on the event pump thread with a context that waited for its file
+   typedef void (*Completion)( RenderContext* ctx, const bool found );
+
+public:
+   PdbFetcher( Lacewing::Pump& pump, Completion completion );
+   ~PdbFetcher();
+
+   // Base URL, the file name (ID.pdb) is appended to it
+   void setMirror( const char* url ) { _mirror = url; }
+   const std::string& getMirror() const { return _mirror; }
+
+   // Stores downloaded files compressed
+   void setCompress( const bool compress ) { _compress = compress; }
+
+   // True if a file of the molecule is in ./Pdb/, compressed or not. Otherwise its download is
+   // started, unless already running, and ctx, if any, waits for it.
+   bool request( const std::string& moleculeId, RenderContext* ctx );
+
+   // Drops the waiting context of a client that went away
+   void onDisconnect( Lacewing::Webserver::Request& request );
+
+   static std::string getFileName( const std::string& moleculeId );
+
+   int getNbDownloads() const { return _nbDownloads; }
+   int getNbJoined() const { return _nbJoined; }
+   int getNbFailed() const { return _nbFailed; }
+
+private:
+   struct Download
+   {
+      PdbFetcher*  owner;
+      std::string  moleculeId;
+      std::vector<RenderContext*> waiting;
+      bool         found;
+   };
+
+   bool download( const Download& download );
+
+   static DWORD WINAPI fetchThread( LPVOID param );
+   static void onFetched( Download* download );
+
+private:
+   Lacewing::Pump& _pump;
+   Completion      _completion;
+   std::string     _mirror;
+   bool            _compress;
+   HINTERNET       _internet;
+
+   // Downloads in progress by molecule, only touched from the event pump thread
+   std::map<std::string, Download*> _downloads;
+
+   // Downloads not picked by a thread yet
+   std::deque<Download*> _queue;
+   CRITICAL_SECTION      _lock;
+   HANDLE                _ready;
+   std::vector<HANDLE>   _threads;
+   bool                  _running;
+
+   int _nbDownloads;
+   int _nbJoined;
+   int _nbFailed;
+};
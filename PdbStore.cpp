@@ -0,0 +1,395 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "PdbStore.h"
+#include "AsyncLog.h"
+
+#include <windows.h>
+#include <zlib.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+
+const unsigned int STORE_CHUNK_SIZE = 64*1024;
+
+const size_t MAX_MOLECULE_ID_LENGTH = 16;
+
+// Source formats, in order of preference
+static const char* PDB_EXTENSIONS[] = { ".pdb", ".pdb.gz", ".cif.gz" };
+const int NB_PDB_EXTENSIONS = 3;
+
+static bool endsWith( const std::string& value, const char* suffix )
+{
+   const size_t length = strlen(suffix);
+   return value.length()>=length && value.compare( value.length()-length, length, suffix )==0;
+}
+
+// --------------------------------------------------------------------------------
+// mmCIF atom sites
+// --------------------------------------------------------------------------------
+enum AtomSiteColumn
+{
+   acGroup = 0,
+   acId,
+   acElement,
+   acAtomName,
+   acLabelAtomName,
+   acAltLoc,
+   acResidue,
+   acLabelResidue,
+   acChain,
+   acLabelChain,
+   acSequence,
+   acLabelSequence,
+   acInsertion,
+   acX,
+   acY,
+   acZ,
+   acOccupancy,
+   acTemperature,
+   acModel,
+   NB_ATOM_SITE_COLUMNS
+};
+
+// Chain identifiers of PDB records, one character each
+static const char PDB_CHAIN_IDS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+const int NB_PDB_CHAIN_IDS = sizeof(PDB_CHAIN_IDS)-1;
+
+static const char* ATOM_SITE_COLUMNS[NB_ATOM_SITE_COLUMNS] =
+{
+   "group_PDB", "id", "type_symbol", "auth_atom_id", "label_atom_id", "label_alt_id",
+   "auth_comp_id", "label_comp_id", "auth_asym_id", "label_asym_id", "auth_seq_id",
+   "label_seq_id", "pdbx_PDB_ins_code", "Cartn_x", "Cartn_y", "Cartn_z",
+   "occupancy", "B_iso_or_equiv", "pdbx_PDB_model_num"
+};
+
+class CifConverter
+{
+public:
+   CifConverter() : _inLoop(false), _inAtomSite(false), _model(-1), _nbColumns(0)
+   {
+      memset( _usedChains, 0, sizeof(_usedChains) );
+   }
+
+   // Appends the PDB records of one mmCIF line
+   void convert( const char* line, std::string& output );
+
+private:
+   void split( const char* line );
+   const char* get( const AtomSiteColumn column, const AtomSiteColumn fallback ) const;
+   void writeAtom( std::string& output );
+   char getChainId( const std::string& chain );
+
+private:
+   bool _inLoop;     // Reading the column names of a loop
+   bool _inAtomSite; // The loop is the atom site one
+   int  _model;      // First model, the only one written
+   std::vector<int> _columns; // Column of the loop for each atom site column
+   int  _nbColumns;
+   std::vector<std::string> _values;
+
+   // mmCIF chains, whose identifiers may be longer than one character, and
+   // the PDB chain each one is written as
+   std::map<std::string, char> _chains;
+   bool _usedChains[256];
+};
+
+char CifConverter::getChainId( const std::string& chain )
+{
+   if( chain.empty() ) return ' ';
+   std::map<std::string, char>::iterator it = _chains.find( chain );
+   if( it != _chains.end() ) return it->second;
+
+   // Chains keep their identifier when it is a free single character, the
+   // others get the first free one
+   char id(0);
+   const unsigned char first = static_cast<unsigned char>(chain[0]);
+   if( chain.length()==1 && !_usedChains[first] ) id = chain[0];
+   for( int i(0); i<NB_PDB_CHAIN_IDS && id==0; ++i )
+   {
+      if( !_usedChains[static_cast<unsigned char>(PDB_CHAIN_IDS[i])] ) id = PDB_CHAIN_IDS[i];
+   }
+   if( id==0 )
+   {
+      // More chains than PDB identifiers, some have to be merged
+      id = PDB_CHAIN_IDS[_chains.size()%NB_PDB_CHAIN_IDS];
+      LOG_INFO(1, "mmCIF chain " << chain << " shares PDB chain identifier " << id );
+   }
+   _usedChains[static_cast<unsigned char>(id)] = true;
+   _chains[chain] = id;
+   return id;
+}
+
+void CifConverter::split( const char* line )
+{
+   _values.clear();
+   const char* c = line;
+   while( *c )
+   {
+      while( *c==' ' || *c=='\t' || *c=='\r' || *c=='\n' ) ++c;
+      if( !*c ) break;
+      const char* begin = c;
+      if( *c=='\'' || *c=='"' )
+      {
+         // Quoted values end at a matching quote followed by a blank
+         const char quote = *c++;
+         begin = c;
+         while( *c && !(*c==quote && (c[1]==' ' || c[1]=='\t' || c[1]=='\r' || c[1]=='\n' || c[1]==0)) ) ++c;
+         _values.push_back( std::string( begin, c ) );
+         if( *c ) ++c;
+      }
+      else
+      {
+         while( *c && *c!=' ' && *c!='\t' && *c!='\r' && *c!='\n' ) ++c;
+         _values.push_back( std::string( begin, c ) );
+      }
+   }
+}
+
+const char* CifConverter::get( const AtomSiteColumn column, const AtomSiteColumn fallback ) const
+{
+   int index = _columns[column];
+   if( index<0 || _values[index]=="?" || _values[index]=="." ) index = _columns[fallback];
+   if( index<0 || _values[index]=="?" || _values[index]=="." ) return "";
+   return _values[index].c_str();
+}
+
+void CifConverter::writeAtom( std::string& output )
+{
+   const int model = atoi( get( acModel, acModel ) );
+   if( _model<0 ) _model = model;
+   if( model!=_model ) return;
+
+   const char* element = get( acElement, acElement );
+   const char* name    = get( acAtomName, acLabelAtomName );
+   const char* group   = get( acGroup, acGroup );
+   const char* chain   = get( acChain, acLabelChain );
+   const char* altLoc  = get( acAltLoc, acAltLoc );
+   const char* insertion = get( acInsertion, acInsertion );
+
+   // Names of one-letter elements start in the second column of the field
+   char atomName[8];
+   if( strlen(name)<4 && strlen(element)<2 ) sprintf( atomName, " %-3.3s", name );
+   else sprintf( atomName, "%-4.4s", name );
+
+   char record[128];
+   sprintf( record, "%-6.6s%5d %4s%c%3.3s %c%4d%c   %8.3f%8.3f%8.3f%6.2f%6.2f          %2.2s\n",
+      strcmp(group,"HETATM")==0 ? "HETATM" : "ATOM",
+      atoi( get( acId, acId ) )%100000,
+      atomName,
+      altLoc[0] ? altLoc[0] : ' ',
+      get( acResidue, acLabelResidue ),
+      getChainId( chain ),
+      atoi( get( acSequence, acLabelSequence ) )%10000,
+      insertion[0] ? insertion[0] : ' ',
+      atof( get( acX, acX ) ), atof( get( acY, acY ) ), atof( get( acZ, acZ ) ),
+      atof( get( acOccupancy, acOccupancy ) ), atof( get( acTemperature, acTemperature ) ),
+      element );
+   output += record;
+}
+
+void CifConverter::convert( const char* line, std::string& output )
+{
+   if( strncmp( line, "loop_", 5 )==0 )
+   {
+      _inLoop     = true;
+      _inAtomSite = false;
+      _nbColumns  = 0;
+      _columns.assign( NB_ATOM_SITE_COLUMNS, -1 );
+      return;
+   }
+   if( line[0]=='_' )
+   {
+      if( _inLoop && strncmp( line, "_atom_site.", 11 )==0 )
+      {
+         _inAtomSite = true;
+         split( line+11 );
+         for( int i(0); i<NB_ATOM_SITE_COLUMNS; ++i )
+         {
+            if( !_values.empty() && _values[0]==ATOM_SITE_COLUMNS[i] ) _columns[i] = _nbColumns;
+         }
+         _nbColumns++;
+      }
+      else
+      {
+         _inAtomSite = false;
+      }
+      return;
+   }
+   _inLoop = false;
+   if( line[0]=='#' || strncmp( line, "data_", 5 )==0 )
+   {
+      _inAtomSite = false;
+      return;
+   }
+   if( !_inAtomSite ) return;
+
+   split( line );
+   if( static_cast<int>(_values.size())==_nbColumns && _columns[acX]>=0 && _columns[acY]>=0 && _columns[acZ]>=0 )
+   {
+      writeAtom( output );
+   }
+}
+
+// --------------------------------------------------------------------------------
+// Store
+// --------------------------------------------------------------------------------
+bool PdbStore::isValidId( const std::string& moleculeId )
+{
+   if( moleculeId.empty() || moleculeId.length()>MAX_MOLECULE_ID_LENGTH ) return false;
+   for( size_t i(0); i<moleculeId.length(); ++i )
+   {
+      if( !isalnum( static_cast<unsigned char>(moleculeId[i]) ) ) return false;
+   }
+   return true;
+}
+
+std::string PdbStore::find( const std::string& moleculeId )
+{
+   if( !isValidId( moleculeId ) ) return "";
+   for( int i(0); i<NB_PDB_EXTENSIONS; ++i )
+   {
+      const std::string fileName = "./Pdb/"+moleculeId+PDB_EXTENSIONS[i];
+      if( GetFileAttributes( fileName.c_str() )!=INVALID_FILE_ATTRIBUTES ) return fileName;
+   }
+   return "";
+}
+
+static bool writeAll( HANDLE file, const std::string& data )
+{
+   DWORD written(0);
+   return data.empty() ||
+      (WriteFile( file, data.c_str(), static_cast<DWORD>(data.length()), &written, NULL ) && written==data.length());
+}
+
+bool PdbStore::extract( const std::string& sourceFile, std::string& textFile )
+{
+   if( !endsWith( sourceFile, ".gz" ) )
+   {
+      textFile = sourceFile;
+      return true;
+   }
+
+   gzFile source = gzopen( sourceFile.c_str(), "rb" );
+   if( !source ) return false;
+   gzbuffer( source, STORE_CHUNK_SIZE );
+
+   char path[MAX_PATH];
+   char name[MAX_PATH];
+   if( GetTempPath( MAX_PATH, path )==0 || GetTempFileName( path, "pdb", 0, name )==0 )
+   {
+      gzclose( source );
+      return false;
+   }
+   textFile = name;
+
+   // Temporary files stay in the file cache unless memory runs low
+   HANDLE file = CreateFile( name, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL );
+   bool complete(file!=INVALID_HANDLE_VALUE);
+   if( complete )
+   {
+      std::string chunk;
+      chunk.reserve( STORE_CHUNK_SIZE+256 );
+      if( endsWith( sourceFile, ".cif.gz" ) )
+      {
+         CifConverter converter;
+         std::vector<char> line( 4096 );
+         while( complete && gzgets( source, &line[0], static_cast<int>(line.size()) ) )
+         {
+            converter.convert( &line[0], chunk );
+            if( chunk.length()>=STORE_CHUNK_SIZE )
+            {
+               complete = writeAll( file, chunk );
+               chunk.clear();
+            }
+         }
+         chunk += "END\n";
+      }
+      else
+      {
+         chunk.resize( STORE_CHUNK_SIZE );
+         int read(0);
+         while( complete && (read = gzread( source, &chunk[0], STORE_CHUNK_SIZE ))>0 )
+         {
+            DWORD written(0);
+            complete = WriteFile( file, chunk.c_str(), read, &written, NULL ) && written==static_cast<DWORD>(read);
+         }
+         if( read<0 ) complete = false;
+         chunk.clear();
+      }
+      int error(Z_OK);
+      gzerror( source, &error );
+      if( error!=Z_OK && error!=Z_STREAM_END ) complete = false;
+      if( complete ) complete = writeAll( file, chunk );
+      CloseHandle( file );
+   }
+   gzclose( source );
+   if( !complete )
+   {
+      DeleteFile( name );
+      textFile.clear();
+   }
+   return complete;
+}
+
+void PdbStore::release( const std::string& sourceFile, const std::string& textFile )
+{
+   if( !textFile.empty() && textFile!=sourceFile ) DeleteFile( textFile.c_str() );
+}
+
+bool PdbStore::compress( const std::string& textFile, const std::string& gzipFile )
+{
+   FILE* source = fopen( textFile.c_str(), "rb" );
+   if( !source ) return false;
+   const std::string temporary = gzipFile+".tmp";
+   gzFile target = gzopen( temporary.c_str(), "wb9" );
+   if( !target )
+   {
+      fclose( source );
+      return false;
+   }
+
+   std::vector<char> buffer( STORE_CHUNK_SIZE );
+   bool complete(true);
+   size_t read(0);
+   while( complete && (read = fread( &buffer[0], 1, buffer.size(), source ))>0 )
+   {
+      complete = (gzwrite( target, &buffer[0], static_cast<unsigned int>(read) )==static_cast<int>(read));
+   }
+   if( ferror( source ) ) complete = false;
+   fclose( source );
+   if( gzclose( target )!=Z_OK ) complete = false;
+
+   if( !complete || !MoveFileEx( temporary.c_str(), gzipFile.c_str(), MOVEFILE_REPLACE_EXISTING ) )
+   {
+      DeleteFile( temporary.c_str() );
+      return false;
+   }
+   return true;
+}
@@ -0,0 +1,62 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+#include <string>
+
+/*
+________________________________________________________________________________
+
+PDB store
+
+Molecules in ./Pdb/ are kept as ID.pdb text files, or gzip compressed as
+ID.pdb.gz or ID.cif.gz (mmCIF). PDBReader only reads PDB text from a file, so
+compressed sources are inflated in 64 KB chunks into a temporary file, which
+the system keeps in memory, and the reader parses that. mmCIF atom sites are
+rewritten on the fly as ATOM/HETATM records of the first model.
+
+Only the compressed bytes are read from disk, about a quarter of the text.
+With --pdb-compress, downloaded files are stored as ID.pdb.gz.
+________________________________________________________________________________
+*/
+class PdbStore
+{
+public:
+   // Molecule identifiers end up in paths and URLs, they must be short and
+   // alphanumeric. Checked when requests are parsed.
+   static bool isValidId( const std::string& moleculeId );
+
+   // Source file of the molecule, the first of ID.pdb, ID.pdb.gz and ID.cif.gz
+   // found in ./Pdb/. Empty if there is none.
+   static std::string find( const std::string& moleculeId );
+
+   // PDB text file with the content of the source. Plain .pdb sources are
+   // their own text file, others are extracted into a temporary file which
+   // must be handed to release.
+   static bool extract( const std::string& sourceFile, std::string& textFile );
+   static void release( const std::string& sourceFile, const std::string& textFile );
+
+   // Compresses a PDB text file into a gzip file, written aside and renamed
+   static bool compress( const std::string& textFile, const std::string& gzipFile );
+};
@@ -0,0 +1,199 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#include "PrimitiveBatch.h"
+
+PrimitiveBatch::PrimitiveBatch()
+{
+}
+
+void PrimitiveBatch::clear()
+{
+   _index.clear(); _type.clear(); _material.clear();
+   _x0.clear(); _y0.clear(); _z0.clear();
+   _x1.clear(); _y1.clear(); _z1.clear();
+   _x2.clear(); _y2.clear(); _z2.clear();
+   _w.clear();  _h.clear();  _d.clear();
+   _instanceIndex.clear(); _instanceMesh.clear(); _instanceMaterial.clear();
+   _tx.clear(); _ty.clear(); _tz.clear();
+   _sx.clear(); _sy.clear(); _sz.clear();
+}
+
+void PrimitiveBatch::reserve( const size_t count )
+{
+   _index.reserve(count); _type.reserve(count); _material.reserve(count);
+   _x0.reserve(count); _y0.reserve(count); _z0.reserve(count);
+   _x1.reserve(count); _y1.reserve(count); _z1.reserve(count);
+   _x2.reserve(count); _y2.reserve(count); _z2.reserve(count);
+   _w.reserve(count);  _h.reserve(count);  _d.reserve(count);
+}
+
+size_t PrimitiveBatch::add( const PrimitiveType type,
+   const float x0, const float y0, const float z0,
+   const float x1, const float y1, const float z1,
+   const float x2, const float y2, const float z2,
+   const float w,  const float h,  const float d,
+   const int material )
+{
+   return set( -1, type, x0, y0, z0, x1, y1, z1, x2, y2, z2, w, h, d, material );
+}
+
+size_t PrimitiveBatch::set( const int index, const PrimitiveType type,
+   const float x0, const float y0, const float z0,
+   const float x1, const float y1, const float z1,
+   const float x2, const float y2, const float z2,
+   const float w,  const float h,  const float d,
+   const int material )
+{
+   _index.push_back(index);
+   _type.push_back(type);
+   _material.push_back(material);
+   _x0.push_back(x0); _y0.push_back(y0); _z0.push_back(z0);
+   _x1.push_back(x1); _y1.push_back(y1); _z1.push_back(z1);
+   _x2.push_back(x2); _y2.push_back(y2); _z2.push_back(z2);
+   _w.push_back(w);   _h.push_back(h);   _d.push_back(d);
+   return _type.size()-1;
+}
+
+size_t PrimitiveBatch::addTriangle( const Vertex& p0, const Vertex& p1, const Vertex& p2, const int material )
+{
+   return add( ptTriangle, p0.x, p0.y, p0.z, p1.x, p1.y, p1.z, p2.x, p2.y, p2.z, 0.f, 0.f, 0.f, material );
+}
+
+size_t PrimitiveBatch::addSphere( const Vertex& center, const float radius, const int material )
+{
+   return add( ptSphere, center.x, center.y, center.z, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, radius, 0.f, 0.f, material );
+}
+
+size_t PrimitiveBatch::addCylinder( const Vertex& p0, const Vertex& p1, const float radius, const int material )
+{
+   return add( ptCylinder, p0.x, p0.y, p0.z, p1.x, p1.y, p1.z, 0.f, 0.f, 0.f, radius, 0.f, 0.f, material );
+}
+
+int PrimitiveBatch::addMesh( const float* vertices, const int nbTriangles )
+{
+   _meshOffset.push_back( static_cast<int>(_meshVertices.size()) );
+   _meshSize.push_back( nbTriangles );
+   _meshVertices.insert( _meshVertices.end(), vertices, vertices+nbTriangles*9 );
+   return static_cast<int>(_meshSize.size())-1;
+}
+
+size_t PrimitiveBatch::addInstance( const int mesh, const Vertex& position, const Vertex& scale, const int material )
+{
+   return setInstance( -1, mesh, position, scale, material );
+}
+
+size_t PrimitiveBatch::setInstance( const int index, const int mesh, const Vertex& position, const Vertex& scale, const int material )
+{
+   _instanceIndex.push_back(index);
+   _instanceMesh.push_back(mesh);
+   _instanceMaterial.push_back(material);
+   _tx.push_back(position.x); _ty.push_back(position.y); _tz.push_back(position.z);
+   _sx.push_back(scale.x);    _sy.push_back(scale.y);    _sz.push_back(scale.z);
+   return _instanceMesh.size()-1;
+}
+
+void PrimitiveBatch::getValues( const size_t position, float* values ) const
+{
+   values[0] = _x0[position]; values[1]  = _y0[position]; values[2]  = _z0[position];
+   values[3] = _x1[position]; values[4]  = _y1[position]; values[5]  = _z1[position];
+   values[6] = _x2[position]; values[7]  = _y2[position]; values[8]  = _z2[position];
+   values[9] = _w[position];  values[10] = _h[position];  values[11] = _d[position];
+}
+
+void PrimitiveBatch::getInstanceTransform( const size_t position, float* translation, float* scale ) const
+{
+   translation[0] = _tx[position]; translation[1] = _ty[position]; translation[2] = _tz[position];
+   scale[0] = _sx[position]; scale[1] = _sy[position]; scale[2] = _sz[position];
+}
+
+void PrimitiveBatch::reset( GPUKernel& kernel )
+{
+   kernel.resetAll();
+   BatchConsumer* consumer = dynamic_cast<BatchConsumer*>(&kernel);
+   if( consumer ) consumer->clearBatches();
+}
+
+int PrimitiveBatch::upload( GPUKernel& kernel )
+{
+   BatchConsumer* consumer = dynamic_cast<BatchConsumer*>(&kernel);
+   if( consumer ) return consumer->consume( *this );
+
+   // One call per primitive, the GPU kernels have no bulk upload
+   int created(0);
+   const int count = static_cast<int>(_type.size());
+   int*         index    = count ? &_index[0] : nullptr;
+   const int*   type     = count ? &_type[0] : nullptr;
+   const int*   material = count ? &_material[0] : nullptr;
+   const float* x0 = count ? &_x0[0] : nullptr; const float* y0 = count ? &_y0[0] : nullptr; const float* z0 = count ? &_z0[0] : nullptr;
+   const float* x1 = count ? &_x1[0] : nullptr; const float* y1 = count ? &_y1[0] : nullptr; const float* z1 = count ? &_z1[0] : nullptr;
+   const float* x2 = count ? &_x2[0] : nullptr; const float* y2 = count ? &_y2[0] : nullptr; const float* z2 = count ? &_z2[0] : nullptr;
+   const float* w  = count ? &_w[0]  : nullptr; const float* h  = count ? &_h[0]  : nullptr; const float* d  = count ? &_d[0]  : nullptr;
+   for( int i(0); i<count; ++i )
+   {
+      if( index[i]<0 )
+      {
+         index[i] = kernel.addPrimitive( static_cast<PrimitiveType>(type[i]) );
+         ++created;
+      }
+      kernel.setPrimitive( index[i],
+         x0[i], y0[i], z0[i],
+         x1[i], y1[i], z1[i],
+         x2[i], y2[i], z2[i],
+         w[i],  h[i],  d[i],
+         material[i] );
+   }
+
+   // Instances are expanded here, the triangles of an instance are contiguous
+   const int nbInstances = static_cast<int>(_instanceMesh.size());
+   for( int i(0); i<nbInstances; ++i )
+   {
+      const int mesh = _instanceMesh[i];
+      const int nbTriangles = _meshSize[mesh];
+      const float* v = &_meshVertices[_meshOffset[mesh]];
+      const float tx = _tx[i], ty = _ty[i], tz = _tz[i];
+      const float sx = _sx[i], sy = _sy[i], sz = _sz[i];
+      int first = _instanceIndex[i];
+      for( int t(0); t<nbTriangles; ++t, v+=9 )
+      {
+         int primitive;
+         if( first<0 )
+         {
+            primitive = kernel.addPrimitive( ptTriangle );
+            if( t==0 ) _instanceIndex[i] = primitive;
+            ++created;
+         }
+         else
+         {
+            primitive = first+t;
+         }
+         kernel.setPrimitive( primitive,
+            tx+v[0]*sx, ty+v[1]*sy, tz+v[2]*sz,
+            tx+v[3]*sx, ty+v[4]*sy, tz+v[5]*sz,
+            tx+v[6]*sx, ty+v[7]*sy, tz+v[8]*sz,
+            0.f, 0.f, 0.f,
+            _instanceMaterial[i] );
+      }
+   }
+   return created;
+}
@@ -0,0 +1,168 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+#include <vector>
+
+#include <GPUKernel.h>
+
+class PrimitiveBatch;
+
+/*
+________________________________________________________________________________
+
+Batch consumer
+
+Kernels that implement it take a whole batch in one call and store the staged
+columns directly, instead of one addPrimitive and one setPrimitive call per
+primitive. The kernel indices they hand back are their own: they are only
+valid for set() and setInstance() on later batches, not for getPrimitive.
+________________________________________________________________________________
+*/
+class BatchConsumer
+{
+public:
+   virtual ~BatchConsumer() {}
+
+   // Creates and updates everything staged in the batch, and records the
+   // kernel indices in it. Returns the number of primitives created.
+   virtual int consume( PrimitiveBatch& batch ) = 0;
+
+   // Removes everything consumed so far
+   virtual void clearBatches() = 0;
+};
+
+/*
+________________________________________________________________________________
+
+Primitive staging buffer
+
+Scene builders fill contiguous structure-of-arrays columns, and the whole
+batch is handed to the kernel by upload(). Primitives are either new ones
+(created in the kernel on upload) or existing ones that are overwritten in
+place.
+
+Kernels implementing BatchConsumer (the CPU kernel) get the whole batch in a
+single call. The GPU kernels have no bulk entry point: they still get one
+addPrimitive and one setPrimitive call per primitive.
+
+Geometry repeated many times (e.g. chart columns) is staged as instances of
+a base mesh: a position, a scale and a material per instance instead of all
+the triangles. Only the GPU kernels get them expanded into triangles.
+________________________________________________________________________________
+*/
+class PrimitiveBatch
+{
+public:
+   PrimitiveBatch();
+
+   // Removes the staged primitives and instances. Meshes are kept.
+   void clear();
+   void reserve( const size_t count );
+   size_t size() const { return _type.size(); }
+   bool empty() const { return _type.empty() && _instanceMesh.empty(); }
+
+   // Stages a new primitive. Returns its position in the batch.
+   size_t add( const PrimitiveType type,
+      const float x0, const float y0, const float z0,
+      const float x1, const float y1, const float z1,
+      const float x2, const float y2, const float z2,
+      const float w,  const float h,  const float d,
+      const int material );
+
+   // Stages an update of the existing kernel primitive 'index'
+   size_t set( const int index, const PrimitiveType type,
+      const float x0, const float y0, const float z0,
+      const float x1, const float y1, const float z1,
+      const float x2, const float y2, const float z2,
+      const float w,  const float h,  const float d,
+      const int material );
+
+   // Shortcuts for the most common primitives
+   size_t addTriangle( const Vertex& p0, const Vertex& p1, const Vertex& p2, const int material );
+   size_t addSphere( const Vertex& center, const float radius, const int material );
+   size_t addCylinder( const Vertex& p0, const Vertex& p1, const float radius, const int material );
+
+   // Registers a base mesh of nbTriangles triangles, 9 coordinates each.
+   // Returns the mesh identifier.
+   int addMesh( const float* vertices, const int nbTriangles );
+   int getMeshSize( const int mesh ) const { return _meshSize[mesh]; }
+
+   // Stages a new instance of a mesh, vertices being scaled then translated.
+   // Returns its position among the staged instances.
+   size_t addInstance( const int mesh, const Vertex& position, const Vertex& scale, const int material );
+
+   // Stages an update of the instance whose triangles start at kernel index 'index'
+   size_t setInstance( const int index, const int mesh, const Vertex& position, const Vertex& scale, const int material );
+
+   // Hands all staged primitives to the kernel. Returns the number of
+   // primitives that were created.
+   int upload( GPUKernel& kernel );
+
+   // Removes all primitives from the kernel, consumed batches included
+   static void reset( GPUKernel& kernel );
+
+   // Kernel index of the primitive staged at 'position', valid after upload
+   int getIndex( const size_t position ) const { return _index[position]; }
+
+   // Kernel index of the instance staged at 'position', valid after upload.
+   // For the GPU kernels, this is the index of its first triangle.
+   int getInstanceIndex( const size_t position ) const { return _instanceIndex[position]; }
+
+   // Staged columns, for batch consumers
+   void setIndex( const size_t position, const int index ) { _index[position] = index; }
+   int getType( const size_t position ) const { return _type[position]; }
+   int getMaterial( const size_t position ) const { return _material[position]; }
+   void getValues( const size_t position, float* values ) const; // p0, p1, p2 then w, h, d
+
+   size_t getNbInstances() const { return _instanceMesh.size(); }
+   void setInstanceIndex( const size_t position, const int index ) { _instanceIndex[position] = index; }
+   int getInstanceMesh( const size_t position ) const { return _instanceMesh[position]; }
+   int getInstanceMaterial( const size_t position ) const { return _instanceMaterial[position]; }
+   void getInstanceTransform( const size_t position, float* translation, float* scale ) const;
+
+   int getNbMeshes() const { return static_cast<int>(_meshSize.size()); }
+   const float* getMeshVertices( const int mesh ) const { return &_meshVertices[_meshOffset[mesh]]; }
+
+private:
+   std::vector<int>   _index; // -1 until created
+   std::vector<int>   _type;
+   std::vector<int>   _material;
+   std::vector<float> _x0, _y0, _z0;
+   std::vector<float> _x1, _y1, _z1;
+   std::vector<float> _x2, _y2, _z2;
+   std::vector<float> _w,  _h,  _d;
+
+   // Meshes: triangles of all meshes back to back
+   std::vector<float> _meshVertices;
+   std::vector<int>   _meshOffset; // First coordinate of each mesh
+   std::vector<int>   _meshSize;   // Number of triangles of each mesh
+
+   // Instances
+   std::vector<int>   _instanceIndex; // -1 until created
+   std::vector<int>   _instanceMesh;
+   std::vector<int>   _instanceMaterial;
+   std::vector<float> _tx, _ty, _tz;
+   std::vector<float> _sx, _sy, _sz;
+};
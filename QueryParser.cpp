@@ -0,0 +1,276 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#include "QueryParser.h"
+#include "NumberParser.h"
+
+#include <string.h>
+
+// Perfect hash of the parameter names: (length + first + 2*last) & 63
+struct HashEntry
+{
+   const char*      name;
+   RequestParameter parameter;
+};
+
+static const HashEntry gParameterTable[64] = {
+   { nullptr,          rpUnknown          }, //  0
+   { "size",           rpSize             }, //  1
+   { "type",           rpType             }, //  2
+   { "scheme",         rpScheme           }, //  3
+   { nullptr,          rpUnknown          }, //  4
+   { nullptr,          rpUnknown          }, //  5
+   { "structure",      rpStructure        }, //  6
+   { "turntable",      rpTurntable        }, //  7
+   { nullptr,          rpUnknown          }, //  8
+   { nullptr,          rpUnknown          }, //  9
+   { "model",          rpModel            }, // 10
+   { nullptr,          rpUnknown          }, // 11
+   { "postprocessing", rpPostProcessing   }, // 12
+   { "bkcolor",        rpBkColor          }, // 13
+   { nullptr,          rpUnknown          }, // 14
+   { "fps",            rpFps              }, // 15
+   { nullptr,          rpUnknown          }, // 16
+   { nullptr,          rpUnknown          }, // 17
+   { nullptr,          rpUnknown          }, // 18
+   { "stream",         rpStream           }, // 19
+   { nullptr,          rpUnknown          }, // 20
+   { nullptr,          rpUnknown          }, // 21
+   { "rotation",       rpRotation         }, // 22
+   { nullptr,          rpUnknown          }, // 23
+   { nullptr,          rpUnknown          }, // 24
+   { nullptr,          rpUnknown          }, // 25
+   { nullptr,          rpUnknown          }, // 26
+   { "poses",          rpPoses            }, // 27
+   { nullptr,          rpUnknown          }, // 28
+   { nullptr,          rpUnknown          }, // 29
+   { nullptr,          rpUnknown          }, // 30
+   { nullptr,          rpUnknown          }, // 31
+   { nullptr,          rpUnknown          }, // 32
+   { nullptr,          rpUnknown          }, // 33
+   { "values",         rpValues           }, // 34
+   { nullptr,          rpUnknown          }, // 35
+   { nullptr,          rpUnknown          }, // 36
+   { nullptr,          rpUnknown          }, // 37
+   { nullptr,          rpUnknown          }, // 38
+   { nullptr,          rpUnknown          }, // 39
+   { nullptr,          rpUnknown          }, // 40
+   { nullptr,          rpUnknown          }, // 41
+   { "quality",        rpQuality          }, // 42
+   { "window",         rpWindow           }, // 43
+   { nullptr,          rpUnknown          }, // 44
+   { nullptr,          rpUnknown          }, // 45
+   { nullptr,          rpUnknown          }, // 46
+   { "append",         rpAppend           }, // 47
+   { nullptr,          rpUnknown          }, // 48
+   { nullptr,          rpUnknown          }, // 49
+   { "close",          rpClose            }, // 50
+   { nullptr,          rpUnknown          }, // 51
+   { nullptr,          rpUnknown          }, // 52
+   { nullptr,          rpUnknown          }, // 53
+   { "distance",       rpDistance         }, // 54
+   { nullptr,          rpUnknown          }, // 55
+   { nullptr,          rpUnknown          }, // 56
+   { nullptr,          rpUnknown          }, // 57
+   { nullptr,          rpUnknown          }, // 58
+   { nullptr,          rpUnknown          }, // 59
+   { nullptr,          rpUnknown          }, // 60
+   { nullptr,          rpUnknown          }, // 61
+   { nullptr,          rpUnknown          }, // 62
+   { "molecule",       rpMolecule         }  // 63
+};
+
+static const StringRef gEmpty = { "", 0 };
+
+void RequestParams::clear()
+{
+   present = 0;
+   count = 0;
+   first = rpUnknown;
+   molecule = model = values = stream = append = poses = gEmpty;
+   type = -1;
+   window = 0;
+   close = 0;
+   distance = 0.f;
+   rotation.x = rotation.y = rotation.z = 0.f;
+   bkColor.x = bkColor.y = bkColor.z = 0.f;
+   quality = 0;
+   size = 0;
+   postProcessing = 0;
+   structure = 0;
+   scheme = 0;
+   turntable = 0;
+   fps = 0;
+}
+
+RequestParameter QueryParser::lookup( const char* name, const size_t length )
+{
+   if( length==0 ) return rpUnknown;
+   const unsigned char first = static_cast<unsigned char>(name[0]);
+   const unsigned char last  = static_cast<unsigned char>(name[length-1]);
+   const HashEntry& entry = gParameterTable[(length+first+2*last)&63];
+
+   // Lengths first, the name of the entry may be shorter than the one looked up
+   if( entry.name && strlen( entry.name )==length && memcmp( entry.name, name, length )==0 )
+   {
+      return entry.parameter;
+   }
+   return rpUnknown;
+}
+
+// Same as atoi: anything that is not a number reads as 0
+static int toInt( const StringRef& value )
+{
+   int result(0);
+   parseInt( value.data, value.end(), result );
+   return result;
+}
+
+static float toFloat( const StringRef& value )
+{
+   float result(0.f);
+   parseFloat( value.data, value.end(), result );
+   return result;
+}
+
+Vertex QueryParser::parseVertex( const char* first, const char* last )
+{
+   Vertex result = {0.f,0.f,0.f};
+   float* components[3] = { &result.x, &result.y, &result.z };
+   const char* p = first;
+   for( int i(0); i<3 && p<last; ++i )
+   {
+      p = parseFloat( p, last, *components[i] );
+      while( p<last && *p!=',' ) ++p;
+      if( p<last ) ++p;
+   }
+   return result;
+}
+
+void QueryParser::set( RequestParams& params, const RequestParameter parameter, const StringRef& value )
+{
+   if( params.count++==0 ) params.first = parameter;
+   if( parameter==rpUnknown ) return;
+   params.present |= (1u<<parameter);
+
+   switch( parameter )
+   {
+   case rpMolecule:       params.molecule = value; break;
+   case rpModel:          params.model = value; break;
+   case rpValues:         params.values = value; break;
+   case rpStream:         params.stream = value; break;
+   case rpAppend:         params.append = value; break;
+   case rpType:           params.type = toInt(value); break;
+   case rpWindow:         params.window = toInt(value); break;
+   case rpClose:          params.close = toInt(value); break;
+   case rpDistance:       params.distance = toFloat(value); break;
+   case rpRotation:       params.rotation = parseVertex( value.data, value.end() ); break;
+   case rpBkColor:        params.bkColor = parseVertex( value.data, value.end() ); break;
+   case rpQuality:        params.quality = toInt(value); break;
+   case rpSize:           params.size = toInt(value); break;
+   case rpPostProcessing: params.postProcessing = toInt(value); break;
+   case rpStructure:      params.structure = toInt(value); break;
+   case rpScheme:         params.scheme = toInt(value); break;
+   case rpPoses:          params.poses = value; break;
+   case rpTurntable:      params.turntable = toInt(value); break;
+   case rpFps:            params.fps = toInt(value); break;
+   default: break;
+   }
+}
+
+void QueryParser::parse( Lacewing::Webserver::Request::Parameter* parameter, RequestParams& params )
+{
+   params.clear();
+   while( parameter )
+   {
+      const char* name = parameter->Name();
+      StringRef value;
+      value.data   = parameter->Value();
+      value.length = strlen(value.data);
+      set( params, lookup( name, strlen(name) ), value );
+      parameter = parameter->Next();
+   }
+}
+
+static int hexValue( const char c )
+{
+   if( c>='0' && c<='9' ) return c-'0';
+   if( c>='a' && c<='f' ) return c-'a'+10;
+   if( c>='A' && c<='F' ) return c-'A'+10;
+   return -1;
+}
+
+void QueryParser::parse( const char* first, const char* last, RequestParams& params, char* scratch )
+{
+   params.clear();
+   const char* p = first;
+   if( p<last && *p=='?' ) ++p;
+   while( p<last )
+   {
+      const char* name = p;
+      while( p<last && *p!='=' && *p!='&' ) ++p;
+      const size_t nameLength = p-name;
+
+      StringRef value = gEmpty;
+      if( p<last && *p=='=' )
+      {
+         ++p;
+         const char* start = p;
+         bool escaped(false);
+         while( p<last && *p!='&' )
+         {
+            escaped |= (*p=='%' || *p=='+');
+            ++p;
+         }
+         value.data   = start;
+         value.length = p-start;
+
+         // Only escaped values are copied, decoded, into the scratch buffer
+         if( escaped )
+         {
+            char* out = scratch;
+            for( const char* c=start; c<p; ++c )
+            {
+               if( *c=='+' )
+               {
+                  *out++ = ' ';
+               }
+               else if( *c=='%' && c+2<p && hexValue(c[1])>=0 && hexValue(c[2])>=0 )
+               {
+                  *out++ = static_cast<char>(hexValue(c[1])*16+hexValue(c[2]));
+                  c += 2;
+               }
+               else
+               {
+                  *out++ = *c;
+               }
+            }
+            value.data   = scratch;
+            value.length = out-scratch;
+            scratch = out;
+         }
+      }
+      if( nameLength!=0 ) set( params, lookup( name, nameLength ), value );
+      if( p<last ) ++p;
+   }
+}
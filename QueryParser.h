@@ -0,0 +1,129 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+#include <lacewing.h>
+#include <string>
+
+#include <GPUKernel.h>
+
+// Text parameter. Points into the buffers of the request, nothing is copied.
+struct StringRef
+{
+   const char* data;
+   size_t      length;
+
+   bool empty() const { return length==0; }
+   const char* end() const { return data+length; }
+   std::string str() const { return std::string(data,length); }
+};
+
+// Parameters understood by the server
+enum RequestParameter
+{
+   rpUnknown = -1,
+   rpMolecule = 0,
+   rpModel,
+   rpType,
+   rpValues,
+   rpStream,
+   rpWindow,
+   rpAppend,
+   rpClose,
+   rpDistance,
+   rpRotation,
+   rpBkColor,
+   rpQuality,
+   rpSize,
+   rpPostProcessing,
+   rpStructure,
+   rpScheme,
+   rpPoses,
+   rpTurntable,
+   rpFps,
+   NB_REQUEST_PARAMETERS
+};
+
+// Typed content of a query string. Missing parameters keep the defaults set
+// by clear(), has() tells which ones were actually specified.
+struct RequestParams
+{
+   unsigned int     present; // One bit per RequestParameter
+   int              count;   // Number of parameters, known or not
+   RequestParameter first;   // First parameter, selects the use case
+
+   StringRef molecule;
+   StringRef model;
+   StringRef values;
+   StringRef stream;
+   StringRef append;
+   int       type;
+   int       window;
+   int       close;
+   float     distance;
+   Vertex    rotation; // Degrees
+   Vertex    bkColor;  // 0..255
+   int       quality;
+   int       size;
+   int       postProcessing;
+   int       structure;
+   int       scheme;
+   StringRef poses;     // Batches: x,y,z;x,y,z;... in degrees
+   int       turntable; // Batches: number of frames of a full turn
+   int       fps;       // Live streams: frames per second
+
+   void clear();
+   bool has( const RequestParameter parameter ) const { return (present & (1u<<parameter))!=0; }
+};
+
+/*
+________________________________________________________________________________
+
+Query parser
+
+Turns the parameters of a request into a RequestParams in a single pass,
+without allocating. Parameter names are dispatched with a static perfect hash
+table (gperf style, generated offline for the names above): one hash and one
+comparison per parameter. Numbers are read with the parsers of NumberParser.h.
+________________________________________________________________________________
+*/
+class QueryParser
+{
+public:
+   // Parameters as decoded by the web server
+   static void parse( Lacewing::Webserver::Request::Parameter* parameter, RequestParams& params );
+
+   // Raw query string (name=value&name=value...). Escaped values are decoded
+   // into scratch, which must be at least as large as the query string.
+   static void parse( const char* first, const char* last, RequestParams& params, char* scratch );
+
+   // rpUnknown if the name is not a parameter of the server
+   static RequestParameter lookup( const char* name, const size_t length );
+
+   // Reads up to three comma separated numbers
+   static Vertex parseVertex( const char* first, const char* last );
+
+private:
+   static void set( RequestParams& params, const RequestParameter parameter, const StringRef& value );
+};
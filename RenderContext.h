@@ -0,0 +1,213 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+#pragma once
+
+#include <lacewing.h>
+#include <string>
+#include <vector>
+
+#include <GPUKernel.h>
+
+#include "ChartScene.h"
+#include "QueryParser.h"
+#include "TileEncoder.h"
+#include "Tracer.h"
+
+class FrameListener;
+
+// ----------------------------------------------------------------------
+// Usecases
+// ----------------------------------------------------------------------
+enum UseCase 
+{
+   ucUndefined = 0,
+   ucChart = 1,
+   ucIRT   = 2,
+   ucPDB   = 3
+};
+
+// ----------------------------------------------------------------------
+// Scenes
+// ----------------------------------------------------------------------
+struct MoleculeInfo
+{
+   std::string moleculeId;
+   int structureType;
+   int scheme;
+   int lod; // Level of detail, picked when the scene is set up
+   Vertex viewPos;
+   Vertex rotationAngles;
+   SceneInfo sceneInfo;
+   PostProcessingInfo postProcessingInfo;
+};
+
+struct ChartInfo
+{
+   int chartType;
+   ChartData data;
+   std::string stream;
+   int window;
+   Vertex viewPos;
+   Vertex rotationAngles;
+   SceneInfo sceneInfo;
+   PostProcessingInfo postProcessingInfo;
+};
+
+struct IrtInfo
+{
+   std::string filename;
+   Vertex viewPos;
+   Vertex rotationAngles;
+   SceneInfo sceneInfo;
+   PostProcessingInfo postProcessingInfo;
+};
+
+// What the kernel is given for each iteration of a frame
+struct FrameInfo
+{
+   SceneInfo sceneInfo;
+   PostProcessingInfo postProcessingInfo;
+   Vertex cameraOrigin;
+   Vertex cameraTarget;
+   Vertex cameraAngles;
+};
+
+/*
+________________________________________________________________________________
+
+Kernel context
+
+A kernel and what is resident in it. Requests rendering with the same kernel
+share this state, so only one of them may use it at a time. Requests using
+different kernels have nothing in common.
+________________________________________________________________________________
+*/
+struct KernelContext
+{
+   GPUKernel*  kernel;
+   UseCase     usecase;
+   std::string sceneKey;   // Key of the scene resident in the kernel
+   ChartScene  chartScene; // Chart geometry, when a chart is resident
+   int         nbPrimitives;
+   int         nbBoxes;
+
+   KernelContext( GPUKernel* k )
+    : kernel(k), usecase(ucUndefined), sceneKey("undefined"), nbPrimitives(0), nbBoxes(0)
+   {
+   }
+};
+
+/*
+________________________________________________________________________________
+
+Render context
+
+Everything a request needs, from the parsing of its parameters to the
+encoding of its frame. It is created when the request comes in and handed
+down to the parse and render functions instead of process-wide globals.
+
+Parsing fills in the scene of the request (usecase, sceneKey and the info of
+that use case). The scene is only made resident when the scheduler runs the
+request, which then fills in the frame.
+
+Frames go either to a web server request, or to a listener for the frames of
+live streams, which are not answered through the web server.
+________________________________________________________________________________
+*/
+struct RenderContext
+{
+   Lacewing::Webserver::Request* request;  // Null for live streams
+   FrameListener* listener;                // Null for web requests
+   KernelContext& kernel;
+   RequestParams  params;
+   unsigned int   width;       // Image size
+   unsigned int   height;
+   int            iterations;  // Path tracing iterations
+   std::string    description; // Parameters of the request, for logs and stats
+
+   // Scene
+   UseCase        usecase;
+   std::string    sceneKey;
+   MoleculeInfo   molecule;
+   ChartInfo      chart;
+   IrtInfo        irt;
+
+   // Frame, set up when the scene is resident
+   FrameInfo      frame;
+
+   // One frame per pose (rotation angles, in radians) when specified.
+   // Batches send them back as a multipart response.
+   bool           batch;
+   std::vector<Vertex> poses;
+
+   // Interactive sessions: camera moved along its axis from the requested
+   // distance
+   float          dolly;
+
+   // Interactive sessions: last frame sent to the client, handed over to the
+   // readback stage with the frame. Owned by the context until then.
+   TileEncoder*   tiles;
+
+   // Stages of the request, when tracing. The context holds a reference.
+   RequestTrace*  trace;
+
+   RenderContext( Lacewing::Webserver::Request& r, KernelContext& k, const unsigned int w, const unsigned int h )
+    : request(&r), listener(nullptr), kernel(k), width(w), height(h), iterations(1), usecase(ucUndefined), batch(false), dolly(0.f), tiles(nullptr), trace(nullptr)
+   {
+   }
+
+   RenderContext( FrameListener& l, KernelContext& k, const unsigned int w, const unsigned int h )
+    : request(nullptr), listener(&l), kernel(k), width(w), height(h), iterations(1), usecase(ucUndefined), batch(false), dolly(0.f), tiles(nullptr), trace(nullptr)
+   {
+   }
+
+   ~RenderContext()
+   {
+      delete tiles;
+      if( trace ) trace->release();
+   }
+
+   // Copy of the request and its scene, without the tile encoder and the
+   // trace, which belong to this context only
+   RenderContext* clone() const { return new RenderContext( *this ); }
+
+private:
+   RenderContext( const RenderContext& other )
+    : request(other.request), listener(other.listener), kernel(other.kernel), params(other.params),
+      width(other.width), height(other.height), iterations(other.iterations), description(other.description),
+      usecase(other.usecase), sceneKey(other.sceneKey), molecule(other.molecule), chart(other.chart), irt(other.irt),
+      frame(other.frame), batch(other.batch), poses(other.poses), dolly(other.dolly), tiles(nullptr), trace(nullptr)
+   {
+   }
+   RenderContext& operator=( const RenderContext& );
+
+public:
+   int getNbFrames() const { return poses.empty() ? 1 : static_cast<int>(poses.size()); }
+
+   // Posted form value, live streams only have their query string
+   const char* getPostValue( const char* name ) const { return request ? request->POST(name) : nullptr; }
+
+   // Text sent back to web clients, with the frame or instead of it
+   void write( const char* text ) { if( request ) *request << text; }
+};
@@ -0,0 +1,299 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#include "RenderScheduler.h"
+#include "Metrics.h"
+#include "AsyncLog.h"
+
+#include <string.h>
+
+// Estimated costs, in pixels times iterations. A 512x512 preview with a few
+// iterations is interactive, full quality 4096x4096 renders are batch jobs.
+const double INTERACTIVE_COST = 512.0*512.0*16.0;
+const double STANDARD_COST    = 2048.0*2048.0*16.0;
+
+// Waiting jobs are promoted one class per period
+const DWORD AGING_PERIOD = 2000;
+
+RenderScheduler::RenderScheduler( Lacewing::Pump& pump, FrameReadback& readback, SceneSetup setup )
+ : _pump(pump), _readback(readback), _setup(setup), _posted(false), _renderTime(0)
+{
+   _running.ctx = nullptr;
+   memset( _stats, 0, sizeof(_stats) );
+}
+
+RenderScheduler::~RenderScheduler()
+{
+   for( int c(0); c<NB_PRIORITY_CLASSES; ++c )
+   {
+      for( size_t i(0); i<_queues[c].size(); ++i ) delete _queues[c][i].ctx;
+   }
+   delete _running.ctx;
+}
+
+RenderScheduler::PriorityClass RenderScheduler::getPriorityClass( const RenderContext& ctx )
+{
+   const double cost = static_cast<double>(ctx.width)*ctx.height*ctx.iterations*ctx.getNbFrames();
+   if( cost<=INTERACTIVE_COST ) return pcInteractive;
+   if( cost<=STANDARD_COST ) return pcStandard;
+   return pcBatch;
+}
+
+const char* RenderScheduler::getClassName( const int priorityClass )
+{
+   switch( priorityClass )
+   {
+   case pcInteractive: return "interactive";
+   case pcStandard:    return "standard";
+   default:            return "batch";
+   }
+}
+
+void RenderScheduler::submit( RenderContext* ctx )
+{
+   Job job;
+   job.ctx           = ctx;
+   job.priorityClass = getPriorityClass( *ctx );
+   job.arrival       = GetTickCount();
+   job.queued        = job.arrival;
+   job.waited        = 0;
+   job.started       = 0;
+   job.prepared      = false;
+   job.frame         = 0;
+   job.iteration     = 0;
+   _queues[job.priorityClass].push_back( job );
+   schedule();
+}
+
+void RenderScheduler::onDisconnect( Lacewing::Webserver::Request& request )
+{
+   remove( &request, nullptr );
+}
+
+void RenderScheduler::onDisconnect( FrameListener& listener )
+{
+   remove( nullptr, &listener );
+}
+
+void RenderScheduler::remove( const Lacewing::Webserver::Request* request, const FrameListener* listener )
+{
+   for( int c(0); c<NB_PRIORITY_CLASSES; ++c )
+   {
+      std::deque<Job>& queue = _queues[c];
+      for( std::deque<Job>::iterator it=queue.begin(); it!=queue.end(); )
+      {
+         if( it->ctx->request==request && it->ctx->listener==listener )
+         {
+            delete it->ctx;
+            it = queue.erase( it );
+         }
+         else ++it;
+      }
+   }
+   if( _running.ctx && _running.ctx->request==request && _running.ctx->listener==listener )
+   {
+      delete _running.ctx;
+      _running.ctx = nullptr;
+   }
+}
+
+int RenderScheduler::getQueueLength() const
+{
+   size_t length(0);
+   for( int c(0); c<NB_PRIORITY_CLASSES; ++c ) length += _queues[c].size();
+   return static_cast<int>(length);
+}
+
+int RenderScheduler::getEffectiveClass( const Job& job, const DWORD now ) const
+{
+   const int promotion = static_cast<int>((now-job.arrival)/AGING_PERIOD);
+   return (promotion>=job.priorityClass) ? 0 : job.priorityClass-promotion;
+}
+
+int RenderScheduler::getBestQueue( const DWORD now ) const
+{
+   // The front of a queue is its oldest job, hence the most promoted one.
+   // Equal classes go to the job that arrived first.
+   int best(-1);
+   int bestClass(0);
+   for( int c(0); c<NB_PRIORITY_CLASSES; ++c )
+   {
+      if( _queues[c].empty() ) continue;
+      const Job& job = _queues[c].front();
+      const int effective = getEffectiveClass( job, now );
+      if( best==-1 || effective<bestClass || 
+         (effective==bestClass && (now-job.arrival)>(now-_queues[best].front().arrival)) )
+      {
+         best = c;
+         bestClass = effective;
+      }
+   }
+   return best;
+}
+
+void RenderScheduler::start( const int queue, const DWORD now )
+{
+   _running = _queues[queue].front();
+   _queues[queue].pop_front();
+   _running.waited += now-_running.queued;
+   _running.started = now;
+   _running.prepared = false;
+   _running.iteration = 0;
+}
+
+void RenderScheduler::drop( Job& job )
+{
+   RenderContext* ctx = job.ctx;
+   job.ctx = nullptr;
+   if( ctx->request )
+   {
+      // Frames of a batch may still be encoding
+      _readback.onDisconnect( *ctx->request );
+      ctx->request->Finish();
+   }
+   else
+   {
+      ctx->listener->onFrameDropped();
+   }
+   delete ctx;
+}
+
+void RenderScheduler::schedule()
+{
+   if( _posted ) return;
+   if( !_running.ctx && getQueueLength()==0 ) return;
+   _posted = true;
+   _pump.Post( (void*)onStep, this );
+}
+
+void RenderScheduler::onStep( RenderScheduler* self )
+{
+   self->step();
+}
+
+void RenderScheduler::step()
+{
+   _posted = false;
+   const DWORD now = GetTickCount();
+
+   // Between two iterations, give way to a better job
+   const int best = getBestQueue( now );
+   if( best!=-1 )
+   {
+      if( !_running.ctx )
+      {
+         start( best, now );
+      }
+      else if( getEffectiveClass( _queues[best].front(), now )<getEffectiveClass( _running, now ) )
+      {
+         LOG_INFO(1, "Preempting " << getClassName(_running.priorityClass) << " job at iteration " << _running.iteration );
+         _stats[_running.priorityClass].nbPreempted++;
+         _running.queued = now;
+         _queues[_running.priorityClass].push_front( _running );
+         start( best, now );
+      }
+   }
+   if( !_running.ctx ) return;
+
+   RenderContext& ctx = *_running.ctx;
+   TraceScope scope( ctx.trace );
+   if( !_running.prepared )
+   {
+      // The kernel may have been used by other jobs since the request was
+      // parsed, or since this job was preempted
+      bool ready(false);
+      try
+      {
+         ready = _setup( ctx );
+      }
+      catch(...)
+      {
+         ctx.write( "An exception occured :-( Please try again" );
+      }
+      if( !ready )
+      {
+         drop( _running );
+         schedule();
+         return;
+      }
+      _running.prepared = true;
+      ctx.frame.cameraOrigin.z += ctx.dolly;
+      ctx.frame.cameraTarget.z += ctx.dolly;
+   }
+
+   GPUKernel* kernel = ctx.kernel.kernel;
+   FrameInfo& frame = ctx.frame;
+   if( !ctx.poses.empty() && _running.iteration==0 ) frame.cameraAngles = ctx.poses[_running.frame];
+   frame.sceneInfo.pathTracingIteration.x = _running.iteration;
+   kernel->setPostProcessingInfo( frame.postProcessingInfo );
+   kernel->setSceneInfo( frame.sceneInfo );
+   kernel->setCamera( frame.cameraOrigin, frame.cameraTarget, frame.cameraAngles );
+   {
+      StageTimer timer( msRender );
+      kernel->render_begin(0.f);
+      kernel->render_end();
+   }
+
+   if( ++_running.iteration<frame.sceneInfo.maxPathTracingIterations.x )
+   {
+      schedule();
+      return;
+   }
+
+   // Frame is complete, the readback stage finishes the request
+   if( ctx.batch )
+   {
+      _readback.readbackPart( *kernel, *ctx.request, frame.sceneInfo, _running.frame, ctx.getNbFrames() );
+      _running.iteration = 0;
+      if( ++_running.frame<ctx.getNbFrames() )
+      {
+         // Next pose, the scene stays as it is
+         schedule();
+         return;
+      }
+   }
+   else if( ctx.listener )
+   {
+      _readback.readback( *kernel, *ctx.listener, frame.sceneInfo, ctx.tiles );
+      ctx.tiles = nullptr;
+   }
+   else
+   {
+      _readback.readback( *kernel, *ctx.request, frame.sceneInfo );
+   }
+
+   ClassStats& stats = _stats[_running.priorityClass];
+   stats.nbJobs++;
+   stats.totalWait += _running.waited;
+   if( _running.waited>stats.maxWait ) stats.maxWait = _running.waited;
+
+   // Time of the run that completed, restarts are accounted as waiting
+   const DWORD renderTime = GetTickCount()-_running.started;
+   _renderTime = _renderTime ? (_renderTime*7+renderTime)/8 : renderTime;
+
+   delete _running.ctx;
+   _running.ctx = nullptr;
+
+   schedule();
+}
@@ -0,0 +1,145 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#pragma once
+
+#include <windows.h>
+#include <lacewing.h>
+
+#include <deque>
+
+#include "RenderContext.h"
+#include "FrameReadback.h"
+
+/*
+________________________________________________________________________________
+
+Render scheduler
+
+Requests are not rendered in arrival order. Each one gets a priority class
+from its estimated cost (image size times path tracing iterations) and waits
+in the queue of that class, cheaper classes being served first.
+
+Frames are rendered one iteration at a time from the event pump, so requests
+keep coming in while a long render is in progress. Between two iterations,
+the running job gives way to any waiting job of a better class. The kernel
+only holds one frame, so a preempted job starts its frame over when it
+resumes.
+
+A batch job renders its poses back to back, the scene being set up once.
+When preempted, it only loses the frame in progress.
+
+Jobs are promoted one class for every AGING_PERIOD milliseconds since they
+arrived, and a job only gives way to a strictly better one. A job that waited
+long enough is in the first class and can no longer be overtaken.
+________________________________________________________________________________
+*/
+class RenderScheduler
+{
+public:
+   enum PriorityClass
+   {
+      pcInteractive = 0,
+      pcStandard    = 1,
+      pcBatch       = 2,
+      NB_PRIORITY_CLASSES
+   };
+
+   struct ClassStats
+   {
+      int   nbJobs;      // Frames delivered
+      int   nbPreempted; // Times a job of the class gave way
+      DWORD totalWait;   // Milliseconds spent in the queue
+      DWORD maxWait;
+   };
+
+   // Makes the scene of a request resident and sets up its frame. Returns
+   // false if the request can no longer be rendered.
+   typedef bool (*SceneSetup)( RenderContext& ctx );
+
+public:
+   RenderScheduler( Lacewing::Pump& pump, FrameReadback& readback, SceneSetup setup );
+   ~RenderScheduler();
+
+   // Queues a parsed request. The scheduler owns the context from now on
+   // and finishes the request.
+   void submit( RenderContext* ctx );
+
+   // Drops the job of a client that went away
+   void onDisconnect( Lacewing::Webserver::Request& request );
+   void onDisconnect( FrameListener& listener );
+
+   static PriorityClass getPriorityClass( const RenderContext& ctx );
+   static const char* getClassName( const int priorityClass );
+
+   const ClassStats& getStats( const int priorityClass ) const { return _stats[priorityClass]; }
+
+   // Jobs waiting for the kernel
+   int getQueueLength() const;
+
+   // True while a frame is being rendered
+   bool isBusy() const { return _running.ctx!=nullptr; }
+
+   // Moving average of the time taken by the last frames, in milliseconds
+   DWORD getAverageRenderTime() const { return _renderTime; }
+
+private:
+   struct Job
+   {
+      RenderContext* ctx;
+      int   priorityClass;
+      DWORD arrival;
+      DWORD queued;    // Last time the job entered a queue
+      DWORD waited;    // Time spent in queues so far
+      DWORD started;   // Start of the current run of the job
+      bool  prepared;  // Scene set up since the job got the kernel
+      int   frame;     // Frame of a batch
+      int   iteration; // Next iteration of the frame
+   };
+
+   int  getEffectiveClass( const Job& job, const DWORD now ) const;
+
+   // Queue holding the best waiting job, -1 if none
+   int  getBestQueue( const DWORD now ) const;
+
+   void remove( const Lacewing::Webserver::Request* request, const FrameListener* listener );
+   void start( const int queue, const DWORD now );
+   void drop( Job& job );
+   void schedule();
+   void step();
+
+   static void onStep( RenderScheduler* self );
+
+private:
+   Lacewing::Pump& _pump;
+   FrameReadback&  _readback;
+   SceneSetup      _setup;
+
+   std::deque<Job> _queues[NB_PRIORITY_CLASSES];
+   Job  _running; // ctx is null when the kernel is idle
+   bool _posted;  // A step is waiting in the event pump
+   DWORD _renderTime;
+
+   ClassStats _stats[NB_PRIORITY_CLASSES];
+};
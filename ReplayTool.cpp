@@ -0,0 +1,242 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "RequestCapture.h"
+
+#include <windows.h>
+#include <wininet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+#pragma comment(lib, "wininet.lib")
+
+/*
+________________________________________________________________________________
+
+Replay load generator
+
+Drives a running server with the gets of a capture (--capture), at their
+original pace, at a multiple of it, or as fast as the workers can go. Reports
+the throughput, the latency percentiles and the cache hit rates, the latter
+read from the server's /metrics before and after the run.
+
+When paced, latencies are measured from the time a request was due rather
+than sent, so that a server falling behind is not hidden by workers that
+were all busy.
+
+Usage: IMVWebServer --replay capture.bin [--rate original|max|<factor>]
+                    [--server localhost:10000] [--workers 32]
+________________________________________________________________________________
+*/
+
+struct ReplayJob
+{
+   const RequestCapture::Record* record;
+   double latency; // Milliseconds
+   bool   ok;
+};
+
+struct Replay
+{
+   std::vector<ReplayJob> jobs;
+   volatile LONG next;
+   std::string   server;
+   HINTERNET     internet;
+   LONGLONG      start;
+   LONGLONG      frequency;
+   double        rate;     // Speed factor, 0 for as fast as possible
+};
+
+// Caches reported by /metrics
+const int NB_REPLAY_CACHES = 3;
+
+struct CacheCounters
+{
+   double hits[NB_REPLAY_CACHES];
+   double misses[NB_REPLAY_CACHES];
+};
+
+static const char* gCacheNames[NB_REPLAY_CACHES] = { "scene", "pdb", "molecule" };
+
+static LONGLONG getTicks()
+{
+   LARGE_INTEGER ticks;
+   QueryPerformanceCounter( &ticks );
+   return ticks.QuadPart;
+}
+
+static bool fetch( HINTERNET internet, const std::string& url, std::string* body )
+{
+   HINTERNET handle = InternetOpenUrl( internet, url.c_str(), NULL, 0, INTERNET_FLAG_RELOAD|INTERNET_FLAG_NO_CACHE_WRITE, 0 );
+   if( !handle ) return false;
+
+   DWORD status(0);
+   DWORD size(sizeof(status));
+   HttpQueryInfo( handle, HTTP_QUERY_STATUS_CODE|HTTP_QUERY_FLAG_NUMBER, &status, &size, NULL );
+   char buffer[16384];
+   DWORD read(0);
+   while( InternetReadFile( handle, buffer, sizeof(buffer), &read ) && read!=0 )
+   {
+      if( body ) body->append( buffer, read );
+   }
+   InternetCloseHandle( handle );
+   return status==200;
+}
+
+static DWORD WINAPI replayWorker( LPVOID param )
+{
+   Replay& replay = *static_cast<Replay*>(param);
+   while( true )
+   {
+      const LONG index = InterlockedIncrement( &replay.next )-1;
+      if( index>=static_cast<LONG>(replay.jobs.size()) ) break;
+      ReplayJob& job = replay.jobs[index];
+
+      LONGLONG begin = getTicks();
+      if( replay.rate>0.0 )
+      {
+         const LONGLONG due = replay.start+static_cast<LONGLONG>(job.record->time/replay.rate*replay.frequency/1000.0);
+         if( due>begin ) Sleep( static_cast<DWORD>((due-begin)*1000/replay.frequency) );
+         begin = due;
+      }
+      std::string url = "http://"+replay.server+"/"+job.record->url+"?"+job.record->query;
+      job.ok = fetch( replay.internet, url, nullptr );
+      job.latency = (getTicks()-begin)*1000.0/replay.frequency;
+   }
+   return 0;
+}
+
+static bool readCacheCounters( HINTERNET internet, const std::string& server, CacheCounters& counters )
+{
+   std::string metrics;
+   if( !fetch( internet, "http://"+server+"/metrics", &metrics ) ) return false;
+   for( int c(0); c<NB_REPLAY_CACHES; ++c )
+   {
+      for( int r(0); r<2; ++r )
+      {
+         char name[128];
+         sprintf( name, "imv_cache_requests_total{cache=\"%s\",result=\"%s\"} ", gCacheNames[c], r ? "miss" : "hit" );
+         const size_t position = metrics.find( name );
+         double& value = r ? counters.misses[c] : counters.hits[c];
+         value = (position==std::string::npos) ? 0.0 : atof( metrics.c_str()+position+strlen(name) );
+      }
+   }
+   return true;
+}
+
+static double percentile( const std::vector<double>& sorted, const double q )
+{
+   if( sorted.empty() ) return 0.0;
+   size_t index = static_cast<size_t>(q*sorted.size());
+   return sorted[(index<sorted.size()) ? index : sorted.size()-1];
+}
+
+int runReplay( int argc, char* argv[] )
+{
+   const char* captureFile = argv[2];
+   Replay replay;
+   replay.server = "localhost:10000";
+   replay.rate = 1.0;
+   replay.next = 0;
+   int nbWorkers(32);
+   for( int i(3); i+1<argc; i+=2 )
+   {
+      if( strcmp(argv[i],"--rate")==0 )
+      {
+         replay.rate = (strcmp(argv[i+1],"max")==0) ? 0.0 : (strcmp(argv[i+1],"original")==0) ? 1.0 : atof(argv[i+1]);
+      }
+      else if( strcmp(argv[i],"--server")==0 ) replay.server = argv[i+1];
+      else if( strcmp(argv[i],"--workers")==0 ) nbWorkers = atoi(argv[i+1]);
+   }
+   if( nbWorkers<1 ) nbWorkers = 1;
+
+   std::vector<RequestCapture::Record> records;
+   if( !RequestCapture::load( captureFile, records ) || records.empty() )
+   {
+      std::cout << "No request found in " << captureFile << std::endl;
+      return 1;
+   }
+   replay.jobs.resize( records.size() );
+   for( size_t i(0); i<records.size(); ++i )
+   {
+      replay.jobs[i].record  = &records[i];
+      replay.jobs[i].latency = 0.0;
+      replay.jobs[i].ok      = false;
+   }
+
+   // WinINet allows 2 connections per server by default
+   DWORD connections = static_cast<DWORD>(nbWorkers);
+   InternetSetOption( NULL, INTERNET_OPTION_MAX_CONNS_PER_SERVER, &connections, sizeof(connections) );
+   InternetSetOption( NULL, INTERNET_OPTION_MAX_CONNS_PER_1_0_SERVER, &connections, sizeof(connections) );
+   replay.internet = InternetOpen( "IMVReplay", INTERNET_OPEN_TYPE_DIRECT, NULL, NULL, 0 );
+
+   CacheCounters before, after;
+   const bool counters = readCacheCounters( replay.internet, replay.server, before );
+
+   LARGE_INTEGER frequency;
+   QueryPerformanceFrequency( &frequency );
+   replay.frequency = frequency.QuadPart;
+   replay.start = getTicks();
+   std::vector<HANDLE> workers;
+   for( int i(0); i<nbWorkers; ++i )
+   {
+      workers.push_back( CreateThread( NULL, 0, replayWorker, &replay, 0, NULL ) );
+   }
+   for( size_t i(0); i<workers.size(); ++i )
+   {
+      WaitForSingleObject( workers[i], INFINITE );
+      CloseHandle( workers[i] );
+   }
+   const double elapsed = static_cast<double>(getTicks()-replay.start)/replay.frequency;
+
+   std::vector<double> latencies;
+   for( size_t i(0); i<replay.jobs.size(); ++i )
+   {
+      if( replay.jobs[i].ok ) latencies.push_back( replay.jobs[i].latency );
+   }
+   std::sort( latencies.begin(), latencies.end() );
+
+   std::cout << replay.jobs.size() << " requests, " << (replay.jobs.size()-latencies.size()) << " failed, "
+      << elapsed << " s, " << latencies.size()/elapsed << " requests/s" << std::endl;
+   std::cout << "latency p50 " << percentile( latencies, 0.5 ) << " ms, p99 " << percentile( latencies, 0.99 )
+      << " ms, p999 " << percentile( latencies, 0.999 ) << " ms" << std::endl;
+   if( counters && readCacheCounters( replay.internet, replay.server, after ) )
+   {
+      for( int c(0); c<NB_REPLAY_CACHES; ++c )
+      {
+         const double hits = after.hits[c]-before.hits[c];
+         const double total = hits+after.misses[c]-before.misses[c];
+         std::cout << gCacheNames[c] << " cache: " << (total>0.0 ? 100.0*hits/total : 0.0) << "% hits of " << total << std::endl;
+      }
+   }
+   InternetCloseHandle( replay.internet );
+   return 0;
+}
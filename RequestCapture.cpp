@@ -0,0 +1,164 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "RequestCapture.h"
+
+#include <string.h>
+
+#define CAPTURE_MAGIC "IMVCAP1"
+
+// Time between two writes of the pending records
+const DWORD CAPTURE_WRITE_PERIOD = 200;
+
+static void appendEncoded( std::string& out, const char* text )
+{
+   static const char* HEX = "0123456789ABCDEF";
+   for( const char* c(text); c && *c; ++c )
+   {
+      const unsigned char u = static_cast<unsigned char>(*c);
+      if( (u>='a' && u<='z') || (u>='A' && u<='Z') || (u>='0' && u<='9') ||
+          u=='-' || u=='_' || u=='.' || u=='~' || u==',' )
+      {
+         out += *c;
+      }
+      else
+      {
+         out += '%';
+         out += HEX[u>>4];
+         out += HEX[u&15];
+      }
+   }
+}
+
+RequestCapture::RequestCapture()
+ : _file(nullptr), _start(0), _nbRecords(0), _thread(NULL), _stop(NULL)
+{
+   InitializeCriticalSection( &_lock );
+}
+
+RequestCapture::~RequestCapture()
+{
+   if( _thread )
+   {
+      SetEvent( _stop );
+      WaitForSingleObject( _thread, INFINITE );
+      CloseHandle( _thread );
+      CloseHandle( _stop );
+   }
+   flush();
+   if( _file ) fclose( _file );
+   DeleteCriticalSection( &_lock );
+}
+
+bool RequestCapture::open( const char* fileName )
+{
+   _file = fopen( fileName, "wb" );
+   if( !_file ) return false;
+   fwrite( CAPTURE_MAGIC, 1, sizeof(CAPTURE_MAGIC), _file );
+   _start = GetTickCount();
+   _stop = CreateEvent( NULL, TRUE, FALSE, NULL );
+   _thread = CreateThread( NULL, 0, writerThread, this, 0, NULL );
+   return true;
+}
+
+void RequestCapture::record( Lacewing::Webserver::Request& request )
+{
+   if( !_file ) return;
+
+   _query.clear();
+   for( Lacewing::Webserver::Request::Parameter* p = request.GET(); p; p = p->Next() )
+   {
+      if( !_query.empty() ) _query += '&';
+      appendEncoded( _query, p->Name() );
+      _query += '=';
+      appendEncoded( _query, p->Value() );
+   }
+   const char* url = request.URL();
+   size_t urlLength = strlen(url);
+   if( urlLength>255 ) urlLength = 255;
+   const size_t queryLength = (_query.length()<65535) ? _query.length() : 65535;
+   const DWORD time = GetTickCount()-_start;
+
+   unsigned char header[7];
+   for( int i(0); i<4; ++i ) header[i] = static_cast<unsigned char>((time>>(i*8))&0xFF);
+   header[4] = static_cast<unsigned char>(urlLength);
+   header[5] = static_cast<unsigned char>(queryLength&0xFF);
+   header[6] = static_cast<unsigned char>(queryLength>>8);
+
+   EnterCriticalSection( &_lock );
+   _pending.append( reinterpret_cast<const char*>(header), sizeof(header) );
+   _pending.append( url, urlLength );
+   _pending.append( _query, 0, queryLength );
+   LeaveCriticalSection( &_lock );
+   _nbRecords++;
+}
+
+void RequestCapture::flush()
+{
+   EnterCriticalSection( &_lock );
+   _writing.swap( _pending );
+   LeaveCriticalSection( &_lock );
+   if( !_writing.empty() && _file )
+   {
+      fwrite( _writing.data(), 1, _writing.size(), _file );
+      fflush( _file );
+   }
+   _writing.clear();
+}
+
+DWORD WINAPI RequestCapture::writerThread( LPVOID param )
+{
+   RequestCapture* self = static_cast<RequestCapture*>(param);
+   while( WaitForSingleObject( self->_stop, CAPTURE_WRITE_PERIOD )==WAIT_TIMEOUT )
+   {
+      self->flush();
+   }
+   return 0;
+}
+
+bool RequestCapture::load( const char* fileName, std::vector<Record>& records )
+{
+   FILE* file = fopen( fileName, "rb" );
+   if( !file ) return false;
+
+   char magic[sizeof(CAPTURE_MAGIC)];
+   bool valid = fread( magic, 1, sizeof(magic), file )==sizeof(magic) && memcmp( magic, CAPTURE_MAGIC, sizeof(magic) )==0;
+   unsigned char header[7];
+   while( valid && fread( header, 1, sizeof(header), file )==sizeof(header) )
+   {
+      Record record;
+      record.time = header[0]|(header[1]<<8)|(header[2]<<16)|(static_cast<DWORD>(header[3])<<24);
+      const size_t urlLength = header[4];
+      const size_t queryLength = header[5]|(header[6]<<8);
+      std::vector<char> text( urlLength+queryLength+1 );
+      if( fread( &text[0], 1, urlLength+queryLength, file )!=urlLength+queryLength ) break;
+      record.url.assign( &text[0], urlLength );
+      record.query.assign( &text[urlLength], queryLength );
+      records.push_back( record );
+   }
+   fclose( file );
+   return valid;
+}
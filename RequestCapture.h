@@ -0,0 +1,86 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#pragma once
+
+#include <windows.h>
+#include <lacewing.h>
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/*
+________________________________________________________________________________
+
+Request capture
+
+Records the incoming gets to a compact binary log, for the replay tool:
+
+   8 bytes   "IMVCAP1" and a null
+   records   4 bytes  milliseconds since the capture started
+             1 byte   length of the URL (get, batch, ...)
+             2 bytes  length of the query string
+             URL and query string (name=value&..., values percent encoded)
+
+All integers are little endian. Records are appended to a memory buffer on
+the event loop thread. A background thread writes that buffer to disk, so
+capturing never waits for the disk.
+________________________________________________________________________________
+*/
+class RequestCapture
+{
+public:
+   RequestCapture();
+   ~RequestCapture();
+
+   bool open( const char* fileName );
+   void record( Lacewing::Webserver::Request& request );
+
+   int getNbRecords() const { return _nbRecords; }
+
+   // Reads a capture, the records hold the URL and the query string
+   struct Record
+   {
+      DWORD       time;
+      std::string url;
+      std::string query;
+   };
+   static bool load( const char* fileName, std::vector<Record>& records );
+
+private:
+   static DWORD WINAPI writerThread( LPVOID param );
+   void flush();
+
+private:
+   FILE*            _file;
+   DWORD            _start;
+   int              _nbRecords;
+   std::string      _query;   // Reused to build query strings
+   std::string      _pending; // Records not written yet, under _lock
+   std::string      _writing;
+   CRITICAL_SECTION _lock;
+   HANDLE           _thread;
+   HANDLE           _stop;
+};
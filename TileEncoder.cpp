@@ -0,0 +1,177 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#include "TileEncoder.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+extern bool jo_write_jpg_to_memory(std::vector<unsigned char> &out, const void *data, int width, int height, int comp, int quality);
+
+// Frames are RGB
+const int TILE_DEPTH = 3;
+
+// Tiles per row of the packed image
+const int ATLAS_COLUMNS = 32;
+
+// Average difference per channel above which a tile is sent again
+const int TILE_THRESHOLD = 3;
+
+enum TileMessageType
+{
+   tmFullFrame = 0,
+   tmTiles     = 1
+};
+
+TileEncoder::TileEncoder()
+ : _width(0), _height(0), _nbTiles(0), _nbSent(0)
+{
+}
+
+bool TileEncoder::isChanged( const unsigned char* pixels, const int column, const int row ) const
+{
+   const int x0 = column*TILE_SIZE;
+   const int y0 = row*TILE_SIZE;
+   const int x1 = (x0+TILE_SIZE<_width) ? x0+TILE_SIZE : _width;
+   const int y1 = (y0+TILE_SIZE<_height) ? y0+TILE_SIZE : _height;
+   const int limit = TILE_THRESHOLD*(x1-x0)*(y1-y0)*TILE_DEPTH;
+
+   int difference(0);
+   for( int y(y0); y<y1; ++y )
+   {
+      const size_t offset = (static_cast<size_t>(y)*_width+x0)*TILE_DEPTH;
+      const unsigned char* a = pixels+offset;
+      const unsigned char* b = &_reference[offset];
+      for( int i(0); i<(x1-x0)*TILE_DEPTH; ++i )
+      {
+         difference += abs( static_cast<int>(a[i])-static_cast<int>(b[i]) );
+      }
+      if( difference>limit ) return true;
+   }
+   return false;
+}
+
+void TileEncoder::copyTile( const unsigned char* pixels, const int column, const int row, const int index )
+{
+   const int x0 = column*TILE_SIZE;
+   const int y0 = row*TILE_SIZE;
+   const int width = (x0+TILE_SIZE<_width) ? TILE_SIZE : _width-x0;
+   const int height = (y0+TILE_SIZE<_height) ? TILE_SIZE : _height-y0;
+   const int atlasWidth = ATLAS_COLUMNS*TILE_SIZE;
+   const int ax = (index%ATLAS_COLUMNS)*TILE_SIZE;
+   const int ay = (index/ATLAS_COLUMNS)*TILE_SIZE;
+
+   for( int y(0); y<height; ++y )
+   {
+      const size_t offset = (static_cast<size_t>(y0+y)*_width+x0)*TILE_DEPTH;
+      memcpy( &_atlas[(static_cast<size_t>(ay+y)*atlasWidth+ax)*TILE_DEPTH], pixels+offset, width*TILE_DEPTH );
+      memcpy( &_reference[offset], pixels+offset, width*TILE_DEPTH );
+   }
+}
+
+void TileEncoder::appendJpeg( const unsigned char* pixels, const int width, const int height, std::string& message )
+{
+   std::vector<unsigned char> jpeg;
+   jo_write_jpg_to_memory( jpeg, pixels, width, height, TILE_DEPTH, 100 );
+   if( !jpeg.empty() ) message.append( reinterpret_cast<const char*>(&jpeg[0]), jpeg.size() );
+}
+
+void TileEncoder::encodeFull( const unsigned char* pixels, std::string& message )
+{
+   _reference.assign( pixels, pixels+static_cast<size_t>(_width)*_height*TILE_DEPTH );
+   _nbSent = _nbTiles;
+
+   const char header[4] = { tmFullFrame, TILE_SIZE, 0, 0 };
+   message.assign( header, sizeof(header) );
+   appendJpeg( pixels, _width, _height, message );
+}
+
+void TileEncoder::encode( const unsigned char* pixels, const int width, const int height, std::string& message )
+{
+   const int columns = (width+TILE_SIZE-1)/TILE_SIZE;
+   const int rows = (height+TILE_SIZE-1)/TILE_SIZE;
+   message.clear();
+
+   if( width!=_width || height!=_height || _reference.empty() )
+   {
+      _width   = width;
+      _height  = height;
+      _nbTiles = columns*rows;
+      encodeFull( pixels, message );
+      return;
+   }
+
+   _changed.clear();
+   for( int row(0); row<rows; ++row )
+   {
+      for( int column(0); column<columns; ++column )
+      {
+         if( isChanged( pixels, column, row ) )
+         {
+            _changed.push_back( static_cast<unsigned short>(column) );
+            _changed.push_back( static_cast<unsigned short>(row) );
+         }
+      }
+   }
+
+   const int nbChanged = static_cast<int>(_changed.size()/2);
+   _nbSent = nbChanged;
+   if( nbChanged==0 ) return;
+
+   // Past half of the frame, one JPEG of the whole frame is cheaper
+   if( nbChanged*2>_nbTiles )
+   {
+      encodeFull( pixels, message );
+      return;
+   }
+
+   const int atlasColumns = (nbChanged<ATLAS_COLUMNS) ? nbChanged : ATLAS_COLUMNS;
+   const int atlasRows = (nbChanged+ATLAS_COLUMNS-1)/ATLAS_COLUMNS;
+   _atlas.assign( static_cast<size_t>(ATLAS_COLUMNS*TILE_SIZE)*atlasRows*TILE_SIZE*TILE_DEPTH, 0 );
+   for( int i(0); i<nbChanged; ++i )
+   {
+      copyTile( pixels, _changed[i*2], _changed[i*2+1], i );
+   }
+   if( atlasColumns<ATLAS_COLUMNS )
+   {
+      // Single partial row, drop the unused part of it
+      const size_t rowSize = static_cast<size_t>(atlasColumns)*TILE_SIZE*TILE_DEPTH;
+      for( int y(1); y<TILE_SIZE; ++y )
+      {
+         memmove( &_atlas[y*rowSize], &_atlas[y*ATLAS_COLUMNS*TILE_SIZE*TILE_DEPTH], rowSize );
+      }
+   }
+
+   message.reserve( 4+_changed.size()*2 );
+   message += static_cast<char>(tmTiles);
+   message += static_cast<char>(TILE_SIZE);
+   message += static_cast<char>(nbChanged&0xFF);
+   message += static_cast<char>((nbChanged>>8)&0xFF);
+   for( size_t i(0); i<_changed.size(); ++i )
+   {
+      message += static_cast<char>(_changed[i]&0xFF);
+      message += static_cast<char>((_changed[i]>>8)&0xFF);
+   }
+   appendJpeg( &_atlas[0], atlasColumns*TILE_SIZE, atlasRows*TILE_SIZE, message );
+}
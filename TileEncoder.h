@@ -0,0 +1,90 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+________________________________________________________________________________
+
+Tile delta encoder
+
+Keeps the last frame sent to an interactive session and, for each new frame,
+only sends the 16x16 tiles that changed. The changed tiles are packed side by
+side into one image (32 tiles per row), JPEG encoded once, and preceded by
+their positions:
+
+   byte 0    0: full frame, 1: tiles
+   byte 1    tile size
+   bytes 2-3 number of tiles n
+   n times   column, row of the tile (16 bit words)
+   JPEG      whole frame, or tile i at ((i%32)*16, (i/32)*16)
+
+All words are little endian. The first frame, a frame of another size or a
+frame where most tiles changed are sent whole. Path tracing noise is not a
+change: a tile is only sent when its pixels moved away from the ones the
+client has by more than a small average difference.
+
+Encoding runs on the readback thread. The encoder belongs to the session and
+travels with its single frame in flight, so it is never used by two threads
+at once.
+________________________________________________________________________________
+*/
+class TileEncoder
+{
+public:
+   static const int TILE_SIZE = 16;
+
+public:
+   TileEncoder();
+
+   // Encodes an RGB frame as a message for the client. The message is empty
+   // when no tile changed.
+   void encode( const unsigned char* pixels, const int width, const int height, std::string& message );
+
+   // Tiles of the last frame, and how many of them were sent
+   int getNbTiles() const { return _nbTiles; }
+   int getNbSent() const { return _nbSent; }
+
+private:
+   bool isChanged( const unsigned char* pixels, const int column, const int row ) const;
+   void copyTile( const unsigned char* pixels, const int column, const int row, const int index );
+   void encodeFull( const unsigned char* pixels, std::string& message );
+   void appendJpeg( const unsigned char* pixels, const int width, const int height, std::string& message );
+
+private:
+   int _width;
+   int _height;
+   int _nbTiles;
+   int _nbSent;
+
+   // What the client has on screen
+   std::vector<unsigned char> _reference;
+
+   // Changed tiles of the frame being encoded (column, row) and their pixels
+   std::vector<unsigned short> _changed;
+   std::vector<unsigned char>  _atlas;
+};
@@ -0,0 +1,190 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "Tracer.h"
+#include "Metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <set>
+
+// Threads with a name, written as metadata the first time they show up
+const int MAX_NAMED_THREADS = 8;
+
+struct NamedThread
+{
+   DWORD id;
+   char  name[32];
+};
+
+// Only touched under gTraceLock, except for the names which are set at
+// thread startup
+static bool             gTraceInitialized = false;
+static CRITICAL_SECTION gTraceLock;
+static FILE*            gTraceFile = nullptr;
+static std::string      gTraceFileName;
+static DWORD            gTraceThreshold = 0;
+static std::set<DWORD>  gTracedThreads;
+static NamedThread      gThreadNames[MAX_NAMED_THREADS];
+static volatile LONG    gNbThreadNames = 0;
+
+static __declspec(thread) RequestTrace* gCurrentTrace = nullptr;
+
+bool Tracer::_enabled = false;
+
+// ----------------------------------------------------------------------
+// Request trace
+// ----------------------------------------------------------------------
+RequestTrace::RequestTrace()
+ : _references(1), _thread(GetCurrentThreadId()), _start(Metrics::getTicks())
+{
+   InitializeCriticalSection( &_lock );
+}
+
+RequestTrace::~RequestTrace()
+{
+   DeleteCriticalSection( &_lock );
+}
+
+void RequestTrace::acquire()
+{
+   InterlockedIncrement( &_references );
+}
+
+void RequestTrace::release()
+{
+   if( InterlockedDecrement( &_references )!=0 ) return;
+   Tracer::write( *this, Metrics::getTicks() );
+   delete this;
+}
+
+void RequestTrace::setDescription( const std::string& description )
+{
+   EnterCriticalSection( &_lock );
+   _description = description;
+   LeaveCriticalSection( &_lock );
+}
+
+void RequestTrace::addEvent( const char* name, const LONGLONG start, const LONGLONG end )
+{
+   Event event;
+   event.name   = name;
+   event.thread = GetCurrentThreadId();
+   event.start  = start;
+   event.end    = end;
+   EnterCriticalSection( &_lock );
+   _events.push_back( event );
+   LeaveCriticalSection( &_lock );
+}
+
+// ----------------------------------------------------------------------
+// Tracer
+// ----------------------------------------------------------------------
+void Tracer::configure( const char* fileName, const DWORD threshold )
+{
+   if( !gTraceInitialized )
+   {
+      InitializeCriticalSection( &gTraceLock );
+      gTraceInitialized = true;
+   }
+   gTraceFileName  = fileName;
+   gTraceThreshold = threshold;
+   _enabled = true;
+}
+
+void Tracer::setThreadName( const char* name )
+{
+   const LONG index = InterlockedIncrement( &gNbThreadNames )-1;
+   if( index>=MAX_NAMED_THREADS ) return;
+   strncpy( gThreadNames[index].name, name, sizeof(gThreadNames[index].name)-1 );
+   gThreadNames[index].name[sizeof(gThreadNames[index].name)-1] = 0;
+   gThreadNames[index].id = GetCurrentThreadId();
+}
+
+RequestTrace* Tracer::getCurrent()
+{
+   return gCurrentTrace;
+}
+
+void Tracer::setCurrent( RequestTrace* trace )
+{
+   gCurrentTrace = trace;
+}
+
+// JSON string content, descriptions come from query strings
+static void writeEscaped( FILE* file, const std::string& text )
+{
+   for( size_t i(0); i<text.size(); ++i )
+   {
+      const unsigned char c = static_cast<unsigned char>(text[i]);
+      if( c=='"' || c=='\\' ) fprintf( file, "\\%c", c );
+      else if( c<0x20 ) fprintf( file, "\\u%04x", c );
+      else fputc( c, file );
+   }
+}
+
+void Tracer::write( const RequestTrace& trace, const LONGLONG end )
+{
+   const LONGLONG duration = Metrics::getMicroseconds( end-trace._start );
+   if( !_enabled || duration<static_cast<LONGLONG>(gTraceThreshold)*1000 ) return;
+
+   EnterCriticalSection( &gTraceLock );
+   if( !gTraceFile )
+   {
+      // JSON array format, the closing bracket is optional
+      gTraceFile = fopen( gTraceFileName.c_str(), "w" );
+      if( gTraceFile ) fputs( "[\n", gTraceFile );
+   }
+   if( gTraceFile )
+   {
+      const int nbNames = (gNbThreadNames<MAX_NAMED_THREADS) ? gNbThreadNames : MAX_NAMED_THREADS;
+      for( size_t i(0); i<=trace._events.size(); ++i )
+      {
+         const DWORD thread = (i<trace._events.size()) ? trace._events[i].thread : trace._thread;
+         if( !gTracedThreads.insert( thread ).second ) continue;
+         for( int n(0); n<nbNames; ++n )
+         {
+            if( gThreadNames[n].id!=thread ) continue;
+            fprintf( gTraceFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"%s\"}},\n",
+               thread, gThreadNames[n].name );
+         }
+      }
+
+      // The whole request, then its stages
+      fprintf( gTraceFile, "{\"name\":\"" );
+      writeEscaped( gTraceFile, trace._description.empty() ? std::string("request") : trace._description );
+      fprintf( gTraceFile, "\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%lld,\"dur\":%lld},\n",
+         trace._thread, Metrics::getMicroseconds( trace._start ), duration );
+      for( size_t i(0); i<trace._events.size(); ++i )
+      {
+         const RequestTrace::Event& event = trace._events[i];
+         fprintf( gTraceFile, "{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%lld,\"dur\":%lld},\n",
+            event.name, event.thread, Metrics::getMicroseconds( event.start ), Metrics::getMicroseconds( event.end-event.start ) );
+      }
+      fflush( gTraceFile );
+   }
+   LeaveCriticalSection( &gTraceLock );
+}
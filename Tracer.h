@@ -0,0 +1,123 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#pragma once
+
+#include <windows.h>
+
+#include <string>
+#include <vector>
+
+/*
+________________________________________________________________________________
+
+Request trace
+
+Stages timed for one request, on whatever thread they ran. The trace is
+shared by the render context, the readback slots and the encoded frames of
+the request, each holding a reference. The last release completes the trace,
+which is then written out if the request was slow enough.
+________________________________________________________________________________
+*/
+class RequestTrace
+{
+public:
+   RequestTrace();
+
+   void acquire();
+   void release();
+
+   void setDescription( const std::string& description );
+
+   // Times are Metrics ticks
+   void addEvent( const char* name, const LONGLONG start, const LONGLONG end );
+
+private:
+   friend class Tracer;
+
+   struct Event
+   {
+      const char* name; // Stage names are literals
+      DWORD       thread;
+      LONGLONG    start;
+      LONGLONG    end;
+   };
+
+   ~RequestTrace();
+
+private:
+   volatile LONG      _references;
+   CRITICAL_SECTION   _lock;
+   std::vector<Event> _events;
+   std::string        _description;
+   DWORD              _thread;
+   LONGLONG           _start;
+};
+
+/*
+________________________________________________________________________________
+
+Tracer
+
+Opt-in (--trace file, --trace-slow milliseconds). Completed requests slower
+than the threshold are appended to the file in Chrome trace_event format
+(chrome://tracing), one track per thread: the event loop, which parses and
+renders, and the readback encoder.
+
+Each thread knows the trace of the request it is working on, so the stage
+timers do not need to be handed the request. Without tracing, that pointer is
+always null and timers only feed the metrics.
+________________________________________________________________________________
+*/
+class Tracer
+{
+public:
+   // Starts tracing requests slower than threshold milliseconds into fileName
+   static void configure( const char* fileName, const DWORD threshold );
+   static bool isEnabled() { return _enabled; }
+
+   // Name of the calling thread's track
+   static void setThreadName( const char* name );
+
+   // Trace of the request the calling thread is working on, if any
+   static RequestTrace* getCurrent();
+   static void setCurrent( RequestTrace* trace );
+
+private:
+   friend class RequestTrace;
+   static void write( const RequestTrace& trace, const LONGLONG end );
+
+   static bool _enabled;
+};
+
+// Makes a trace current for a scope
+class TraceScope
+{
+public:
+   TraceScope( RequestTrace* trace ) : _previous(Tracer::getCurrent()) { Tracer::setCurrent( trace ); }
+   ~TraceScope() { Tracer::setCurrent( _previous ); }
+
+private:
+   RequestTrace* _previous;
+};
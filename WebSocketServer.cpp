@@ -0,0 +1,452 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#define _CRT_SECURE_NO_WARNINGS
+#define _USE_MATH_DEFINES
+
+#include "WebSocketServer.h"
+#include "QueryParser.h"
+#include "NumberParser.h"
+#include "AsyncLog.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+extern char *base64_encode(const unsigned char *data, size_t input_length, size_t *output_length);
+
+// Iterations of the frames rendered while the camera moves
+const int PREVIEW_ITERATIONS = 2;
+
+// Size of the handshake, query string included
+const size_t MAX_HEADER_SIZE = 8192;
+
+// Camera updates are a few floats, anything bigger is a protocol error
+const size_t MAX_MESSAGE_SIZE = 4096;
+
+// One camera update: dRotX, dRotY, dRotZ, dDistance
+const size_t DELTA_SIZE = 4*sizeof(float);
+
+// How far the camera can move from its initial distance, either way
+const float MAX_DOLLY = 50000.f;
+
+// RFC 6455
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+enum WebSocketOpcode
+{
+   opText   = 0x1,
+   opBinary = 0x2,
+   opClose  = 0x8,
+   opPing   = 0x9,
+   opPong   = 0xA
+};
+
+// ----------------------------------------------------------------------
+// Handshake
+// ----------------------------------------------------------------------
+static unsigned int rotateLeft( const unsigned int value, const int bits )
+{
+   return (value<<bits)|(value>>(32-bits));
+}
+
+// SHA-1 of the handshake key, only used for Sec-WebSocket-Accept
+static void sha1( const std::string& message, unsigned char digest[20] )
+{
+   unsigned int h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+   std::string data( message );
+   const unsigned long long bits = static_cast<unsigned long long>(message.size())*8;
+   data += static_cast<char>(0x80);
+   while( data.size()%64!=56 ) data += static_cast<char>(0);
+   for( int i(7); i>=0; --i ) data += static_cast<char>((bits>>(i*8))&0xFF);
+
+   for( size_t chunk(0); chunk<data.size(); chunk+=64 )
+   {
+      unsigned int w[80];
+      const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data())+chunk;
+      for( int i(0); i<16; ++i )
+      {
+         w[i] = (p[i*4]<<24)|(p[i*4+1]<<16)|(p[i*4+2]<<8)|p[i*4+3];
+      }
+      for( int i(16); i<80; ++i )
+      {
+         w[i] = rotateLeft( w[i-3]^w[i-8]^w[i-14]^w[i-16], 1 );
+      }
+
+      unsigned int a(h[0]), b(h[1]), c(h[2]), d(h[3]), e(h[4]);
+      for( int i(0); i<80; ++i )
+      {
+         unsigned int f, k;
+         if( i<20 )      { f = (b&c)|(~b&d);       k = 0x5A827999; }
+         else if( i<40 ) { f = b^c^d;              k = 0x6ED9EBA1; }
+         else if( i<60 ) { f = (b&c)|(b&d)|(c&d);  k = 0x8F1BBCDC; }
+         else            { f = b^c^d;              k = 0xCA62C1D6; }
+         const unsigned int t = rotateLeft( a, 5 )+f+e+k+w[i];
+         e = d;
+         d = c;
+         c = rotateLeft( b, 30 );
+         b = a;
+         a = t;
+      }
+      h[0] += a;
+      h[1] += b;
+      h[2] += c;
+      h[3] += d;
+      h[4] += e;
+   }
+
+   for( int i(0); i<20; ++i )
+   {
+      digest[i] = static_cast<unsigned char>((h[i/4]>>(24-(i%4)*8))&0xFF);
+   }
+}
+
+// Value of an HTTP header, header names are case insensitive
+static std::string getHeader( const std::string& header, const char* name )
+{
+   const size_t length = strlen(name);
+   size_t line = header.find( '\n' );
+   while( line!=std::string::npos )
+   {
+      ++line;
+      if( header.size()>line+length && _strnicmp( header.c_str()+line, name, length )==0 && header[line+length]==':' )
+      {
+         size_t first = line+length+1;
+         size_t last = header.find( '\n', first );
+         if( last==std::string::npos ) last = header.size();
+         while( first<last && header[first]==' ' ) ++first;
+         while( last>first && (header[last-1]=='\r' || header[last-1]==' ') ) --last;
+         return header.substr( first, last-first );
+      }
+      line = header.find( '\n', line );
+   }
+   return std::string();
+}
+
+// ----------------------------------------------------------------------
+// Session
+// ----------------------------------------------------------------------
+WebSocketSession::WebSocketSession( WebSocketServer& server, Lacewing::Server::Client& client )
+ : _server(server), _client(client), _template(nullptr), _tiles(new TileEncoder), _started(false), _inFlight(false),
+   _moved(false), _refined(false), _maxIterations(1), _dolly(0.f)
+{
+   _rotation.x = _rotation.y = _rotation.z = 0.f;
+   _server._nbSessions++;
+}
+
+WebSocketSession::~WebSocketSession()
+{
+   _server._scheduler.onDisconnect( *this );
+   _server._readback.onDisconnect( *this );
+   delete _template;
+   delete _tiles;
+   _server._nbSessions--;
+}
+
+bool WebSocketSession::receive( const char* data, const int size )
+{
+   _input.append( data, size );
+   if( _started ) return receiveMessages();
+
+   size_t end = _input.find( "\r\n\r\n" );
+   if( end==std::string::npos ) return _input.size()<MAX_HEADER_SIZE;
+
+   // Messages may follow the handshake in the same packet
+   const std::string header = _input.substr( 0, end );
+   _input.erase( 0, end+4 );
+
+   bool started(false);
+   try
+   {
+      started = handshake( header );
+   }
+   catch(...)
+   {
+   }
+   if( !started )
+   {
+      const char* response = 
+         "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n"
+         "Syntax: WebSocket GET /session?molecule=XXXX|model=XXXX|values=...";
+      _client.Send( response, static_cast<int>(strlen(response)) );
+      return false;
+   }
+   return receiveMessages();
+}
+
+bool WebSocketSession::handshake( const std::string& header )
+{
+   const std::string key = getHeader( header, "Sec-WebSocket-Key" );
+   if( key.empty() ) return false;
+
+   const char* first = header.c_str();
+   const char* last = first+header.find( '\n' );
+   if( last<first ) last = first+header.size();
+   if( last>first && last[-1]=='\r' ) --last;
+   if( !start( first, last ) ) return false;
+
+   unsigned char digest[20];
+   sha1( key+WEBSOCKET_GUID, digest );
+   size_t len(0);
+   char* accept = base64_encode( digest, sizeof(digest), &len );
+   if( !accept ) return false;
+
+   std::string response =
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: ";
+   response.append( accept, len );
+   response += "\r\n\r\n";
+   free( accept );
+   _client.Send( response.c_str(), static_cast<int>(response.size()) );
+
+   _started = true;
+   next( true );
+   return true;
+}
+
+bool WebSocketSession::start( const char* first, const char* last )
+{
+   // Request line: GET /path?query HTTP/1.1
+   if( last-first<4 || strncmp( first, "GET ", 4 )!=0 ) return false;
+   const char* target = first+4;
+   const char* end = target;
+   while( end<last && *end!=' ' ) ++end;
+   const char* query = target;
+   while( query<end && *query!='?' ) ++query;
+   if( query==end ) return false;
+
+   // Parameters point into the query buffers, which live as long as the session
+   _query.assign( query, end );
+   _scratch.resize( _query.size() );
+   _template = new RenderContext( *this, _server._kernel, 512, 512 );
+   RequestParams& params = _template->params;
+   QueryParser::parse( &_query[0], &_query[0]+_query.size(), params, &_scratch[0] );
+   if( params.count==0 ) return false;
+
+   // Sessions default to small frames
+   if( !params.has(rpSize) )
+   {
+      params.present |= (1u<<rpSize);
+      params.size = 0;
+   }
+
+   _template->description.assign( target, end );
+   if( !_server._parser( *_template ) ) return false;
+   _maxIterations = _template->iterations;
+   _rotation = params.rotation;
+   LOG_INFO(1, "WebSocket session " << _client.GetAddress().ToString() << " - " << _template->description );
+   return true;
+}
+
+bool WebSocketSession::receiveMessages()
+{
+   while( _input.size()>=2 )
+   {
+      const unsigned char* p = reinterpret_cast<const unsigned char*>(_input.data());
+      const bool fin = (p[0]&0x80)!=0;
+      const int opcode = p[0]&0x0F;
+
+      // Client messages are always masked
+      if( (p[1]&0x80)==0 ) return false;
+      size_t length = p[1]&0x7F;
+      size_t offset(2);
+      if( length==126 )
+      {
+         if( _input.size()<4 ) return true;
+         length = (p[2]<<8)|p[3];
+         offset = 4;
+      }
+      else if( length==127 )
+      {
+         // Never needed by camera updates
+         return false;
+      }
+      if( length>MAX_MESSAGE_SIZE ) return false;
+      if( _input.size()<offset+4+length ) return true;
+
+      std::string payload( _input, offset+4, length );
+      for( size_t i(0); i<length; ++i )
+      {
+         payload[i] ^= p[offset+i%4];
+      }
+      _input.erase( 0, offset+4+length );
+
+      switch( opcode )
+      {
+      case opBinary:
+         if( !fin ) return false;
+         onCameraDeltas( payload );
+         break;
+      case opPing:
+         send( opPong, payload.data(), payload.size() );
+         break;
+      case opClose:
+         send( opClose, payload.data(), (payload.size()<2) ? payload.size() : 2 );
+         return false;
+      case opText:
+      case opPong:
+         break;
+      default:
+         return false;
+      }
+   }
+   return true;
+}
+
+void WebSocketSession::onCameraDeltas( const std::string& payload )
+{
+   // Several updates may come in one message
+   for( size_t i(0); i+DELTA_SIZE<=payload.size(); i+=DELTA_SIZE )
+   {
+      float delta[4];
+      memcpy( delta, payload.data()+i, DELTA_SIZE );
+
+      // A single NaN would stick to the camera for the rest of the session
+      if( !isFinite(delta[0]) || !isFinite(delta[1]) || !isFinite(delta[2]) || !isFinite(delta[3]) ) continue;
+      _rotation.x = fmodf( _rotation.x+delta[0], 360.f );
+      _rotation.y = fmodf( _rotation.y+delta[1], 360.f );
+      _rotation.z = fmodf( _rotation.z+delta[2], 360.f );
+      _dolly += delta[3];
+      _dolly = (_dolly<-MAX_DOLLY) ? -MAX_DOLLY : (_dolly>MAX_DOLLY) ? MAX_DOLLY : _dolly;
+      if( _moved ) _server._nbCoalesced++;
+      _moved = true;
+   }
+   if( !_inFlight ) next( false );
+}
+
+void WebSocketSession::send( const int opcode, const char* data, const size_t size )
+{
+   // Server messages are not masked
+   unsigned char header[10];
+   int length(2);
+   header[0] = static_cast<unsigned char>(0x80|opcode);
+   if( size<126 )
+   {
+      header[1] = static_cast<unsigned char>(size);
+   }
+   else if( size<65536 )
+   {
+      header[1] = 126;
+      header[2] = static_cast<unsigned char>(size>>8);
+      header[3] = static_cast<unsigned char>(size);
+      length = 4;
+   }
+   else
+   {
+      header[1] = 127;
+      for( int i(0); i<8; ++i )
+      {
+         header[2+i] = static_cast<unsigned char>((static_cast<unsigned long long>(size)>>((7-i)*8))&0xFF);
+      }
+      length = 10;
+   }
+   _client.Send( reinterpret_cast<const char*>(header), length );
+   if( size!=0 ) _client.Send( data, static_cast<int>(size) );
+}
+
+void WebSocketSession::next( const bool refine )
+{
+   // Same scene, latest camera
+   RenderContext* ctx = _template->clone();
+   Vertex pose;
+   pose.x = _rotation.x/180.f*static_cast<float>(M_PI);
+   pose.y = _rotation.y/180.f*static_cast<float>(M_PI);
+   pose.z = _rotation.z/180.f*static_cast<float>(M_PI);
+   ctx->poses.assign( 1, pose );
+   ctx->dolly = _dolly;
+   ctx->tiles = _tiles;
+   _tiles = nullptr;
+   ctx->iterations = (refine || _maxIterations<PREVIEW_ITERATIONS) ? _maxIterations : PREVIEW_ITERATIONS;
+
+   _inFlight = true;
+   _moved = false;
+   _refined = refine;
+   _server._scheduler.submit( ctx );
+}
+
+void WebSocketSession::onFrame( const std::string& image, TileEncoder* tiles )
+{
+   _inFlight = false;
+   _tiles = tiles;
+   if( _tiles )
+   {
+      _server._nbTiles += _tiles->getNbTiles();
+      _server._nbTilesSent += _tiles->getNbSent();
+   }
+   if( !image.empty() ) send( opBinary, image.data(), image.size() );
+
+   // Render the camera as it is now, or refine the last preview
+   if( _moved ) next( false );
+   else if( !_refined ) next( true );
+}
+
+void WebSocketSession::onFrameDropped()
+{
+   // The scene of the session can no longer be rendered
+   _inFlight = false;
+   _client.Disconnect();
+}
+
+// ----------------------------------------------------------------------
+// Server
+// ----------------------------------------------------------------------
+WebSocketServer* WebSocketServer::_instance = nullptr;
+
+WebSocketServer::WebSocketServer( Lacewing::Pump& pump, RenderScheduler& scheduler, FrameReadback& readback,
+   KernelContext& kernel, RequestParser parser )
+ : _server(pump), _scheduler(scheduler), _readback(readback), _kernel(kernel), _parser(parser),
+   _nbSessions(0), _nbCoalesced(0), _nbTiles(0), _nbTilesSent(0)
+{
+   _instance = this;
+   _server.onConnect( onConnect );
+   _server.onReceive( onReceive );
+   _server.onDisconnect( onDisconnect );
+}
+
+void WebSocketServer::host( const int port )
+{
+   _server.DisableNagling();
+   _server.Host( port );
+}
+
+void WebSocketServer::onConnect( Lacewing::Server& server, Lacewing::Server::Client& client )
+{
+   client.Tag = new WebSocketSession( *_instance, client );
+}
+
+void WebSocketServer::onReceive( Lacewing::Server& server, Lacewing::Server::Client& client, const char* data, int size )
+{
+   WebSocketSession* session = static_cast<WebSocketSession*>(client.Tag);
+   if( session && !session->receive( data, size ) ) client.Disconnect();
+}
+
+void WebSocketServer::onDisconnect( Lacewing::Server& server, Lacewing::Server::Client& client )
+{
+   delete static_cast<WebSocketSession*>(client.Tag);
+   client.Tag = nullptr;
+}
@@ -0,0 +1,150 @@
+/*
+* Molecular Visualization HTTP Server
+* Copyright (C) 2011-2014 Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* aint with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+* Author: Cyrille Favreau <cyrille_favreau@hotmail.com>
+*
+*/
+
+
+#pragma once
+
+#include <windows.h>
+#include <lacewing.h>
+
+#include <string>
+#include <vector>
+
+#include "FrameReadback.h"
+#include "RenderContext.h"
+#include "RenderScheduler.h"
+
+class WebSocketServer;
+
+/*
+________________________________________________________________________________
+
+Interactive session
+
+One WebSocket client. The query string of the handshake is parsed once: the
+scene and its parameters stay on the server for the life of the connection,
+so a camera move only costs a few bytes instead of a full get request.
+
+The client sends binary messages of four little endian floats: rotation
+deltas around x, y and z (degrees) and a distance delta. Every rendered frame
+is sent back as a binary message holding the tiles that changed since the
+previous frame (see TileEncoder). Nothing is sent when no tile changed.
+
+A single frame is in flight at a time. Updates received meanwhile are folded
+into the camera of the session, and only the latest camera is rendered when
+the frame comes back: intermediate positions are never rendered. While the
+camera moves, frames are rendered with few iterations. Once it stops, a last
+frame is rendered at the quality of the request.
+________________________________________________________________________________
+*/
+class WebSocketSession : public FrameListener
+{
+public:
+   WebSocketSession( WebSocketServer& server, Lacewing::Server::Client& client );
+   ~WebSocketSession();
+
+   // Handshake, then WebSocket frames. Returns false when the client has to
+   // be disconnected.
+   bool receive( const char* data, const int size );
+
+   virtual void onFrame( const std::string& image, TileEncoder* tiles );
+   virtual void onFrameDropped();
+
+private:
+   bool handshake( const std::string& header );
+   bool start( const char* first, const char* last );
+   bool receiveMessages();
+   void onCameraDeltas( const std::string& payload );
+   void send( const int opcode, const char* data, const size_t size );
+   void next( const bool refine );
+
+private:
+   WebSocketServer& _server;
+   Lacewing::Server::Client& _client;
+
+   std::string       _input;    // Handshake, then incomplete WebSocket frames
+   std::vector<char> _query;    // Parameters of the session point in there
+   std::vector<char> _scratch;
+   RenderContext*    _template; // Parsed scene, copied for each frame
+   TileEncoder*      _tiles;    // Null while a frame is in flight
+
+   bool   _started;
+   bool   _inFlight;
+   bool   _moved;     // Camera changed since the last submitted frame
+   bool   _refined;   // Last submitted frame was at full quality
+   int    _maxIterations;
+   Vertex _rotation;  // Degrees
+   float  _dolly;
+};
+
+/*
+________________________________________________________________________________
+
+WebSocket server
+
+Serves interactive sessions on a port of its own (RFC 6455, binary messages
+only). The handshake is a GET with the query string of get, for instance
+ws://host:10002/session?molecule=1BNA&quality=8
+________________________________________________________________________________
+*/
+class WebSocketServer
+{
+public:
+   // Fills in the scene of a session from its parsed parameters
+   typedef bool (*RequestParser)( RenderContext& ctx );
+
+public:
+   WebSocketServer( Lacewing::Pump& pump, RenderScheduler& scheduler, FrameReadback& readback,
+      KernelContext& kernel, RequestParser parser );
+
+   void host( const int port );
+
+   int getNbSessions() const { return _nbSessions; }
+
+   // Camera updates folded into a later one instead of being rendered
+   int getNbCoalesced() const { return _nbCoalesced; }
+
+   // Tiles of the frames rendered for sessions, and how many were sent
+   long long getNbTiles() const { return _nbTiles; }
+   long long getNbTilesSent() const { return _nbTilesSent; }
+
+private:
+   friend class WebSocketSession;
+
+   static void onConnect( Lacewing::Server& server, Lacewing::Server::Client& client );
+   static void onReceive( Lacewing::Server& server, Lacewing::Server::Client& client, const char* data, int size );
+   static void onDisconnect( Lacewing::Server& server, Lacewing::Server::Client& client );
+
+   static WebSocketServer* _instance;
+
+private:
+   Lacewing::Server _server;
+   RenderScheduler& _scheduler;
+   FrameReadback&   _readback;
+   KernelContext&   _kernel;
+   RequestParser    _parser;
+   int              _nbSessions;
+   int              _nbCoalesced;
+   long long        _nbTiles;
+   long long        _nbTilesSent;
+};